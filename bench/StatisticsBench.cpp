@@ -0,0 +1,215 @@
+// Residual + statistics phase of the lossless HFM encoder, timed two ways:
+//   separate  - residual planes first, then one statistics pass over each
+//               finished plane (the encoder before StatisticsAccumulator)
+//   per row   - each residual row is counted right after it is produced,
+//               as buildResidualPlanes does now
+// Both must give the same statistics. Usage: statistics_bench [image.ppm ...]
+// with 8-bit PGM/PPM files; without arguments a 4000x3000 RGB image of smooth
+// gradients and noise is used. Times are the best of kRepeats runs on one core.
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ChannelStatistics.hpp"
+#include "PixelKernels.hpp"
+
+namespace {
+
+constexpr int kRepeats = 15;
+
+struct Image {
+    std::string name;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<std::uint8_t> pixels;
+};
+
+bool readToken(std::istream& in, std::string& token) {
+    // PNM header token; comments run from '#' to the end of the line
+    token.clear();
+    char c = 0;
+    while (in.get(c)) {
+        if (c == '#') {
+            std::string comment;
+            std::getline(in, comment);
+        } else if (!std::isspace(static_cast<unsigned char>(c))) {
+            token.push_back(c);
+            break;
+        }
+    }
+    while (in.get(c) && !std::isspace(static_cast<unsigned char>(c))) {
+        token.push_back(c);
+    }
+    return !token.empty();
+}
+
+bool loadPnm(const std::string& path, Image& image) {
+    // 8-bit P2/P3 (ASCII) and P5/P6 (binary) files
+    std::ifstream in(path, std::ios::binary);
+    std::string magic, width, height, maxValue;
+    if (!in || !readToken(in, magic) || (magic != "P2" && magic != "P3" && magic != "P5" && magic != "P6") ||
+        !readToken(in, width) || !readToken(in, height) || !readToken(in, maxValue) || maxValue != "255") {
+        return false;
+    }
+    image.name = path;
+    image.width = std::atoi(width.c_str());
+    image.height = std::atoi(height.c_str());
+    image.channels = magic == "P3" || magic == "P6" ? 3 : 1;
+    if (image.width <= 0 || image.height <= 0) {
+        return false;
+    }
+    image.pixels.resize(static_cast<std::size_t>(image.width) * image.height * image.channels);
+    if (magic == "P5" || magic == "P6") {
+        in.read(reinterpret_cast<char*>(image.pixels.data()), static_cast<std::streamsize>(image.pixels.size()));
+        return in.gcount() == static_cast<std::streamsize>(image.pixels.size());
+    }
+    for (auto& sample : image.pixels) {
+        int value = 0;
+        if (!(in >> value)) {
+            return false;
+        }
+        sample = static_cast<std::uint8_t>(value);
+    }
+    return true;
+}
+
+Image syntheticImage() {
+    Image image{"4000x3000 RGB (合成)", 4000, 3000, 3, {}};
+    image.pixels.resize(static_cast<std::size_t>(image.width) * image.height * 3);
+    std::mt19937 rng(33);
+    std::uniform_int_distribution<int> noise(-3, 3);
+    std::size_t i = 0;
+    for (int row = 0; row < image.height; ++row) {
+        for (int col = 0; col < image.width; ++col) {
+            for (int ch = 0; ch < 3; ++ch) {
+                const int value = (row / 12 + col / (8 + 4 * ch)) % 256 + noise(rng);
+                image.pixels[i++] = static_cast<std::uint8_t>(std::clamp(value, 0, 255));
+            }
+        }
+    }
+    return image;
+}
+
+ChannelStatistics gatherStatistics(const std::vector<std::uint8_t>& data) {
+    // the former separate pass: a run of n equal bytes adds n to one bin
+    ChannelStatistics stats;
+    const std::size_t size = data.size();
+    std::size_t begin = 0;
+    while (begin < size) {
+        const std::uint8_t value = data[begin];
+        std::size_t end = begin + 1;
+        while (end < size && data[end] == value) {
+            ++end;
+        }
+        stats.histogram[value] += end - begin;
+        std::size_t length = end - begin;
+        std::uint64_t bytes = 2;
+        while (length >= 0x80) {
+            length >>= 7;
+            ++bytes;
+        }
+        stats.runLengthBytes += bytes;
+        begin = end;
+    }
+    return stats;
+}
+
+using Planes = std::vector<std::vector<std::uint8_t>>;
+using Statistics = std::vector<ChannelStatistics>;
+
+template <typename Row>
+void residualRows(const Image& image, Planes& planes, Row countRow) {
+    std::uint8_t* pointers[3] = {};
+    for (int row = 0; row < image.height; ++row) {
+        const std::size_t offset = static_cast<std::size_t>(row) * image.width;
+        for (int ch = 0; ch < image.channels; ++ch) {
+            pointers[ch] = planes[static_cast<std::size_t>(ch)].data() + offset;
+        }
+        PixelKernels::leftDifference(image.pixels.data() + offset * image.channels, image.width, image.channels, pointers);
+        countRow(pointers);
+    }
+}
+
+Statistics separatePasses(const Image& image, Planes& planes) {
+    residualRows(image, planes, [](std::uint8_t* const*) {});
+    Statistics statistics;
+    for (const auto& plane : planes) {
+        statistics.push_back(gatherStatistics(plane));
+    }
+    return statistics;
+}
+
+Statistics perRow(const Image& image, Planes& planes) {
+    std::vector<StatisticsAccumulator> accumulators(static_cast<std::size_t>(image.channels));
+    residualRows(image, planes, [&](std::uint8_t* const* pointers) {
+        for (int ch = 0; ch < image.channels; ++ch) {
+            accumulators[static_cast<std::size_t>(ch)].add(pointers[ch], static_cast<std::size_t>(image.width));
+        }
+    });
+    Statistics statistics;
+    for (const auto& accumulator : accumulators) {
+        statistics.push_back(accumulator.finish());
+    }
+    return statistics;
+}
+
+template <typename Method>
+double bestMilliseconds(const Image& image, Method method, Statistics& statistics) {
+    Planes planes(static_cast<std::size_t>(image.channels),
+                  std::vector<std::uint8_t>(static_cast<std::size_t>(image.width) * image.height));
+    double best = 1e300;
+    for (int repeat = 0; repeat < kRepeats; ++repeat) {
+        const auto start = std::chrono::steady_clock::now();
+        statistics = method(image, planes);
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+bool sameStatistics(const Statistics& lhs, const Statistics& rhs) {
+    return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const auto& a, const auto& b) {
+        return a.histogram == b.histogram && a.runLengthBytes == b.runLengthBytes;
+    });
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<Image> images;
+    for (int i = 1; i < argc; ++i) {
+        Image image;
+        if (!loadPnm(argv[i], image)) {
+            std::cerr << "无法读取 " << argv[i] << "（仅支持 8 位 PGM/PPM）\n";
+            return EXIT_FAILURE;
+        }
+        images.push_back(std::move(image));
+    }
+    if (images.empty()) {
+        images.push_back(syntheticImage());
+    }
+
+    std::cout << "kernel level: " << PixelKernels::levelName(PixelKernels::activeLevel()) << ", best of " << kRepeats
+              << "\n";
+    bool identical = true;
+    for (const auto& image : images) {
+        Statistics separate;
+        Statistics rows;
+        const double before = bestMilliseconds(image, separatePasses, separate);
+        const double after = bestMilliseconds(image, perRow, rows);
+        identical = identical && sameStatistics(separate, rows);
+        std::cout << std::fixed << std::setprecision(2) << image.name << "  separate " << before << " ms  per row " << after
+                  << " ms" << (sameStatistics(separate, rows) ? "" : "  统计结果不一致") << "\n";
+    }
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Statistics the HFM encoder needs to pick a coding for one residual channel.
+struct ChannelStatistics {
+    std::array<std::uint64_t, 256> histogram{};
+    std::uint64_t runLengthBytes = 0;   // exact size of the RunLength payload
+};
+
+// Histogram and run statistics of one channel, fed a row at a time while the
+// row is still in cache. Runs may continue across rows. Rows are counted byte
+// by byte into four histogram banks, so equal neighbouring residuals do not
+// wait on each other's increment; rows that were mostly long runs last time
+// are counted a run at a time instead.
+class StatisticsAccumulator {
+public:
+    void add(const std::uint8_t* data, std::size_t size);
+    ChannelStatistics finish() const;
+
+private:
+    void addRuns(const std::uint8_t* data, std::size_t size);
+    void addBytes(const std::uint8_t* data, std::size_t size);
+
+    std::array<std::array<std::uint64_t, 256>, 4> banks_{};
+    std::uint64_t runLengthBytes_ = 0;
+    std::size_t runLength_ = 0;     // length of the run still open at the end of the last row
+    std::uint8_t runValue_ = 0;
+    std::size_t lastRowRuns_ = 0;
+};
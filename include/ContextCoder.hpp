@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Archive-level entropy coder of the HF2 format. Every sample is predicted from
+// its already coded neighbours with CALIC's gradient-adjusted predictor, the
+// prediction is corrected by the mean error seen in the same texture context,
+// and the remaining error is coded bit by bit with an adaptive binary range
+// coder whose probabilities are selected by the local error energy. Colour
+// images code the green channel first; red and blue also take the green
+// prediction error at the same pixel into account.
+//
+// Several times slower than the Huffman planes, in exchange for smaller files.
+namespace ContextCoder {
+
+// lossless payload for an 8-bit image with 1 or 3 channels
+std::vector<std::uint8_t> encode(const cv::Mat& image);
+
+// inverse of encode; throws if the payload is damaged
+cv::Mat decode(const std::uint8_t* data, std::size_t size, int width, int height, int channels);
+
+} // namespace ContextCoder
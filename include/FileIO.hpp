@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Asynchronous whole-file I/O for batch runs over many files. Reads are kept
+// up to queueDepth files ahead of the caller and writes are queued without
+// waiting for them to land. On Linux the requests go through io_uring when the
+// kernel allows it; otherwise worker threads serve them with pread/pwrite.
+namespace FileIO {
+
+enum class Backend {
+    Auto,       // io_uring if available, worker threads otherwise
+    IoUring,
+    Threads,
+};
+
+const char* backendName(Backend backend);
+
+class BatchIO {
+public:
+    BatchIO(std::vector<std::string> inputs, unsigned queueDepth, Backend backend = Backend::Auto);
+    ~BatchIO();     // waits for every request still in flight
+    BatchIO(const BatchIO&) = delete;
+    BatchIO& operator=(const BatchIO&) = delete;
+
+    Backend backend() const;
+
+    // contents of the next input, in the order given; false once all were returned
+    bool nextInput(std::vector<char>& data);
+
+    // queues a write of data to path; blocks only while queueDepth writes are in flight
+    void write(const std::string& path, std::vector<char> data);
+
+    // waits for every queued write; throws on the first failed one
+    void finish();
+
+private:
+    struct Request;
+    class Engine;
+    class UringEngine;
+    class ThreadEngine;
+
+    void fillReadAhead();
+    void complete(Request* request);
+    void drain();
+
+    std::unique_ptr<Engine> engine_;
+    std::vector<std::string> inputs_;
+    std::vector<std::unique_ptr<Request>> reads_;   // indexed like inputs_
+    Backend backend_ = Backend::Threads;
+    unsigned depth_ = 1;
+    std::size_t nextRead_ = 0;      // next input to submit
+    std::size_t nextResult_ = 0;    // next input to hand out
+    unsigned readsInFlight_ = 0;
+    unsigned writesInFlight_ = 0;
+    std::string writeError_;
+};
+
+// Read-only view of a whole file. Mapped into memory where the platform allows
+// it, so only the pages that are touched get read; otherwise the file is loaded.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<char> buffer_;     // contents when the file could not be mapped
+};
+
+} // namespace FileIO
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Longest code the HFM format allows: canonical codes are built in 32-bit
+// integers, and decoders reject longer lengths as corrupt.
+constexpr std::uint8_t kMaxCodeLength = 31;
+
+struct HuffmanTable {
+    std::array<std::uint8_t, 256> lengths{};
+    std::array<std::uint32_t, 256> codes{};
+    std::uint8_t maxLength = 0; // maximum code length
+};
+
+// Huffman code lengths for symbol counts; symbols with count 0 get no code.
+// Counts so skewed that the tree would be deeper than kMaxCodeLength (which
+// takes planes of billions of samples) are halved until it is not.
+std::array<std::uint8_t, 256> buildCodeLengths(const std::array<std::uint64_t, 256>& frequencies);
+
+// canonical codes for the lengths, assigned in order of length, then symbol
+HuffmanTable buildCanonicalTable(const std::array<std::uint8_t, 256>& lengths);
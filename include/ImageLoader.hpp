@@ -1,7 +1,11 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
+#include <fstream>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -15,13 +19,178 @@ struct ImageData {
     cv::Mat image;
 };
 
+// How one channel of residuals is stored in an HFM file.
+enum class ChannelCoding : std::uint8_t {
+    Stored = 0,     // raw residual bytes
+    RunLength = 1,  // (value, LEB128 run length) pairs
+    Huffman = 2,    // canonical Huffman code, 256-byte length table
+    Dictionary = 3, // canonical Huffman code from a shared dictionary, no table
+};
+
+// Huffman tables trained on the residuals of a corpus of images and shared by
+// every file compressed against them. Files reference the dictionary by ID,
+// so small images no longer pay 256 bytes of code lengths per channel.
+class HuffmanDictionary {
+public:
+    static HuffmanDictionary train(const std::vector<std::string>& samplePaths);
+    static std::shared_ptr<const HuffmanDictionary> load(const std::string& path);     // cached per process
+
+    HuffmanDictionary(HuffmanDictionary&&) noexcept;
+    HuffmanDictionary& operator=(HuffmanDictionary&&) noexcept;
+    HuffmanDictionary(const HuffmanDictionary&) = delete;
+    HuffmanDictionary& operator=(const HuffmanDictionary&) = delete;
+    ~HuffmanDictionary();
+
+    void save(const std::string& path) const;
+    std::uint32_t id() const { return id_; }
+
+private:
+    friend class ImageLoader;
+    struct Tables;
+    HuffmanDictionary();
+    std::unique_ptr<Tables> tables_;    // encode tables and decode tries, built once
+    std::uint32_t id_ = 0;
+};
+
+enum class CompressionLevel {
+    Default,    // per-plane Huffman / run-length coding of left differences
+    Archive,    // context-modelled arithmetic coding: slower, smaller; lossless only
+};
+
+struct CompressionOptions {
+    int nearLossless = 0;   // JPEG-LS NEAR: max per-sample error, 0 = lossless
+    CompressionLevel level = CompressionLevel::Default;
+    std::shared_ptr<const HuffmanDictionary> dictionary;    // null: every Huffman plane carries its own table
+};
+
+struct CompressionSummary {
+    int channels = 0;       // coded planes: 1 for palette images
+    int paletteSize = 0;    // 0 when the image was not palette coded
+    int nearLossless = 0;
+    bool archive = false;   // one arithmetic-coded payload, counted in payloadBytes[0]
+    std::array<ChannelCoding, 3> coding{};
+    std::array<std::uint64_t, 3> payloadBytes{};    // bytes per channel including its table
+};
+
+struct SequenceOptions {
+    int keyframeInterval = 30;  // every n-th frame is coded on its own, for seeking
+};
+
+struct SequenceSummary {
+    int frames = 0;
+    int keyframes = 0;
+    std::uint64_t rawBytes = 0;         // samples of all frames
+    std::uint64_t compressedBytes = 0;  // size of the written file
+};
+
+// Scratch buffers reused by consecutive compress calls. They grow to the
+// largest image seen, so steady-state batch encoding does not allocate.
+class CompressionContext {
+public:
+    CompressionContext();
+    ~CompressionContext();
+    CompressionContext(CompressionContext&&) noexcept;
+    CompressionContext& operator=(CompressionContext&&) noexcept;
+    CompressionContext(const CompressionContext&) = delete;
+    CompressionContext& operator=(const CompressionContext&) = delete;
+
+private:
+    friend class ImageLoader;
+    struct Buffers;
+    std::unique_ptr<Buffers> buffers_;
+};
+
+// Decoder counterpart of CompressionContext: Huffman trie, payload and channel buffers.
+class DecompressionContext {
+public:
+    DecompressionContext();
+    ~DecompressionContext();
+    DecompressionContext(DecompressionContext&&) noexcept;
+    DecompressionContext& operator=(DecompressionContext&&) noexcept;
+    DecompressionContext(const DecompressionContext&) = delete;
+    DecompressionContext& operator=(const DecompressionContext&) = delete;
+
+private:
+    friend class ImageLoader;
+    struct Buffers;
+    std::unique_ptr<Buffers> buffers_;
+};
+
+// Row-at-a-time reading of a PPM/PGM file, for images too large to hold in memory.
+class ImageReader {
+public:
+    explicit ImageReader(const std::string& path);
+
+    const ImageData& header() const { return header_; }    // image stays empty
+    int channels() const { return header_.magic == "P2" ? 1 : 3; }
+    void readRow(cv::Mat& row);     // next row as a 1 x width matrix
+    void readRows(cv::Mat& band, int count);    // next count rows as one count x width matrix
+
+private:
+    std::ifstream ifs_;
+    ImageData header_;
+    int nextRow_ = 0;
+};
+
+// Row-at-a-time counterpart of ImageLoader::save.
+class ImageWriter {
+public:
+    ImageWriter(const std::string& path, int width, int height, int channels, int maxValue, bool useBinaryColor);
+
+    void writeRow(const cv::Mat& row);
+    void finish();  // checks that every row was written and flushed
+
+private:
+    std::ofstream ofs_;
+    std::string path_;
+    int width_ = 0;
+    int height_ = 0;
+    int channels_ = 0;
+    bool binary_ = false;
+    int rowsWritten_ = 0;
+};
+
+class SparseImage;
+
 class ImageLoader {
 public:
     static ImageData load(const std::string& path);
     static void save(const std::string& path, const cv::Mat& image, int maxValue = 255, bool useBinaryColor = true);
-    static void compress(const std::string& path, const cv::Mat& image, int maxValue = 255);
-    static ImageData decompress(const std::string& path);
+    static CompressionSummary compress(const std::string& path, const cv::Mat& image, int maxValue = 255,
+                                       const CompressionOptions& options = {});
+    static CompressionSummary compress(const std::string& path, const cv::Mat& image, int maxValue, CompressionContext& context,
+                                       const CompressionOptions& options = {});
+    // lossless only; writes the same file as compressing the dense image
+    static CompressionSummary compress(const std::string& path, const SparseImage& image, int maxValue,
+                                       const CompressionOptions& options = {});
+    static ImageData decompress(const std::string& path, const HuffmanDictionary* dictionary = nullptr);
+    static ImageData decompress(const std::string& path, DecompressionContext& context,
+                                const HuffmanDictionary* dictionary = nullptr);
     static void saveTriples(const std::string& path, const cv::Mat& image, int maxValue = 255);
+
+    // In-memory counterparts of the calls above, for callers that do their own
+    // file I/O (batch runs go through FileIO). Formats are byte-identical.
+    static ImageData loadFromMemory(const std::vector<char>& bytes);
+    static std::vector<char> saveToMemory(const cv::Mat& image, int maxValue = 255, bool useBinaryColor = true);
+    static CompressionSummary compressToMemory(std::vector<char>& bytes, const cv::Mat& image, int maxValue,
+                                               CompressionContext& context, const CompressionOptions& options = {});
+    static ImageData decompressFromMemory(const std::vector<char>& bytes, DecompressionContext& context,
+                                          const HuffmanDictionary* dictionary = nullptr);
+    // decodes in place: the payloads are read from data without being copied
+    static ImageData decompressFromMemory(const char* data, std::size_t size, DecompressionContext& context,
+                                          const HuffmanDictionary* dictionary = nullptr);
+    // dimensions, channels (as magic) and maxValue of an HF2/HFM file, image left empty
+    static ImageData compressedHeader(const char* data, std::size_t size);
+
+    // Multi-frame streams: concatenated PPM/PGM frames of one size, coded as an
+    // HFS sequence where frames between keyframes are predicted from the previous one.
+    static std::vector<ImageData> loadFrames(const std::string& path);
+    static void saveFrames(const std::string& path, const std::vector<ImageData>& frames);
+    static bool isSequence(const std::string& path);
+    static SequenceSummary compressSequence(const std::string& path, const std::vector<ImageData>& frames,
+                                            const SequenceOptions& options = {});
+    static std::vector<ImageData> decompressSequence(const std::string& path, int firstFrame = 0, int lastFrame = -1);  // inclusive, -1 = last
+
     struct PixelTriple {
         int row = 0;
         int col = 0;
@@ -29,4 +198,11 @@ public:
         std::array<std::uint8_t, 3> value{0, 0, 0};
     };
     static std::vector<PixelTriple> toTriples(const cv::Mat& image);    // convert matrix to pixel triples
+    // toTriples in one pass, or nullopt as soon as more than maxTriples pixels are non-zero
+    static std::optional<std::vector<PixelTriple>> toTriples(const cv::Mat& image, std::size_t maxTriples);
+
+private:
+    static CompressionSummary compressTo(std::ostream& os, const cv::Mat& image, int maxValue, CompressionContext& context,
+                                         const CompressionOptions& options);
+    static ImageData decompressFrom(std::istream& is, DecompressionContext& context, const HuffmanDictionary* dictionary);
 };
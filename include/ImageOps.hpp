@@ -1,12 +1,43 @@
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "SparseImage.hpp"
+
 namespace ImageOps {
 
+// Source of image rows, produced top to bottom. Chains of these process
+// images that are too large to hold in memory one row at a time.
+class RowSource {
+public:
+    virtual ~RowSource() = default;
+
+    virtual int rows() const = 0;
+    virtual int cols() const = 0;
+    virtual int channels() const = 0;
+    virtual void nextRow(cv::Mat& row) = 0;     // 1 x cols, 8-bit
+};
+
 cv::Mat toGrayscale(const cv::Mat& image);
 
+// Bilinear scaling (other than halving) of 8-bit images and nearest scaling of
+// 8-bit RGB run a cached ResamplePlan (Resampler.hpp); the rest goes to cv::resize.
 cv::Mat scaleByPercentage(const cv::Mat& image, double scale, int interpolation = cv::INTER_LINEAR);
 
+// side length after scaling, rounded like cv::resize; throws if it is not a valid size
+int scaledLength(int length, double scale);
+
+// Row-streaming versions of toGrayscale and scaleByPercentage (bilinear only).
+std::unique_ptr<RowSource> grayscaleRows(std::unique_ptr<RowSource> source);
+std::unique_ptr<RowSource> scaleRowsByPercentage(std::unique_ptr<RowSource> source, double scale);
+
+// Sparse versions, touching only the non-zero pixels. Results match the dense
+// ones exactly; scaling supports nearest, bilinear and (shrinking only) area.
+SparseImage toGrayscale(const SparseImage& image);
+SparseImage scaleByPercentage(const SparseImage& image, double scale, int interpolation = cv::INTER_LINEAR);
+
 } // namespace ImageOps
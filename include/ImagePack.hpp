@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "FileIO.hpp"
+#include "ImageLoader.hpp"
+
+// Many HF2/HFM files stored back to back in one file, followed by an index of
+// fixed-size entries sorted by member name. Opening a pack maps it and reads
+// only the trailer; looking a member up touches O(log n) index entries and
+// decoding it reads the member's bytes in place.
+struct PackEntry {
+    std::string_view name;      // points into the mapped pack
+    std::uint64_t offset = 0;   // of the member's compressed bytes
+    std::uint64_t size = 0;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+};
+
+class PackWriter {
+public:
+    explicit PackWriter(const std::string& path);
+
+    // appends one compressed image (the contents of an .hfm file) under name
+    void add(const std::string& name, const char* data, std::size_t size);
+    void add(const std::string& name, const std::vector<char>& compressed) {
+        add(name, compressed.data(), compressed.size());
+    }
+    // writes the index; the pack is incomplete until this returns
+    void finish();
+
+    std::size_t size() const { return entries_.size(); }
+
+private:
+    struct Pending {
+        std::string name;
+        std::uint64_t offset = 0;
+        std::uint64_t size = 0;
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+        std::uint8_t channels = 0;
+    };
+
+    std::string path_;
+    std::ofstream ofs_;
+    std::uint64_t position_ = 0;
+    std::vector<Pending> entries_;
+};
+
+class ImagePack {
+public:
+    explicit ImagePack(const std::string& path);
+
+    // true when path starts with the pack magic
+    static bool isPack(const std::string& path);
+
+    std::size_t size() const { return count_; }
+    PackEntry entry(std::size_t index) const;     // members are ordered by name
+    // index of the member called name, or size() if there is none
+    std::size_t find(std::string_view name) const;
+
+    ImageData decode(std::size_t index, DecompressionContext& context, const HuffmanDictionary* dictionary = nullptr) const;
+
+private:
+    FileIO::MappedFile file_;
+    const char* index_ = nullptr;
+    const char* names_ = nullptr;
+    std::size_t count_ = 0;
+    std::uint64_t dataEnd_ = 0;     // members lie in [header, dataEnd_)
+    std::uint32_t namesSize_ = 0;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Row kernels of the HFM codec (left-difference residuals and their inverse)
+// and of the separable resampler. The widest implementation the CPU supports
+// is selected on first use; every level produces exactly the same bytes as
+// the scalar code.
+namespace PixelKernels {
+
+enum class Level {
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+Level activeLevel();
+Level detectedLevel();          // the widest level this CPU supports
+void setLevel(Level level);     // capped at detectedLevel(); not thread-safe, meant for comparisons
+const char* levelName(Level level);
+
+// planes[ch][col] = row[col][ch] - row[col - 1][ch] (mod 256); column 0 is copied as is
+void leftDifference(const std::uint8_t* row, int width, int channels, std::uint8_t* const* planes);
+
+// inverse of leftDifference: per-plane prefix sums (mod 256) interleaved into row.
+// row may alias planes[0] when channels == 1.
+void reconstructInterleaved(const std::uint8_t* const* planes, int width, int channels, std::uint8_t* row);
+
+// number of pixels in the row with any non-zero channel
+std::size_t countNonZeroPixels(const std::uint8_t* row, int width, int channels);
+
+// Horizontal pass of the resampler, with 11-bit fixed-point weights:
+// out[i] = (src[offsets[i]] * weights[2i] + src[offsets[i] + step] * weights[2i + 1]) >> 4.
+// step is at most 3; the 8 bytes at src + offsets[i] must be readable for i < gatherSafe.
+// With step == 3 the samples come in pixels of 3 consecutive offsets sharing one weight pair.
+void resampleRow(const std::uint8_t* src, const std::int32_t* offsets, const std::int16_t* weights, int step,
+                 std::size_t count, std::size_t gatherSafe, std::int16_t* out);
+
+// Horizontal pass for samples that lie close together, as when enlarging: count is
+// a multiple of 8, group g of 8 samples reads only the 16 bytes at src + windows[g],
+// and its 16 shuffle bytes give the positions of its (tap 0, tap 1) pairs there.
+void resampleRowLocal(const std::uint8_t* src, const std::int32_t* windows, const std::int16_t* weights,
+                      const std::uint8_t* shuffles, std::size_t count, std::int16_t* out);
+
+// Vertical pass of the resampler, rounded like the vector path of cv::resize:
+// out[i] = saturate(((top[i] * topWeight >> 16) + (bottom[i] * bottomWeight >> 16) + 2) >> 2)
+void blendRows(const std::int16_t* top, const std::int16_t* bottom, std::int16_t topWeight, std::int16_t bottomWeight,
+               std::size_t count, std::uint8_t* out);
+
+// index of the first non-zero byte of data[0, size), or size if there is none
+std::size_t findNonZero(const std::uint8_t* data, std::size_t size);
+
+} // namespace PixelKernels
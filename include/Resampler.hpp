@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace ImageOps {
+
+// Precomputed nearest / bilinear resize of 8-bit images with 1 or 3 channels
+// from one source size by one scale. Source positions and weights follow
+// cv::resize (pixel-centre mapping, 11-bit fixed-point weights, the same
+// rounding), so results match it. For bilinear halving cv::resize averages
+// 2x2 blocks instead; the blend gives the same values except on blocks cut
+// short by an odd side, which halving plans round as cv::resize does.
+// Bilinear plans are separable: a horizontal pass turns each needed source
+// row into 16-bit samples, and a vertical pass blends two of them into an
+// output row. Output rows are split into bands across a pool of worker threads.
+class ResamplePlan {
+public:
+    ResamplePlan(cv::Size source, double scale, int interpolation, int channels);
+
+    cv::Size sourceSize() const { return source_; }
+    cv::Size destinationSize() const { return destination_; }
+    int channels() const { return channels_; }
+
+    // source must have sourceSize() and channels(); destination is reallocated as needed
+    void execute(const cv::Mat& source, cv::Mat& destination) const;
+
+    // Bilinear plans one row at a time, for callers that see the source row by
+    // row: output row y blends the horizontal passes of the two source rows
+    // sourceRows(y). Passes hold rowSamples() samples.
+    std::pair<int, int> sourceRows(int y) const;
+    std::size_t rowSamples() const { return offsets_.size(); }
+    void resampleRow(const std::uint8_t* in, std::int16_t* out) const;
+    void blendRow(int y, const std::int16_t* top, const std::int16_t* bottom, std::uint8_t* out) const;
+
+    // Bilinear plans one sample at a time, for callers that see only some pixels:
+    // output pixel x reads source columns columnTaps(x), and resampleSample and
+    // blendSample give what resampleRow and blendRow write for its sample i.
+    std::pair<int, int> columnTaps(int x) const;
+    std::int16_t resampleSample(std::size_t i, std::uint8_t first, std::uint8_t second) const;
+    std::uint8_t blendSample(int y, std::size_t i, std::int16_t top, std::int16_t bottom) const;
+
+private:
+    void copyRows(const cv::Mat& source, cv::Mat& destination, int begin, int end) const;
+    void executeRows(const cv::Mat& source, cv::Mat& destination, int begin, int end, std::int16_t* scratch) const;
+
+    cv::Size source_;
+    cv::Size destination_;
+    int channels_ = 1;
+    bool nearest_ = false;
+    // bilinear halving: the last column and row when an odd side leaves them a block of their own
+    bool halving_ = false;
+    bool partialColumn_ = false;
+    bool partialRow_ = false;
+    // bilinear: per output sample, offset of the first tap in the source row and the two
+    // tap weights; nearest: per output pixel, offset of the source pixel
+    std::vector<std::int32_t> offsets_;
+    std::vector<std::int16_t> columnWeights_;
+    int step_ = 0;                  // distance of the second tap from the first
+    std::size_t gatherSafe_ = 0;    // leading samples whose 8 bytes at their offset lie inside the row
+    // leading samples resampled in groups of 8 from 16-byte windows: the offset of
+    // each group's window and the positions of the tap pairs within it
+    std::size_t localCount_ = 0;
+    std::vector<std::int32_t> windows_;
+    std::vector<std::uint8_t> shuffles_;
+    // per output row: (upper) source row, and for bilinear the two row weights
+    std::vector<int> rows_;
+    std::vector<std::int16_t> rowWeights_;
+};
+
+// Plans by (source size, scale, destination size, interpolation, channels),
+// shared by every image resized in the process. Plans are immutable, so they
+// may be executed concurrently.
+class ResamplePlanCache {
+public:
+    struct Stats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+    };
+
+    explicit ResamplePlanCache(std::size_t capacity);
+
+    static ResamplePlanCache& shared();
+
+    std::shared_ptr<const ResamplePlan> plan(cv::Size source, double scale, int interpolation, int channels);
+
+    Stats stats() const;
+    void clear();
+
+private:
+    using Key = std::tuple<int, int, double, int, int, int, int>;
+
+    struct Entry {
+        std::shared_ptr<const ResamplePlan> plan;
+        std::uint64_t lastUse = 0;
+    };
+
+    std::size_t capacity_;
+    mutable std::mutex mutex_;
+    std::map<Key, Entry> plans_;
+    std::uint64_t clock_ = 0;
+    Stats stats_;
+};
+
+} // namespace ImageOps
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// On-disk cache of finished outputs, addressed by a hash of the input bytes
+// and the normalized operation list. Entries are published with an atomic
+// rename, so several processes may share one directory.
+class ResultCache {
+public:
+    struct Stats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t stores = 0;
+        std::uint64_t evictions = 0;
+    };
+
+    ResultCache(std::string directory, std::uint64_t maxBytes);
+
+    static std::uint64_t hashBytes(const void* data, std::size_t size, std::uint64_t seed = 0);
+
+    // key = hash(input file bytes) + hash(recipe), recipe already contains the tool version
+    std::string makeKey(const std::string& inputPath, const std::string& recipe) const;
+
+    bool fetch(const std::string& key, const std::string& outputPath);   // copy a cached entry to outputPath
+    void store(const std::string& key, const std::string& producedPath); // publish producedPath under key
+
+    const Stats& stats() const { return stats_; }
+    const std::string& directory() const { return directory_; }
+
+private:
+    std::string entryPath(const std::string& key) const;
+    // drop least recently used entries until the directory, including temporaries of
+    // stores in progress, fits maxBytes_; temporaries left by interrupted stores are removed
+    void evict();
+
+    std::string directory_;
+    std::uint64_t maxBytes_ = 0;
+    Stats stats_;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "ImageLoader.hpp"
+
+// An image held as its non-zero pixels only, in the triple form produced by
+// ImageLoader::toTriples (row-major order). Meant for mask-like images where
+// most pixels are black: operations on it cost time proportional to the
+// non-zero pixels plus the image's side lengths.
+class SparseImage {
+public:
+    using Triple = ImageLoader::PixelTriple;
+
+    SparseImage(int rows, int cols, int channels, std::vector<Triple> triples);
+
+    static SparseImage fromDense(const cv::Mat& image);
+    // fromDense when fewer than maxDensity of the pixels are non-zero, else nullopt;
+    // one pass that stops once that is exceeded
+    static std::optional<SparseImage> fromDenseIfSparse(const cv::Mat& image, double maxDensity);
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+    int channels() const { return channels_; }
+    const std::vector<Triple>& triples() const { return triples_; }
+    double density() const;
+
+    // triples of one row are [rowBegin(row), rowBegin(row + 1))
+    std::size_t rowBegin(int row) const { return rowStarts_[static_cast<std::size_t>(row)]; }
+    bool rowEmpty(int row) const { return rowBegin(row) == rowBegin(row + 1); }
+    // samples of the pixel, or nullptr for a zero pixel
+    const std::uint8_t* find(int row, int col) const;
+
+    cv::Mat toDense() const;
+
+private:
+    int rows_ = 0;
+    int cols_ = 0;
+    int channels_ = 1;
+    std::vector<Triple> triples_;
+    std::vector<std::size_t> rowStarts_;    // rows_ + 1 offsets into triples_
+};
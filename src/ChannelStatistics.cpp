@@ -0,0 +1,108 @@
+#include "ChannelStatistics.hpp"
+
+namespace {
+
+// rows whose runs averaged more than this many bytes are counted run by run
+constexpr std::size_t kRunRowRatio = 4;
+
+std::size_t varintSize(std::size_t value) {
+    std::size_t bytes = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++bytes;
+    }
+    return bytes;
+}
+
+} // namespace
+
+void StatisticsAccumulator::add(const std::uint8_t* data, std::size_t size) {
+    if (size == 0) {
+        return;
+    }
+    if (lastRowRuns_ * kRunRowRatio < size) {
+        addRuns(data, size);
+    } else {
+        addBytes(data, size);
+    }
+}
+
+ChannelStatistics StatisticsAccumulator::finish() const {
+    ChannelStatistics stats;
+    for (std::size_t symbol = 0; symbol < 256; ++symbol) {
+        stats.histogram[symbol] = banks_[0][symbol] + banks_[1][symbol] + banks_[2][symbol] + banks_[3][symbol];
+    }
+    stats.runLengthBytes = runLengthBytes_ + (runLength_ > 0 ? 1 + varintSize(runLength_) : 0);
+    return stats;
+}
+
+void StatisticsAccumulator::addRuns(const std::uint8_t* data, std::size_t size) {
+    // a run of n equal bytes adds n to one bin; run state is kept in
+    // locals because the histogram stores could otherwise alias it
+    std::size_t runLength = runLength_;
+    std::uint8_t runValue = runValue_;
+    std::uint64_t runLengthBytes = runLengthBytes_;
+    std::size_t runs = 0;
+    std::size_t begin = 0;
+    while (begin < size) {
+        const std::uint8_t value = data[begin];
+        std::size_t end = begin + 1;
+        while (end < size && data[end] == value) {
+            ++end;
+        }
+        banks_[0][value] += end - begin;
+        if (runLength > 0 && value == runValue) {
+            runLength += end - begin;
+        } else {
+            runLengthBytes += runLength > 0 ? 1 + varintSize(runLength) : 0;
+            runValue = value;
+            runLength = end - begin;
+            ++runs;
+        }
+        begin = end;
+    }
+    runLength_ = runLength;
+    runValue_ = runValue;
+    runLengthBytes_ = runLengthBytes;
+    lastRowRuns_ = runs;
+}
+
+void StatisticsAccumulator::addBytes(const std::uint8_t* data, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        ++banks_[0][data[i]];
+        ++banks_[1][data[i + 1]];
+        ++banks_[2][data[i + 2]];
+        ++banks_[3][data[i + 3]];
+    }
+    for (; i < size; ++i) {
+        ++banks_[0][data[i]];
+    }
+
+    // Run boundaries are counted without branching on the data. Every run
+    // costs 1 value byte + 1 length byte; lengths of 128 and more need
+    // extra LEB128 bytes, which is rare enough to branch on.
+    std::ptrdiff_t start = -static_cast<std::ptrdiff_t>(runLength_);
+    std::uint64_t closed = 0;
+    std::uint64_t extra = 0;
+    if (runLength_ > 0 && data[0] != runValue_) {
+        closed = 1;
+        extra = varintSize(runLength_) - 1;
+        start = 0;
+    } else if (runLength_ == 0) {
+        start = 0;
+    }
+    const auto count = static_cast<std::ptrdiff_t>(size);
+    for (std::ptrdiff_t col = 1; col < count; ++col) {
+        const bool boundary = data[col] != data[col - 1];
+        closed += boundary;
+        if (col - start >= 128 && boundary) {
+            extra += varintSize(static_cast<std::size_t>(col - start)) - 1;
+        }
+        start = boundary ? col : start;
+    }
+    runLengthBytes_ += 2 * closed + extra;
+    runLength_ = static_cast<std::size_t>(count - start);
+    runValue_ = data[size - 1];
+    lastRowRuns_ = static_cast<std::size_t>(closed) + 1;
+}
@@ -0,0 +1,379 @@
+#include "ContextCoder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace ContextCoder {
+
+namespace {
+
+constexpr int kProbabilityBits = 16;
+constexpr std::uint32_t kRangeTop = 1u << 24;
+
+// Adaptive probability of a 0 bit, in 1/65536. Two estimates follow the bits at
+// different rates and their mean is used: quick to adapt, still precise.
+struct Probability {
+    std::uint16_t fast = 1u << 15;
+    std::uint16_t slow = 1u << 15;
+
+    std::uint32_t zero() const { return (std::uint32_t{fast} + slow) >> 1; }
+    void update(int bit) {
+        if (bit != 0) {
+            fast = static_cast<std::uint16_t>(fast - (fast >> 4));
+            slow = static_cast<std::uint16_t>(slow - (slow >> 7));
+        } else {
+            fast = static_cast<std::uint16_t>(fast + ((65536u - fast) >> 4));
+            slow = static_cast<std::uint16_t>(slow + ((65536u - slow) >> 7));
+        }
+    }
+};
+
+// Binary range coder with carry propagation (the scheme used by LZMA).
+class RangeEncoder {
+public:
+    explicit RangeEncoder(std::vector<std::uint8_t>& out) : out_(out) {}
+
+    int bit(Probability& probability, int bit) {
+        const std::uint32_t bound = (range_ >> kProbabilityBits) * probability.zero();
+        if (bit != 0) {
+            low_ += bound;
+            range_ -= bound;
+        } else {
+            range_ = bound;
+        }
+        probability.update(bit);
+        while (range_ < kRangeTop) {
+            range_ <<= 8;
+            shiftLow();
+        }
+        return bit;
+    }
+
+    void finish() {
+        for (int i = 0; i < 5; ++i) {
+            shiftLow();
+        }
+    }
+
+private:
+    void shiftLow() {
+        // the top byte of low is held back until it is known whether a carry reaches it
+        if (static_cast<std::uint32_t>(low_) < 0xFF000000u || (low_ >> 32) != 0) {
+            const auto carry = static_cast<std::uint8_t>(low_ >> 32);
+            std::uint8_t pending = cache_;
+            do {
+                out_.push_back(static_cast<std::uint8_t>(pending + carry));
+                pending = 0xFF;
+            } while (--cacheSize_ != 0);
+            cache_ = static_cast<std::uint8_t>(low_ >> 24);
+        }
+        ++cacheSize_;
+        low_ = (low_ & 0x00FFFFFFu) << 8;
+    }
+
+    std::vector<std::uint8_t>& out_;
+    std::uint64_t low_ = 0;
+    std::uint32_t range_ = 0xFFFFFFFFu;
+    std::uint8_t cache_ = 0;
+    std::uint64_t cacheSize_ = 1;
+};
+
+class RangeDecoder {
+public:
+    RangeDecoder(const std::uint8_t* data, std::size_t size) : next_(data), end_(data + size) {
+        for (int i = 0; i < 5; ++i) {
+            code_ = (code_ << 8) | nextByte();
+        }
+    }
+
+    // the second argument only mirrors RangeEncoder::bit; the decoded bit is returned
+    int bit(Probability& probability, int) {
+        const std::uint32_t bound = (range_ >> kProbabilityBits) * probability.zero();
+        int bit = 0;
+        if (code_ < bound) {
+            range_ = bound;
+        } else {
+            code_ -= bound;
+            range_ -= bound;
+            bit = 1;
+        }
+        probability.update(bit);
+        while (range_ < kRangeTop) {
+            range_ <<= 8;
+            code_ = (code_ << 8) | nextByte();
+        }
+        return bit;
+    }
+
+    void finish() const {
+        if (next_ != end_) {
+            throw std::runtime_error("归档压缩数据长度不匹配");
+        }
+    }
+
+private:
+    std::uint32_t nextByte() {
+        if (next_ == end_) {
+            throw std::runtime_error("归档压缩数据不完整");
+        }
+        return *next_++;
+    }
+
+    const std::uint8_t* next_;
+    const std::uint8_t* end_;
+    std::uint32_t range_ = 0xFFFFFFFFu;
+    std::uint32_t code_ = 0;
+};
+
+// Error energy (CALIC's dh + dv + 2|e_W|) is quantized into these levels; each
+// level has its own set of bit probabilities.
+constexpr int kEnergyLevels = 8;
+constexpr std::array<int, kEnergyLevels - 1> kEnergyThresholds{5, 15, 25, 42, 60, 85, 140};
+constexpr int kMagnitudeClasses = 8;    // magnitudes [2^k, 2^(k+1)), k < 8
+// Bias contexts: 8 texture bits, half the energy level and, for red and blue,
+// the sign of the green error at the same pixel
+constexpr int kBiasContexts = 256 * (kEnergyLevels / 2) * 3;
+constexpr int kBiasCountLimit = 128;    // sums are halved here so the mean keeps adapting
+
+struct ErrorModel {
+    std::array<Probability, kEnergyLevels> zero;
+    std::array<Probability, kEnergyLevels> sign;
+    std::array<std::array<Probability, kMagnitudeClasses>, kEnergyLevels> magnitudeClass;
+    // first two mantissa bits below the leading one, as a small binary tree
+    std::array<std::array<std::array<Probability, 3>, kMagnitudeClasses>, kEnergyLevels> mantissaHigh;
+    std::array<std::array<Probability, kMagnitudeClasses>, kMagnitudeClasses> mantissaLow;
+};
+
+struct BiasEntry {
+    std::int32_t sum = 0;   // of (8 * sample - 8 * GAP prediction)
+    std::int32_t count = 0;
+};
+
+// energy -> level, for energies below the last threshold
+constexpr auto kEnergyLevelTable = [] {
+    std::array<std::uint8_t, 256> table{};
+    int level = 0;
+    for (int energy = 0; energy < 256; ++energy) {
+        while (level < kEnergyLevels - 1 && energy >= kEnergyThresholds[static_cast<std::size_t>(level)]) {
+            ++level;
+        }
+        table[static_cast<std::size_t>(energy)] = static_cast<std::uint8_t>(level);
+    }
+    return table;
+}();
+
+int energyLevel(int energy) {
+    return kEnergyLevelTable[static_cast<std::size_t>(std::min(energy, 255))];
+}
+
+int floorLog2(int value) {
+    int log = 0;
+    while ((value >> (log + 1)) != 0) {
+        ++log;
+    }
+    return log;
+}
+
+template <typename Coder>
+int codeError(Coder& coder, ErrorModel& model, int level, int error) {
+    // error in [-127, 128]: a zero flag, a sign, the magnitude class in unary and
+    // the mantissa below the leading one. The decoder passes 0 and gets the error back.
+    const auto q = static_cast<std::size_t>(level);
+    if (coder.bit(model.zero[q], error == 0) != 0) {
+        return 0;
+    }
+    const int negative = coder.bit(model.sign[q], error < 0);
+    const int magnitude = std::abs(error);
+    const int targetClass = magnitude > 0 ? floorLog2(magnitude) : 0;
+    int magnitudeClass = 0;
+    while (magnitudeClass < kMagnitudeClasses - 1 &&
+           coder.bit(model.magnitudeClass[q][static_cast<std::size_t>(magnitudeClass)], magnitudeClass < targetClass) != 0) {
+        ++magnitudeClass;
+    }
+    const auto k = static_cast<std::size_t>(magnitudeClass);
+    int value = 1;
+    for (int bitIndex = magnitudeClass - 1; bitIndex >= 0; --bitIndex) {
+        const int depth = magnitudeClass - 1 - bitIndex;
+        Probability& probability = depth == 0   ? model.mantissaHigh[q][k][0]
+                                   : depth == 1 ? model.mantissaHigh[q][k][1 + static_cast<std::size_t>(value & 1)]
+                                                : model.mantissaLow[k][static_cast<std::size_t>(bitIndex)];
+        value = (value << 1) | coder.bit(probability, (magnitude >> bitIndex) & 1);
+    }
+    return negative != 0 ? -value : value;
+}
+
+// One plane of the image with its three most recent rows, padded by two
+// samples on each side so that the neighbourhood of border pixels is defined.
+class PlaneState {
+public:
+    explicit PlaneState(int width) : width_(width) {
+        for (auto& row : storage_) {
+            row.assign(static_cast<std::size_t>(width) + 4, 0);
+        }
+        bias_.resize(kBiasContexts);
+    }
+
+    void beginRow() {
+        // rotate: current -> above -> above2; the new current row starts left of column 0
+        // with copies of the sample above it
+        std::rotate(storage_.begin(), storage_.begin() + 2, storage_.end());
+        current_ = storage_[2].data() + 2;
+        above_ = storage_[1].data() + 2;
+        above2_ = storage_[0].data() + 2;
+        current_[-1] = above_[0];
+        current_[-2] = above_[0];
+        leftError_ = 0;
+    }
+
+    void endRow() {
+        current_[width_] = current_[width_ - 1];
+        current_[width_ + 1] = current_[width_ - 1];
+    }
+
+    // codes the sample at col and returns {sample, prediction error}; refError is the
+    // error of the reference plane at this pixel (hasRef false for the first plane)
+    template <typename Coder>
+    std::pair<int, int> code(Coder& coder, int col, int sample, bool hasRef, int refError) {
+        const int w = current_[col - 1];
+        const int ww = current_[col - 2];
+        const int n = above_[col];
+        const int nw = above_[col - 1];
+        const int ne = above_[col + 1];
+        const int nn = above2_[col];
+        const int nne = above2_[col + 1];
+
+        // CALIC gradient-adjusted prediction, in eighths
+        const int dh = std::abs(w - ww) + std::abs(n - nw) + std::abs(ne - n);
+        const int dv = std::abs(w - nw) + std::abs(n - nn) + std::abs(ne - nne);
+        const int slope = dv - dh;
+        int prediction;
+        if (slope > 80) {
+            prediction = 8 * w;
+        } else if (slope < -80) {
+            prediction = 8 * n;
+        } else {
+            prediction = 4 * (w + n) + 2 * (ne - nw);
+            if (slope > 32) {
+                prediction = (prediction + 8 * w) / 2;
+            } else if (slope > 8) {
+                prediction = (3 * prediction + 8 * w) / 4;
+            } else if (slope < -32) {
+                prediction = (prediction + 8 * n) / 2;
+            } else if (slope < -8) {
+                prediction = (3 * prediction + 8 * n) / 4;
+            }
+        }
+        if (hasRef) {
+            // the channels of natural images err in the same direction; half the
+            // green error predicted best on the sample images
+            prediction += 4 * refError;
+        }
+        prediction = std::clamp(prediction, 0, 8 * 255);
+
+        int energy = dh + dv + 2 * std::abs(leftError_);
+        if (hasRef) {
+            energy += 2 * std::abs(refError);
+        }
+        const int level = energyLevel(energy);
+
+        const int base = prediction >> 3;
+        int texture = 0;
+        texture |= (n < base) << 0;
+        texture |= (w < base) << 1;
+        texture |= (nw < base) << 2;
+        texture |= (ne < base) << 3;
+        texture |= (nn < base) << 4;
+        texture |= (ww < base) << 5;
+        texture |= (2 * n - nn < base) << 6;
+        texture |= (2 * w - ww < base) << 7;
+        const int refClass = !hasRef ? 0 : (refError < 0 ? 1 : (refError > 0 ? 2 : 0));
+        BiasEntry& bias = bias_[static_cast<std::size_t>((refClass * (kEnergyLevels / 2) + level / 2) * 256 + texture)];
+
+        const int meanError = bias.count > 0 ? bias.sum / bias.count : 0;
+        const int predicted = std::clamp((prediction + meanError + 4) >> 3, 0, 255);
+        const bool flip = meanError < 0;
+
+        int error = ((sample - predicted + 128) & 0xFF) - 128;
+        error = codeError(coder, errors_, level, flip ? -error : error);
+        error = flip ? -error : error;
+        sample = (predicted + error) & 0xFF;
+        error = ((sample - predicted + 128) & 0xFF) - 128;
+
+        bias.sum += 8 * sample - prediction;
+        if (++bias.count == kBiasCountLimit) {
+            bias.sum /= 2;
+            bias.count /= 2;
+        }
+        leftError_ = error;
+        current_[col] = sample;
+        return {sample, error};
+    }
+
+private:
+    int width_;
+    std::array<std::vector<int>, 3> storage_;
+    int* current_ = nullptr;
+    int* above_ = nullptr;
+    int* above2_ = nullptr;
+    int leftError_ = 0;
+    ErrorModel errors_;
+    std::vector<BiasEntry> bias_;
+};
+
+template <typename Coder>
+void codeImage(Coder& coder, cv::Mat& image) {
+    // colour samples are coded pixel by pixel, green first so red and blue can use its error
+    const int channels = image.channels();
+    const std::array<int, 3> order = channels == 3 ? std::array<int, 3>{1, 0, 2} : std::array<int, 3>{0, 0, 0};
+    std::vector<PlaneState> planes(static_cast<std::size_t>(channels), PlaneState(image.cols));
+    for (int row = 0; row < image.rows; ++row) {
+        for (auto& plane : planes) {
+            plane.beginRow();
+        }
+        std::uint8_t* pixels = image.ptr<std::uint8_t>(row);
+        for (int col = 0; col < image.cols; ++col) {
+            std::uint8_t* pixel = pixels + static_cast<std::size_t>(col) * static_cast<std::size_t>(channels);
+            int refError = 0;
+            for (int i = 0; i < channels; ++i) {
+                const int ch = order[static_cast<std::size_t>(i)];
+                const auto [sample, error] = planes[static_cast<std::size_t>(i)].code(coder, col, pixel[ch], i > 0, refError);
+                pixel[ch] = static_cast<std::uint8_t>(sample);
+                if (i == 0) {
+                    refError = error;
+                }
+            }
+        }
+        for (auto& plane : planes) {
+            plane.endRow();
+        }
+    }
+}
+
+} // namespace
+
+std::vector<std::uint8_t> encode(const cv::Mat& image) {
+    if (image.empty() || image.depth() != CV_8U || (image.channels() != 1 && image.channels() != 3)) {
+        throw std::runtime_error("归档压缩仅支持 8 位单通道或三通道图像");
+    }
+    std::vector<std::uint8_t> payload;
+    payload.reserve(image.total() * static_cast<std::size_t>(image.channels()) / 2);
+    RangeEncoder encoder(payload);
+    // the encoder writes the samples back unchanged, so a shallow copy would do;
+    // a clone keeps the caller's image untouched all the same
+    cv::Mat samples = image.clone();
+    codeImage(encoder, samples);
+    encoder.finish();
+    return payload;
+}
+
+cv::Mat decode(const std::uint8_t* data, std::size_t size, int width, int height, int channels) {
+    cv::Mat image = cv::Mat::zeros(height, width, channels == 3 ? CV_8UC3 : CV_8UC1);
+    RangeDecoder decoder(data, size);
+    codeImage(decoder, image);
+    decoder.finish();
+    return image;
+}
+
+} // namespace ContextCoder
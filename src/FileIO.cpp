@@ -0,0 +1,546 @@
+#include "FileIO.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IMAGICK_HAS_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+namespace {
+
+constexpr std::size_t kMaxTransfer = std::size_t{1} << 30;  // per request; larger files are resubmitted
+constexpr unsigned kMaxWorkers = 16;
+
+#if defined(_WIN32)
+
+int openFile(const std::string& path, bool forWrite) {
+    const int flags = (forWrite ? _O_WRONLY | _O_CREAT | _O_TRUNC : _O_RDONLY) | _O_BINARY;
+    return _open(path.c_str(), flags, _S_IREAD | _S_IWRITE);
+}
+
+long long fileSize(int fd) {
+    struct _stat64 info;
+    return _fstat64(fd, &info) == 0 ? static_cast<long long>(info.st_size) : -1;
+}
+
+int closeFile(int fd) {
+    return _close(fd);
+}
+
+long long transferAt(int fd, bool write, char* data, std::size_t size, std::size_t offset) {
+    // one transfer per file at a time, so seeking the shared descriptor is safe
+    if (_lseeki64(fd, static_cast<long long>(offset), SEEK_SET) < 0) {
+        return -errno;
+    }
+    const unsigned count = static_cast<unsigned>(std::min(size, kMaxTransfer));
+    const int done = write ? _write(fd, data, count) : _read(fd, data, count);
+    return done < 0 ? -errno : done;
+}
+
+#else
+
+int openFile(const std::string& path, bool forWrite) {
+    const int flags = (forWrite ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY) | O_CLOEXEC;
+    int fd;
+    do {
+        fd = ::open(path.c_str(), flags, 0644);
+    } while (fd < 0 && errno == EINTR);
+    return fd;
+}
+
+long long fileSize(int fd) {
+    struct stat info;
+    return ::fstat(fd, &info) == 0 ? static_cast<long long>(info.st_size) : -1;
+}
+
+int closeFile(int fd) {
+    return ::close(fd);
+}
+
+long long transferAt(int fd, bool write, char* data, std::size_t size, std::size_t offset) {
+    const std::size_t count = std::min(size, kMaxTransfer);
+    const off_t position = static_cast<off_t>(offset);
+    const ssize_t done = write ? ::pwrite(fd, data, count, position) : ::pread(fd, data, count, position);
+    return done < 0 ? -errno : done;
+}
+
+#endif
+
+} // namespace
+
+namespace FileIO {
+
+const char* backendName(Backend backend) {
+    switch (backend) {
+    case Backend::IoUring:
+        return "io_uring";
+    case Backend::Threads:
+        return "pread/pwrite";
+    default:
+        return "auto";
+    }
+}
+
+struct BatchIO::Request {
+    bool isWrite = false;
+    bool finished = false;
+    int fd = -1;
+    int error = 0;              // errno of the failed step
+    std::size_t done = 0;       // bytes transferred so far
+    std::string path;
+    std::vector<char> buffer;
+#ifdef IMAGICK_HAS_IO_URING
+    iovec chunk{};
+#endif
+
+    ~Request() {
+        if (fd >= 0) {
+            closeFile(fd);
+        }
+    }
+
+    // Accounts for one transfer result (bytes or -errno); true once the request is over.
+    bool advance(long long result) {
+        if (result == -EINTR || result == -EAGAIN) {
+            return false;
+        }
+        if (result < 0) {
+            error = static_cast<int>(-result);
+            return true;
+        }
+        if (result == 0) {
+            if (isWrite) {
+                error = EIO;
+            } else {
+                buffer.resize(done);    // the file shrank since it was opened
+            }
+            return true;
+        }
+        done += static_cast<std::size_t>(result);
+        return done >= buffer.size();
+    }
+};
+
+class BatchIO::Engine {
+public:
+    virtual ~Engine() = default;
+    // starts moving buffer[done..] at file offset done
+    virtual void submit(Request* request) = 0;
+    // blocks until a submitted request is over (complete, failed or at end of file)
+    virtual Request* wait() = 0;
+};
+
+class BatchIO::ThreadEngine final : public Engine {
+public:
+    explicit ThreadEngine(unsigned workers) {
+        for (unsigned i = 0; i < workers; ++i) {
+            workers_.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~ThreadEngine() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        queued_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    void submit(Request* request) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.push_back(request);
+        }
+        queued_.notify_one();
+    }
+
+    Request* wait() override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        finished_.wait(lock, [this]() { return !done_.empty(); });
+        Request* request = done_.front();
+        done_.pop_front();
+        return request;
+    }
+
+private:
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            queued_.wait(lock, [this]() { return stopping_ || !pending_.empty(); });
+            if (pending_.empty()) {
+                return;
+            }
+            Request* request = pending_.front();
+            pending_.pop_front();
+            lock.unlock();
+            for (;;) {
+                const long long result = transferAt(request->fd, request->isWrite, request->buffer.data() + request->done,
+                                                    request->buffer.size() - request->done, request->done);
+                if (request->advance(result)) {
+                    break;
+                }
+            }
+            lock.lock();
+            done_.push_back(request);
+            finished_.notify_one();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable queued_;
+    std::condition_variable finished_;
+    std::deque<Request*> pending_;
+    std::deque<Request*> done_;
+    std::vector<std::thread> workers_;
+    bool stopping_ = false;
+};
+
+#ifdef IMAGICK_HAS_IO_URING
+
+class BatchIO::UringEngine final : public Engine {
+public:
+    UringEngine() = default;
+    UringEngine(const UringEngine&) = delete;
+    UringEngine& operator=(const UringEngine&) = delete;
+
+    ~UringEngine() override {
+        if (sqes_ != nullptr) {
+            ::munmap(sqes_, sqesSize_);
+        }
+        if (cqRing_ != nullptr && cqRing_ != sqRing_) {
+            ::munmap(cqRing_, cqRingSize_);
+        }
+        if (sqRing_ != nullptr) {
+            ::munmap(sqRing_, sqRingSize_);
+        }
+        if (ringFd_ >= 0) {
+            ::close(ringFd_);
+        }
+    }
+
+    // Sets up a ring with room for `entries` requests; false (errno set) if the kernel refuses.
+    bool open(unsigned entries) {
+        io_uring_params params{};
+        ringFd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFd_ < 0) {
+            return false;
+        }
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap) {
+            sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+        }
+        sqRing_ = mapRing(sqRingSize_, IORING_OFF_SQ_RING);
+        if (sqRing_ == nullptr) {
+            return false;
+        }
+        cqRing_ = singleMap ? sqRing_ : mapRing(cqRingSize_, IORING_OFF_CQ_RING);
+        if (cqRing_ == nullptr) {
+            return false;
+        }
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mapRing(sqesSize_, IORING_OFF_SQES));
+        if (sqes_ == nullptr) {
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sqRing_);
+        char* cq = static_cast<char*>(cqRing_);
+        sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void submit(Request* request) override {
+        // Every call enters the kernel right away, so the submission ring never fills up: at
+        // most 2 * depth requests are in flight and the ring was sized for that.
+        const unsigned tail = *sqTail_;
+        const unsigned index = tail & sqMask_;
+        request->chunk.iov_base = request->buffer.data() + request->done;
+        request->chunk.iov_len = std::min(request->buffer.size() - request->done, kMaxTransfer);
+
+        io_uring_sqe& entry = sqes_[index];
+        std::memset(&entry, 0, sizeof(entry));
+        entry.opcode = request->isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+        entry.fd = request->fd;
+        entry.addr = reinterpret_cast<std::uint64_t>(&request->chunk);
+        entry.len = 1;
+        entry.off = request->done;
+        entry.user_data = reinterpret_cast<std::uint64_t>(request);
+        sqArray_[index] = index;
+        __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+
+        if (enter(1, 0, 0) < 0) {
+            throw std::runtime_error(std::string("io_uring 提交失败: ") + std::strerror(errno));
+        }
+    }
+
+    Request* wait() override {
+        for (;;) {
+            const unsigned head = *cqHead_;
+            if (head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe& completion = cqes_[head & cqMask_];
+                Request* request = reinterpret_cast<Request*>(completion.user_data);
+                const long long result = completion.res;
+                __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+                if (request->advance(result)) {
+                    return request;
+                }
+                submit(request);    // short transfer: queue the rest
+                continue;
+            }
+            if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0) {
+                throw std::runtime_error(std::string("io_uring 等待失败: ") + std::strerror(errno));
+            }
+        }
+    }
+
+private:
+    void* mapRing(std::size_t size, long long offset) {
+        void* ring = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, offset);
+        return ring == MAP_FAILED ? nullptr : ring;
+    }
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        int result;
+        do {
+            result = static_cast<int>(::syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete, flags, nullptr, 0));
+        } while (result < 0 && errno == EINTR);
+        return result;
+    }
+
+    int ringFd_ = -1;
+    void* sqRing_ = nullptr;
+    void* cqRing_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    std::size_t sqRingSize_ = 0;
+    std::size_t cqRingSize_ = 0;
+    std::size_t sqesSize_ = 0;
+    unsigned* sqTail_ = nullptr;
+    unsigned* sqArray_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned cqMask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+};
+
+#endif
+
+BatchIO::BatchIO(std::vector<std::string> inputs, unsigned queueDepth, Backend backend)
+    : inputs_(std::move(inputs)), depth_(std::max(1u, queueDepth)) {
+    reads_.resize(inputs_.size());
+#ifdef IMAGICK_HAS_IO_URING
+    if (backend != Backend::Threads) {
+        auto ring = std::make_unique<UringEngine>();
+        if (ring->open(2 * depth_)) {
+            engine_ = std::move(ring);
+            backend_ = Backend::IoUring;
+        } else if (backend == Backend::IoUring) {
+            throw std::runtime_error(std::string("io_uring 不可用: ") + std::strerror(errno));
+        }
+    }
+#else
+    if (backend == Backend::IoUring) {
+        throw std::runtime_error("当前平台不支持 io_uring");
+    }
+#endif
+    if (!engine_) {
+        engine_ = std::make_unique<ThreadEngine>(std::min(depth_, kMaxWorkers));
+        backend_ = Backend::Threads;
+    }
+    fillReadAhead();
+}
+
+BatchIO::~BatchIO() {
+    try {
+        drain();
+    } catch (...) {
+        // nothing sensible left to report from a destructor
+    }
+    engine_.reset();
+}
+
+Backend BatchIO::backend() const {
+    return backend_;
+}
+
+void BatchIO::fillReadAhead() {
+    while (nextRead_ < inputs_.size() && nextRead_ - nextResult_ < depth_) {
+        auto request = std::make_unique<Request>();
+        request->path = inputs_[nextRead_];
+        request->fd = openFile(request->path, false);
+        const long long size = request->fd < 0 ? -1 : fileSize(request->fd);
+        if (size < 0) {
+            request->error = errno;
+            request->finished = true;
+        } else if (size == 0) {
+            request->finished = true;
+        } else {
+            request->buffer.resize(static_cast<std::size_t>(size));
+            engine_->submit(request.get());
+            ++readsInFlight_;
+        }
+        reads_[nextRead_++] = std::move(request);
+    }
+}
+
+void BatchIO::complete(Request* request) {
+    if (!request->isWrite) {
+        request->finished = true;
+        --readsInFlight_;
+        return;
+    }
+    std::unique_ptr<Request> owned(request);
+    --writesInFlight_;
+    const int fd = owned->fd;
+    owned->fd = -1;
+    if (closeFile(fd) != 0 && owned->error == 0) {
+        owned->error = errno;
+    }
+    if (owned->error != 0 && writeError_.empty()) {
+        writeError_ = "无法写入文件: " + owned->path + " (" + std::strerror(owned->error) + ")";
+    }
+}
+
+void BatchIO::drain() {
+    while (readsInFlight_ + writesInFlight_ > 0) {
+        complete(engine_->wait());
+    }
+}
+
+bool BatchIO::nextInput(std::vector<char>& data) {
+    if (nextResult_ >= inputs_.size()) {
+        return false;
+    }
+    while (!reads_[nextResult_]->finished) {
+        complete(engine_->wait());
+    }
+    std::unique_ptr<Request> request = std::move(reads_[nextResult_++]);
+    fillReadAhead();
+    if (request->error != 0) {
+        throw std::runtime_error("无法读取文件: " + request->path + " (" + std::strerror(request->error) + ")");
+    }
+    data = std::move(request->buffer);
+    return true;
+}
+
+void BatchIO::write(const std::string& path, std::vector<char> data) {
+    while (writesInFlight_ >= depth_) {
+        complete(engine_->wait());
+    }
+    if (!writeError_.empty()) {
+        throw std::runtime_error(writeError_);
+    }
+    auto request = std::make_unique<Request>();
+    request->isWrite = true;
+    request->path = path;
+    request->buffer = std::move(data);
+    request->fd = openFile(path, true);
+    if (request->fd < 0) {
+        throw std::runtime_error("无法写入文件: " + path + " (" + std::strerror(errno) + ")");
+    }
+    if (request->buffer.empty()) {
+        return;     // the truncating open already produced the file
+    }
+    engine_->submit(request.get());
+    request.release();
+    ++writesInFlight_;
+}
+
+void BatchIO::finish() {
+    while (writesInFlight_ > 0) {
+        complete(engine_->wait());
+    }
+    if (!writeError_.empty()) {
+        throw std::runtime_error(writeError_);
+    }
+}
+
+MappedFile::MappedFile(const std::string& path) {
+    const int fd = openFile(path, false);
+    if (fd < 0) {
+        throw std::runtime_error("无法读取文件: " + path + " (" + std::strerror(errno) + ")");
+    }
+    const long long size = fileSize(fd);
+    if (size < 0) {
+        const int error = errno;
+        closeFile(fd);
+        throw std::runtime_error("无法读取文件: " + path + " (" + std::strerror(error) + ")");
+    }
+    size_ = static_cast<std::size_t>(size);
+    if (size_ == 0) {
+        closeFile(fd);
+        return;
+    }
+#if !defined(_WIN32)
+    void* view = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view != MAP_FAILED) {
+        closeFile(fd);     // the mapping keeps the file alive
+        data_ = static_cast<const char*>(view);
+        mapped_ = true;
+        return;
+    }
+#endif
+    buffer_.resize(size_);
+    std::size_t done = 0;
+    while (done < size_) {
+        const long long count = transferAt(fd, false, buffer_.data() + done, size_ - done, done);
+        if (count == -EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            closeFile(fd);
+            throw std::runtime_error("无法读取文件: " + path + " (" + std::strerror(count < 0 ? static_cast<int>(-count) : EIO) + ")");
+        }
+        done += static_cast<std::size_t>(count);
+    }
+    closeFile(fd);
+    data_ = buffer_.data();
+}
+
+MappedFile::~MappedFile() {
+#if !defined(_WIN32)
+    if (mapped_) {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+}
+
+} // namespace FileIO
@@ -0,0 +1,143 @@
+#include "HuffmanCode.hpp"
+
+#include <algorithm>
+
+namespace {
+
+std::array<std::uint8_t, 256> treeLengths(const std::array<std::uint64_t, 256>& frequencies) {
+    // lengths of a plain Huffman tree; nodes live in a fixed array (256 leaves +
+    // 255 internal nodes) and the queue is a heap over node indices, so no
+    // allocation happens here
+    struct Node {
+        std::uint64_t freq = 0;
+        int symbol = -1;
+        int left = -1;
+        int right = -1;
+    };
+
+    std::array<Node, 511> nodes{};
+    int nodeCount = 0;
+
+    // Compare nodes by frequency, then by symbol
+    const auto compare = [&nodes](int lhs, int rhs) {
+        if (nodes[lhs].freq == nodes[rhs].freq) {
+            return nodes[lhs].symbol > nodes[rhs].symbol;
+        }
+        return nodes[lhs].freq > nodes[rhs].freq;
+    };
+
+    std::array<int, 256> heap{};
+    int heapSize = 0;
+    const auto push = [&](int node) {
+        heap[heapSize++] = node;
+        std::push_heap(heap.begin(), heap.begin() + heapSize, compare);
+    };
+    const auto pop = [&]() {
+        std::pop_heap(heap.begin(), heap.begin() + heapSize, compare);
+        return heap[--heapSize];
+    };
+
+    // Build initial nodes
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (frequencies[symbol] == 0) {
+            continue;
+        }
+        nodes[nodeCount] = Node{frequencies[symbol], symbol, -1, -1};
+        push(nodeCount++);
+    }
+
+    if (heapSize == 0) {
+        nodes[nodeCount] = Node{1, 0, -1, -1};
+        push(nodeCount++);
+    }
+
+    while (heapSize > 1) {
+        const int a = pop();
+        const int b = pop();
+        nodes[nodeCount] = Node{nodes[a].freq + nodes[b].freq, -1, a, b};
+        push(nodeCount++);
+    }
+
+    const int root = heap[0];
+    std::array<std::uint8_t, 256> lengths{};
+
+    auto assignLengths = [&](auto&& self, int node, std::uint8_t depth) -> void {
+        // assign code lengths to the Huffman tree recursively
+        if (node < 0) {
+            return;
+        }
+        if (nodes[node].symbol >= 0) {
+            lengths[nodes[node].symbol] = depth == 0 ? 1 : depth;
+            return;
+        }
+        self(self, nodes[node].left, static_cast<std::uint8_t>(depth + 1));
+        self(self, nodes[node].right, static_cast<std::uint8_t>(depth + 1));
+    };
+
+    assignLengths(assignLengths, root, 0);
+    return lengths;
+}
+
+} // namespace
+
+std::array<std::uint8_t, 256> buildCodeLengths(const std::array<std::uint64_t, 256>& frequencies) {
+    // Halving rounds up, so every used symbol keeps a code; once all counts are
+    // 1 the tree is balanced, so this ends. Ordinary planes never loop.
+    std::array<std::uint64_t, 256> counts = frequencies;
+    while (true) {
+        const auto lengths = treeLengths(counts);
+        if (*std::max_element(lengths.begin(), lengths.end()) <= kMaxCodeLength) {
+            return lengths;
+        }
+        for (std::uint64_t& count : counts) {
+            count = (count + 1) / 2;
+        }
+    }
+}
+
+HuffmanTable buildCanonicalTable(const std::array<std::uint8_t, 256>& lengths) {
+    HuffmanTable table;
+    table.lengths = lengths;
+
+    std::array<std::uint32_t, 32> count{};
+    std::uint8_t maxLength = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        const std::uint8_t length = lengths[symbol];
+        if (length == 0) {
+            continue;
+        }
+        ++count[length];
+        maxLength = std::max(maxLength, length);
+    }
+    table.maxLength = maxLength;
+
+    std::array<std::uint32_t, 32> nextCode{};
+    std::uint32_t code = 0;
+    for (std::uint8_t length = 1; length <= maxLength; ++length) {
+        code = (code + count[length - 1]) << 1;
+        nextCode[length] = code;
+    }
+
+    std::array<int, 256> symbols{};
+    int symbolCount = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (lengths[symbol] > 0) {
+            symbols[symbolCount++] = symbol;
+        }
+    }
+
+    std::sort(symbols.begin(), symbols.begin() + symbolCount, [&](int lhs, int rhs) {
+        if (lengths[lhs] == lengths[rhs]) {
+            return lhs < rhs;
+        }
+        return lengths[lhs] < lengths[rhs];
+    });
+
+    for (int i = 0; i < symbolCount; ++i) {
+        const int symbol = symbols[i];
+        const std::uint8_t length = lengths[symbol];
+        table.codes[symbol] = nextCode[length]++;
+    }
+
+    return table;
+}
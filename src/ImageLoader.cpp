@@ -1,16 +1,30 @@
 #include "ImageLoader.hpp"
+#include "ChannelStatistics.hpp"
+#include "ContextCoder.hpp"
+#include "HuffmanCode.hpp"
+#include "PixelKernels.hpp"
+#include "SparseImage.hpp"
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <exception>
 #include <fstream>
 #include <limits>
+#include <map>
 #include <memory>
-#include <queue>
+#include <mutex>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
+#include <streambuf>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace {
@@ -29,59 +43,367 @@ std::string readToken(std::istream& is) {
     throw std::runtime_error("意外到达文件末尾，PPM 数据不完整");
 }
 
-cv::Mat readAscii(const std::string& magic, std::istream& is, int width, int height, int maxValue) {
-    // read a ASCII format PPM/PGM image
-    const bool isColor = magic == "P3";
-    const int channels = isColor ? 3 : 1;
+int readDimension(std::istream& is) {
+    // dimensions are parsed as 64-bit so that oversized headers fail loudly instead of wrapping
+    const std::string token = readToken(is);
+    long long value = 0;
+    try {
+        value = std::stoll(token);
+    } catch (const std::exception&) {
+        throw std::runtime_error("无法解析图像尺寸: " + token);
+    }
+    if (value <= 0) {
+        throw std::runtime_error("图像尺寸非法");
+    }
+    if (value > std::numeric_limits<int>::max()) {
+        throw std::runtime_error("图像尺寸超出支持范围: " + token);
+    }
+    return static_cast<int>(value);
+}
 
-    int type = (channels == 1) ? CV_8UC1 : CV_8UC3;
+ImageData readHeader(std::istream& is) {
+    // magic, dimensions and maxValue; for P6 the single whitespace before the pixels is consumed too
+    ImageData data;
+    data.magic = readToken(is);
+    if (data.magic != "P2" && data.magic != "P3" && data.magic != "P6") {
+        throw std::runtime_error("仅支持 P2/P3/P6 格式，检测到: " + data.magic);
+    }
 
-    cv::Mat image(height, width, type);
+    data.width = readDimension(is);
+    data.height = readDimension(is);
+    data.maxValue = std::stoi(readToken(is));
+    if (data.maxValue <= 0) {
+        throw std::runtime_error("最大像素值必须大于 0");
+    }
 
-    for (int row = 0; row < height; ++row) {
-        for (int col = 0; col < width; ++col) {
-            if (channels == 1) {
-                const int value = std::stoi(readToken(is));
-                if (value < 0 || value > maxValue) {
-                    throw std::runtime_error("检测到超出范围的像素值");
-                }
-                image.at<std::uint8_t>(row, col) = static_cast<std::uint8_t>(value);
-            } else {
-                auto& pixel = image.at<cv::Vec3b>(row, col);
-                for (int ch = 0; ch < channels; ++ch) {
-                    const int value = std::stoi(readToken(is));
-                    if (value < 0 || value > maxValue) {
-                        throw std::runtime_error("检测到超出范围的像素值");
-                    }
-                    pixel[ch] = static_cast<std::uint8_t>(value);
-                }
-            }
+    // every sample must be addressable with size_t, even on 32-bit builds
+    const std::size_t channels = data.magic == "P2" ? 1 : 3;
+    const std::size_t rowBytes = static_cast<std::size_t>(data.width) * channels;
+    if (rowBytes / channels != static_cast<std::size_t>(data.width) ||
+        static_cast<std::size_t>(data.height) > std::numeric_limits<std::size_t>::max() / rowBytes) {
+        throw std::runtime_error("图像数据量超出可寻址范围");
+    }
+
+    if (data.magic == "P6") {
+        if (data.maxValue > 255) {
+            throw std::runtime_error("当前实现暂不支持大于 8 位的二进制 P6 图像");
+        }
+        char whitespace = static_cast<char>(is.get());
+        if (whitespace == '\r' && is.peek() == '\n') {
+            is.get();
+        }
+    }
+    return data;
+}
+
+void readAsciiRow(std::istream& is, int maxValue, std::uint8_t* row, std::size_t samples) {
+    // read one row of an ASCII PPM/PGM image
+    for (std::size_t i = 0; i < samples; ++i) {
+        const int value = std::stoi(readToken(is));
+        if (value < 0 || value > maxValue) {
+            throw std::runtime_error("检测到超出范围的像素值");
         }
+        row[i] = static_cast<std::uint8_t>(value);
+    }
+}
+
+void readBinaryRow(std::istream& is, std::uint8_t* row, std::size_t bytes) {
+    // read one row of a binary P6 image
+    is.read(reinterpret_cast<char*>(row), static_cast<std::streamsize>(bytes));
+    if (is.gcount() != static_cast<std::streamsize>(bytes)) {
+        throw std::runtime_error("P6 图像像素数据长度不匹配");
     }
+}
 
+cv::Mat readImage(std::istream& is, const ImageData& header) {
+    // read the pixels of a PPM/PGM image straight into the matrix rows
+    const int channels = header.magic == "P2" ? 1 : 3;
+    cv::Mat image(header.height, header.width, channels == 1 ? CV_8UC1 : CV_8UC3);
+    const std::size_t samples = static_cast<std::size_t>(header.width) * static_cast<std::size_t>(channels);
+    for (int row = 0; row < header.height; ++row) {
+        if (header.magic == "P6") {
+            readBinaryRow(is, image.ptr<std::uint8_t>(row), samples);
+        } else {
+            readAsciiRow(is, header.maxValue, image.ptr<std::uint8_t>(row), samples);
+        }
+    }
     return image;
 }
 
-cv::Mat readBinaryP6(std::istream& is, int width, int height, int maxValue) {
-    // read a binary P6 format PPM image
-    if (maxValue > 255) {
-        throw std::runtime_error("当前实现暂不支持大于 8 位的二进制 P6 图像");
+// ASCII bodies with at least this many samples are parsed on several threads
+constexpr std::size_t kParallelParseSamples = std::size_t{1} << 20;
+
+bool isAsciiSpace(char c) {
+    // the characters operator>> treats as separators in the classic locale
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+std::size_t countAsciiTokens(const char* p, const char* end, bool& endsInComment) {
+    // count the samples in [p, end), starting outside a comment
+    std::size_t count = 0;
+    endsInComment = false;
+    while (true) {
+        while (p < end && isAsciiSpace(*p)) {
+            ++p;
+        }
+        if (p == end) {
+            return count;
+        }
+        if (*p == '#') {
+            // like readToken: a token starting with '#' discards the rest of the line
+            p = static_cast<const char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+            if (p == nullptr) {
+                endsInComment = true;
+                return count;
+            }
+            continue;
+        }
+        ++count;
+        while (p < end && !isAsciiSpace(*p)) {
+            ++p;
+        }
+    }
+}
+
+int parseSampleToken(const char* token, std::size_t length) {
+    // plain digit strings are converted inline; anything else goes through std::stoi for identical errors
+    if (length <= 9) {
+        int value = 0;
+        std::size_t i = 0;
+        for (; i < length; ++i) {
+            const unsigned digit = static_cast<unsigned>(token[i]) - '0';
+            if (digit > 9) {
+                break;
+            }
+            value = value * 10 + static_cast<int>(digit);
+        }
+        if (i == length) {
+            return value;
+        }
     }
+    return std::stoi(std::string(token, length));
+}
 
-    const int channels = 3;
-    const std::size_t total = static_cast<std::size_t>(width) * static_cast<std::size_t>(height) * channels;
+struct AsciiChunk {
+    // one whitespace-aligned slice of an ASCII body
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    const char* lineStart = nullptr;   // one past the first '\n', or end
+    bool hasNewline = false;
+    std::size_t headSamples = 0;        // samples in [begin, lineStart)
+    std::size_t tailSamples = 0;        // samples in [lineStart, end)
+    bool headEndsInComment = false;
+    bool tailEndsInComment = false;
+    bool startsInComment = false;
+    std::size_t firstSample = 0;
+    std::exception_ptr error;
+};
 
-    std::vector<std::uint8_t> buffer(total);
-    is.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
-    if (is.gcount() != static_cast<std::streamsize>(buffer.size())) {
-        throw std::runtime_error("P6 图像像素数据长度不匹配");
+void parseAsciiChunk(AsciiChunk& chunk, int maxValue, std::uint8_t* samples, std::size_t sampleCount) {
+    const char* p = chunk.startsInComment ? chunk.lineStart : chunk.begin;
+    const char* end = chunk.end;
+    std::size_t index = chunk.firstSample;
+    while (index < sampleCount) {
+        while (p < end && isAsciiSpace(*p)) {
+            ++p;
+        }
+        if (p == end) {
+            return;
+        }
+        if (*p == '#') {
+            p = static_cast<const char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+            if (p == nullptr) {
+                return;
+            }
+            continue;
+        }
+        const char* token = p;
+        while (p < end && !isAsciiSpace(*p)) {
+            ++p;
+        }
+        const int value = parseSampleToken(token, static_cast<std::size_t>(p - token));
+        if (value < 0 || value > maxValue) {
+            throw std::runtime_error("检测到超出范围的像素值");
+        }
+        samples[index++] = static_cast<std::uint8_t>(value);
+    }
+}
+
+template <typename Task>
+void runOnThreads(std::size_t count, Task task) {
+    // task(i) for every i < count; the calling thread takes index 0
+    std::vector<std::thread> threads;
+    threads.reserve(count > 0 ? count - 1 : 0);
+    for (std::size_t i = 1; i < count; ++i) {
+        threads.emplace_back([&task, i]() { task(i); });
+    }
+    if (count > 0) {
+        task(0);
     }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+cv::Mat parseAsciiBody(const char* begin, const char* end, const ImageData& header) {
+    // Parse a whole P2/P3 body held in memory. The body is cut into chunks at whitespace; each
+    // chunk counts its samples, a prefix sum gives every chunk its first pixel, and the chunks are
+    // then converted in parallel straight into the matrix. A chunk may start inside a comment, so
+    // the samples before and after its first newline are counted separately and the comment state
+    // is resolved during the prefix sum.
+    const int channels = header.magic == "P2" ? 1 : 3;
+    cv::Mat image(header.height, header.width, channels == 1 ? CV_8UC1 : CV_8UC3);
+    const std::size_t sampleCount =
+        static_cast<std::size_t>(header.width) * static_cast<std::size_t>(header.height) * static_cast<std::size_t>(channels);
+
+    std::size_t chunkCount = 1;
+    if (sampleCount >= kParallelParseSamples) {
+        chunkCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const std::size_t bodySize = static_cast<std::size_t>(end - begin);
+    chunkCount = std::max<std::size_t>(1, std::min(chunkCount, bodySize / 4096));
+
+    std::vector<AsciiChunk> chunks(chunkCount);
+    const char* cursor = begin;
+    for (std::size_t i = 0; i < chunkCount; ++i) {
+        const char* limit = i + 1 == chunkCount ? end : begin + bodySize / chunkCount * (i + 1);
+        limit = std::max(limit, cursor);
+        while (limit < end && !isAsciiSpace(*limit)) {
+            ++limit;
+        }
+        chunks[i].begin = cursor;
+        chunks[i].end = limit;
+        cursor = limit;
+    }
+
+    runOnThreads(chunkCount, [&chunks](std::size_t i) {
+        AsciiChunk& chunk = chunks[i];
+        const char* newline = nullptr;
+        if (chunk.end > chunk.begin) {
+            newline = static_cast<const char*>(
+                std::memchr(chunk.begin, '\n', static_cast<std::size_t>(chunk.end - chunk.begin)));
+        }
+        chunk.hasNewline = newline != nullptr;
+        chunk.lineStart = newline == nullptr ? chunk.end : newline + 1;
+        chunk.headSamples = countAsciiTokens(chunk.begin, chunk.lineStart, chunk.headEndsInComment);
+        chunk.tailSamples = countAsciiTokens(chunk.lineStart, chunk.end, chunk.tailEndsInComment);
+    });
+
+    std::size_t total = 0;
+    bool inComment = false;
+    for (auto& chunk : chunks) {
+        chunk.startsInComment = inComment;
+        chunk.firstSample = total;
+        total += (inComment ? 0 : chunk.headSamples) + chunk.tailSamples;
+        if (chunk.hasNewline) {
+            inComment = chunk.tailEndsInComment;
+        } else {
+            inComment = inComment || chunk.headEndsInComment;
+        }
+    }
+
+    std::uint8_t* samples = image.ptr<std::uint8_t>(0);
+    runOnThreads(chunkCount, [&](std::size_t i) {
+        try {
+            parseAsciiChunk(chunks[i], header.maxValue, samples, sampleCount);
+        } catch (...) {
+            chunks[i].error = std::current_exception();
+        }
+    });
 
-    cv::Mat image(height, width, CV_8UC3);
-    std::memcpy(image.data, buffer.data(), buffer.size());
+    // chunks are in file order, so the first failing chunk holds the error a sequential read would hit
+    for (const auto& chunk : chunks) {
+        if (chunk.error) {
+            std::rethrow_exception(chunk.error);
+        }
+    }
+    if (total < sampleCount) {
+        throw std::runtime_error("意外到达文件末尾，PPM 数据不完整");
+    }
     return image;
 }
 
+// Read-only stream over bytes already in memory; seeking is supported for readAsciiImage.
+class MemoryBuffer : public std::streambuf {
+public:
+    MemoryBuffer(const char* data, std::size_t size) {
+        char* begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+
+    // the next size bytes in place, skipping over them; nullptr if fewer are left
+    const char* take(std::size_t size) {
+        if (static_cast<std::size_t>(egptr() - gptr()) < size) {
+            return nullptr;
+        }
+        const char* data = gptr();
+        setg(eback(), gptr() + size, egptr());
+        return data;
+    }
+
+protected:
+    pos_type seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        if ((which & std::ios_base::in) == 0) {
+            return pos_type(off_type(-1));
+        }
+        off_type base = gptr() - eback();
+        if (dir == std::ios_base::beg) {
+            base = 0;
+        } else if (dir == std::ios_base::end) {
+            base = egptr() - eback();
+        }
+        const off_type target = base + offset;
+        if (target < 0 || target > egptr() - eback()) {
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), eback() + target, egptr());
+        return pos_type(target);
+    }
+
+    pos_type seekpos(pos_type position, std::ios_base::openmode which) override {
+        return seekoff(off_type(position), std::ios_base::beg, which);
+    }
+};
+
+// Output stream that appends to a byte vector.
+class VectorSink : public std::streambuf {
+public:
+    explicit VectorSink(std::vector<char>& bytes) : bytes_(bytes) {}
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            bytes_.push_back(traits_type::to_char_type(ch));
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize count) override {
+        bytes_.insert(bytes_.end(), data, data + count);
+        return count;
+    }
+
+private:
+    std::vector<char>& bytes_;
+};
+
+cv::Mat readAsciiImage(std::istream& is, const ImageData& header) {
+    // read the rest of the stream and parse it in memory
+    const std::streampos start = is.tellg();
+    is.seekg(0, std::ios::end);
+    const std::streamoff size = is.tellg() - start;
+    is.seekg(start);
+    if (size <= 0) {
+        throw std::runtime_error("意外到达文件末尾，PPM 数据不完整");
+    }
+    std::vector<char> body(static_cast<std::size_t>(size));
+    is.read(body.data(), static_cast<std::streamsize>(body.size()));
+    if (!is) {
+        throw std::runtime_error("读取图像数据失败");
+    }
+    return parseAsciiBody(body.data(), body.data() + body.size(), header);
+}
+
 void writeHeader(std::ostream& os, const std::string& magic, int width, int height, int maxValue) {
     // write PPM/PGM header
     os << magic << '\n';
@@ -89,43 +411,106 @@ void writeHeader(std::ostream& os, const std::string& magic, int width, int heig
     os << maxValue << '\n';
 }
 
-void writeAscii(const cv::Mat& image, std::ostream& os, int /*maxValue*/, bool isColor) {
-    // write ASCII format PPM/PGM image
-    const int width = image.cols;
-    const int height = image.rows;
+// decimal text of every sample value; the last byte holds the digit count
+constexpr auto kDecimalSamples = [] {
+    std::array<std::array<char, 4>, 256> table{};
+    for (int value = 0; value < 256; ++value) {
+        const int length = value >= 100 ? 3 : (value >= 10 ? 2 : 1);
+        int rest = value;
+        for (int i = length - 1; i >= 0; --i) {
+            table[value][i] = static_cast<char>('0' + rest % 10);
+            rest /= 10;
+        }
+        table[value][3] = static_cast<char>(length);
+    }
+    return table;
+}();
+
+template <int Channels>
+void writeAsciiRow(std::ostream& os, const std::uint8_t* row, int width) {
+    // one pixel per line for colour ("r g b"), one image row per line for grey;
+    // the text is assembled in a local buffer instead of one stream insertion per sample
+    char buffer[4096];
+    std::size_t used = 0;
+    for (int col = 0; col < width; ++col) {
+        if (used + 4 * Channels > sizeof(buffer)) {
+            os.write(buffer, static_cast<std::streamsize>(used));
+            used = 0;
+        }
+        const std::uint8_t* pixel = row + static_cast<std::size_t>(col) * Channels;
+        for (int ch = 0; ch < Channels; ++ch) {
+            const auto& text = kDecimalSamples[pixel[ch]];
+            std::memcpy(buffer + used, text.data(), 3);
+            used += static_cast<std::size_t>(text[3]);
+            buffer[used++] = (Channels == 1 || ch + 1 < Channels) ? ' ' : '\n';
+        }
+    }
+    if (Channels == 1) {
+        if (used == sizeof(buffer)) {
+            os.write(buffer, static_cast<std::streamsize>(used));
+            used = 0;
+        }
+        buffer[used++] = '\n';
+    }
+    os.write(buffer, static_cast<std::streamsize>(used));
+}
 
+void writeAsciiRow(std::ostream& os, const std::uint8_t* row, int width, bool isColor) {
+    // write one row of an ASCII PPM/PGM image
     if (isColor) {
-        for (int row = 0; row < height; ++row) {
-            for (int col = 0; col < width; ++col) {
-                const auto pixel = image.at<cv::Vec3b>(row, col);
-                os << static_cast<int>(pixel[0]) << ' '
-                   << static_cast<int>(pixel[1]) << ' '
-                   << static_cast<int>(pixel[2]) << '\n';
-            }
-        }
+        writeAsciiRow<3>(os, row, width);
     } else {
-        for (int row = 0; row < height; ++row) {
-            for (int col = 0; col < width; ++col) {
-                os << static_cast<int>(image.at<std::uint8_t>(row, col)) << ' ';
-            }
-            os << '\n';
-        }
+        writeAsciiRow<1>(os, row, width);
     }
 }
 
-void writeBinaryP6(const cv::Mat& image, std::ostream& os) {
-    // write binary P6 format PPM image
-    if (image.type() != CV_8UC3) {
-        throw std::runtime_error("二进制 P6 输出仅支持 8 位 3 通道图像");
+void writeImage(std::ostream& os, const cv::Mat& image, int maxValue, bool useBinaryColor) {
+    // write one PPM/PGM image (header and pixels) to the stream
+    if (image.empty()) {
+        throw std::runtime_error("尝试保存空图像");
+    }
+    if (image.depth() != CV_8U) {
+        throw std::runtime_error("当前仅支持 8 位图像保存");
+    }
+
+    const bool isColor = image.channels() == 3;
+    const bool binary = isColor && useBinaryColor;
+    writeHeader(os, isColor ? (binary ? "P6" : "P3") : "P2", image.cols, image.rows, maxValue);
+    const std::size_t rowBytes = static_cast<std::size_t>(image.cols) * image.elemSize();
+    for (int row = 0; row < image.rows; ++row) {
+        const std::uint8_t* rowPtr = image.ptr<std::uint8_t>(row);
+        if (binary) {
+            os.write(reinterpret_cast<const char*>(rowPtr), static_cast<std::streamsize>(rowBytes));
+        } else {
+            writeAsciiRow(os, rowPtr, image.cols, isColor);
+        }
     }
-    const std::size_t total = static_cast<std::size_t>(image.total()) * image.elemSize();
-    os.write(reinterpret_cast<const char*>(image.data), static_cast<std::streamsize>(total));
 }
 
-constexpr char kCompressedMagic[] = "HFM";
+constexpr char kLegacyMagic[] = "HFM";     // every channel Huffman coded, no flags
+constexpr char kCompressedMagic[] = "HF2";  // per-channel coding mode
+constexpr char kSequenceMagic[] = "HFS";    // multi-frame sequence
+constexpr char kDictionaryMagic[] = "HFD";  // shared Huffman tables
 constexpr std::size_t kCompressedMagicSize = sizeof(kCompressedMagic) - 1;
+constexpr std::uint8_t kFrameKey = 0;       // left prediction only
+constexpr std::uint8_t kFrameDelta = 1;     // left prediction of the difference to the previous frame
+constexpr std::uint8_t kFlagPalette = 0x01;     // one index plane plus a colour table
+constexpr std::uint8_t kFlagNearLossless = 0x02; // residuals quantized with step 2 * NEAR + 1
+constexpr std::uint8_t kFlagWideSizes = 0x04;   // payload byte counts are 8 bytes
+constexpr std::uint8_t kFlagDictionary = 0x08;  // planes may use the tables of a shared dictionary
+constexpr std::uint8_t kFlagArchive = 0x10;     // one context-modelled arithmetic payload instead of planes
+constexpr std::uint8_t kSupportedFlags = kFlagPalette | kFlagNearLossless | kFlagWideSizes | kFlagDictionary | kFlagArchive;
+
+std::uint64_t maxArchivePayload(std::size_t pixelCount, int channels) {
+    // the largest archive payload decompress accepts; bigger ones are never written
+    return static_cast<std::uint64_t>(pixelCount) * static_cast<std::uint64_t>(channels) + 64;
+}
 
 // Write and read integers in binary
+void writeUint64(std::ostream& os, std::uint64_t value) {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
 void writeUint32(std::ostream& os, std::uint32_t value) {
     os.write(reinterpret_cast<const char*>(&value), sizeof(value));
 }
@@ -138,6 +523,15 @@ void writeUint8(std::ostream& os, std::uint8_t value) {
     os.write(reinterpret_cast<const char*>(&value), sizeof(value));
 }
 
+std::uint64_t readUint64(std::istream& is) {
+    std::uint64_t value = 0;
+    is.read(reinterpret_cast<char*>(&value), sizeof(value));
+    if (!is) {
+        throw std::runtime_error("无法读取压缩文件中的 64 位整数");
+    }
+    return value;
+}
+
 std::uint32_t readUint32(std::istream& is) {
     std::uint32_t value = 0;
     is.read(reinterpret_cast<char*>(&value), sizeof(value));
@@ -165,14 +559,12 @@ std::uint8_t readUint8(std::istream& is) {
     return value;
 }
 
-struct HuffmanTable {
-    std::array<std::uint8_t, 256> lengths{};
-    std::array<std::uint32_t, 256> codes{};
-    std::uint8_t maxLength = 0; // maximum code length
-};
-
 class BitWriter {
 public:
+    explicit BitWriter(std::vector<std::uint8_t>& data) : data_(data) {
+        data_.clear(); // keep the capacity of the caller's buffer
+    }
+
     void writeBits(std::uint32_t code, std::uint8_t length) {
         // write bits to the buffer
         for (int bit = length - 1; bit >= 0; --bit) {
@@ -187,19 +579,18 @@ public:
         }
     }
 
-    std::vector<std::uint8_t> takeData() {
-        // finalize and return the data buffer
+    void finish() {
+        // flush the last partial byte
         if (bitCount_ > 0) {
             current_ <<= static_cast<std::uint8_t>(8 - bitCount_);
             data_.push_back(current_);
             bitCount_ = 0;
             current_ = 0;
         }
-        return std::move(data_);
     }
 
 private:
-    std::vector<std::uint8_t> data_;
+    std::vector<std::uint8_t>& data_;
     std::uint8_t current_ = 0;
     std::uint8_t bitCount_ = 0;
 };
@@ -222,6 +613,8 @@ public:
         return bit;
     }
 
+    std::size_t position() const { return index_; }   // bytes consumed so far
+
 private:
     const std::uint8_t* data_ = nullptr;
     std::size_t size_ = 0;
@@ -230,160 +623,43 @@ private:
     std::uint8_t bitCount_ = 0;
 };
 
-std::array<std::uint64_t, 256> buildHistogram(const std::vector<std::uint8_t>& data) {
-    std::array<std::uint64_t, 256> histogram{};
-    for (std::uint8_t value : data) {
-        ++histogram[value];
-    }
-    return histogram;
-}
-
-std::array<std::uint8_t, 256> buildCodeLengths(const std::array<std::uint64_t, 256>& frequencies) {
-    struct Node {
-        std::uint64_t freq = 0;
-        int symbol = -1;
-        Node* left = nullptr;
-        Node* right = nullptr;
-    };
-
-    struct NodeCompare {
-        // Compare nodes by frequency, then by symbol
-        bool operator()(const Node* lhs, const Node* rhs) const {
-            if (lhs->freq == rhs->freq) {
-                return lhs->symbol > rhs->symbol;
-            }
-            return lhs->freq > rhs->freq;
-        }
-    };
-
-    std::priority_queue<Node*, std::vector<Node*>, NodeCompare> queue;
-    std::vector<std::unique_ptr<Node>> storage; // memory management
-
-    // Build initial nodes
-    for (int symbol = 0; symbol < 256; ++symbol) {
-        if (frequencies[symbol] == 0) {
-            continue;
-        }
-        auto node = std::make_unique<Node>();
-        node->freq = frequencies[symbol];
-        node->symbol = symbol;
-        queue.push(node.get());
-        storage.push_back(std::move(node));
-    }
-
-    if (queue.empty()) {
-        auto node = std::make_unique<Node>();
-        node->freq = 1;
-        node->symbol = 0;
-        queue.push(node.get());
-        storage.push_back(std::move(node));
-    }
-
-    while (queue.size() > 1) {
-        Node* a = queue.top();
-        queue.pop();
-        Node* b = queue.top();
-        queue.pop();
-
-        auto parent = std::make_unique<Node>();
-        parent->freq = a->freq + b->freq;
-        parent->symbol = -1;
-        parent->left = a;
-        parent->right = b;
-        queue.push(parent.get());
-        storage.push_back(std::move(parent));
-    }
-
-    Node* root = queue.top();
-    std::array<std::uint8_t, 256> lengths{};
-
-    auto assignLengths = [&](auto&& self, Node* node, std::uint8_t depth) -> void {
-        // assign code lengths to the Huffman tree recursively
-        if (!node) {
-            return;
-        }
-        if (node->symbol >= 0) {
-            lengths[node->symbol] = depth == 0 ? 1 : depth;
-            return;
-        }
-        self(self, node->left, static_cast<std::uint8_t>(depth + 1));
-        self(self, node->right, static_cast<std::uint8_t>(depth + 1));
-    };
-
-    assignLengths(assignLengths, root, 0);
-    return lengths;
-}
-
-HuffmanTable buildCanonicalTable(const std::array<std::uint8_t, 256>& lengths) {
-    HuffmanTable table;
-    table.lengths = lengths;
+struct DecoderNode {
+    int child[2] = {-1, -1};
+    int symbol = -1;
+};
 
-    std::array<std::uint32_t, 32> count{};
-    std::uint8_t maxLength = 0;
+void buildDecoderNodes(const HuffmanTable& table, std::vector<DecoderNode>& nodes) {
+    // build Trie from the Huffman table, reusing the caller's node storage
+    nodes.clear();
+    nodes.push_back(DecoderNode{});
     for (int symbol = 0; symbol < 256; ++symbol) {
-        const std::uint8_t length = lengths[symbol];
+        const std::uint8_t length = table.lengths[symbol];
         if (length == 0) {
             continue;
         }
-        ++count[length];
-        maxLength = std::max(maxLength, length);
-    }
-    table.maxLength = maxLength;
-
-    std::array<std::uint32_t, 32> nextCode{};
-    std::uint32_t code = 0;
-    for (std::uint8_t length = 1; length <= maxLength; ++length) {
-        code = (code + count[length - 1]) << 1;
-        nextCode[length] = code;
-    }
-
-    std::vector<int> symbols;
-    symbols.reserve(256);
-    for (int symbol = 0; symbol < 256; ++symbol) {
-        if (lengths[symbol] > 0) {
-            symbols.push_back(symbol);
-        }
-    }
-
-    std::sort(symbols.begin(), symbols.end(), [&](int lhs, int rhs) {
-        if (lengths[lhs] == lengths[rhs]) {
-            return lhs < rhs;
+        std::uint32_t code = table.codes[symbol];
+        int current = 0;
+        for (int bit = length - 1; bit >= 0; --bit) {
+            const int direction = static_cast<int>((code >> bit) & 0x1U);
+            if (nodes[current].child[direction] == -1) {
+                nodes[current].child[direction] = static_cast<int>(nodes.size());
+                nodes.push_back(DecoderNode{});
+            }
+            current = nodes[current].child[direction];
         }
-        return lengths[lhs] < lengths[rhs];
-    });
-
-    for (int symbol : symbols) {
-        const std::uint8_t length = lengths[symbol];
-        table.codes[symbol] = nextCode[length]++;
+        nodes[current].symbol = symbol;
     }
-
-    return table;
 }
 
 class HuffmanDecoder {
 public:
-    explicit HuffmanDecoder(const HuffmanTable& table) {
-        // build Trie from the Huffman table
-        nodes_.push_back(Node{});
-        for (int symbol = 0; symbol < 256; ++symbol) {
-            const std::uint8_t length = table.lengths[symbol];
-            if (length == 0) {
-                continue;
-            }
-            std::uint32_t code = table.codes[symbol];
-            int current = 0;
-            for (int bit = length - 1; bit >= 0; --bit) {
-                const int direction = static_cast<int>((code >> bit) & 0x1U);
-                if (nodes_[current].child[direction] == -1) {
-                    nodes_[current].child[direction] = static_cast<int>(nodes_.size());
-                    nodes_.push_back(Node{});
-                }
-                current = nodes_[current].child[direction];
-            }
-            nodes_[current].symbol = symbol;
-        }
+    HuffmanDecoder(const HuffmanTable& table, std::vector<DecoderNode>& nodes) : nodes_(nodes) {
+        buildDecoderNodes(table, nodes);
     }
 
+    // decodes with a trie built elsewhere, e.g. by a shared dictionary
+    explicit HuffmanDecoder(const std::vector<DecoderNode>& nodes) : nodes_(nodes) {}
+
     std::uint8_t decodeSymbol(BitReader& reader) const {
         int current = 0;
         while (nodes_[current].symbol < 0) {
@@ -397,175 +673,1274 @@ public:
     }
 
 private:
-    struct Node {
-        int child[2] = {-1, -1};
-        int symbol = -1;
-    };
-
-    std::vector<Node> nodes_;
+    const std::vector<DecoderNode>& nodes_;
 };
 
-std::vector<std::uint8_t> encode(const std::vector<std::uint8_t>& data, const HuffmanTable& table) {
+void encode(const std::vector<std::uint8_t>& data, const HuffmanTable& table, std::vector<std::uint8_t>& output) {
     // encode an array of data using the provided Huffman table
-    BitWriter writer;
+    BitWriter writer(output);
     for (std::uint8_t value : data) {
         const std::uint8_t length = table.lengths[value];
         const std::uint32_t code = table.codes[value];
         writer.writeBits(code, length);
     }
-    return writer.takeData();
+    writer.finish();
 }
 
-std::vector<std::uint8_t> decode(const std::vector<std::uint8_t>& data, const HuffmanTable& table, std::size_t expectedCount) {
-    // decode binary data to an array of bytes using the provided Huffman table
-    BitReader reader(data.data(), data.size());
-    HuffmanDecoder decoder(table);
-    std::vector<std::uint8_t> result(expectedCount);
-    for (std::size_t i = 0; i < expectedCount; ++i) {
-        result[i] = decoder.decodeSymbol(reader);
+void appendRun(std::vector<std::uint8_t>& output, std::uint8_t value, std::size_t run) {
+    // (value, run length) pair, run length as LEB128
+    output.push_back(value);
+    while (run >= 0x80) {
+        output.push_back(static_cast<std::uint8_t>((run & 0x7F) | 0x80));
+        run >>= 7;
     }
-    return result;
+    output.push_back(static_cast<std::uint8_t>(run));
 }
 
-std::vector<std::uint8_t> buildResidualChannel(const cv::Mat& image, int channel) {
-    // build residuals for a single channel
-    const int width = image.cols;
-    const int height = image.rows;
-    std::vector<std::uint8_t> residuals(static_cast<std::size_t>(width) * static_cast<std::size_t>(height));
-
-    for (int row = 0; row < height; ++row) {
-        if (image.channels() == 1) {
-            const auto* rowPtr = image.ptr<std::uint8_t>(row);
-            for (int col = 0; col < width; ++col) {
-                const std::size_t index = static_cast<std::size_t>(row) * width + col;
-                const std::uint8_t current = rowPtr[col];
-                if (col == 0) {
-                    residuals[index] = current;
-                } else {
-                    const std::uint8_t left = rowPtr[col - 1];
-                    const int diff = static_cast<int>(current) - static_cast<int>(left);
-                    residuals[index] = static_cast<std::uint8_t>(diff & 0xFF);
-                }
-            }
-        } else {
-            const auto* rowPtr = image.ptr<cv::Vec3b>(row);
-            for (int col = 0; col < width; ++col) {
-                const std::size_t index = static_cast<std::size_t>(row) * width + col;
-                const std::uint8_t current = rowPtr[col][channel];
-                if (col == 0) {
-                    residuals[index] = current;
-                } else {
-                    const std::uint8_t left = rowPtr[col - 1][channel];
-                    const int diff = static_cast<int>(current) - static_cast<int>(left);
-                    residuals[index] = static_cast<std::uint8_t>(diff & 0xFF);
-                }
-            }
+void encodeRuns(const std::vector<std::uint8_t>& data, std::vector<std::uint8_t>& output) {
+    output.clear();
+    const std::size_t size = data.size();
+    std::size_t begin = 0;
+    while (begin < size) {
+        const std::uint8_t value = data[begin];
+        std::size_t end = begin + 1;
+        while (end < size && data[end] == value) {
+            ++end;
         }
+        appendRun(output, value, end - begin);
+        begin = end;
     }
-
-    return residuals;
 }
 
-std::vector<std::uint8_t> reconstruct(const std::vector<std::uint8_t>& residuals, int width, int height) {
-    // reconstruct original channel values from residuals
-    std::vector<std::uint8_t> values(residuals.size());
-    for (int row = 0; row < height; ++row) {
-        for (int col = 0; col < width; ++col) {
-            const std::size_t index = static_cast<std::size_t>(row) * width + col;
-            const std::uint8_t encoded = residuals[index];
-            if (col == 0) {
-                values[index] = encoded;
-            } else {
-                const std::uint8_t previous = values[index - 1];
-                const std::uint16_t sum = static_cast<std::uint16_t>(previous) + static_cast<std::uint16_t>(encoded);
-                values[index] = static_cast<std::uint8_t>(sum & 0xFFU);
-            }
-        }
-    }
-    return values;
-}
+// Plane payloads are read ahead in slices of about this many bytes in total
+constexpr std::size_t kReadAheadSliceBytes = std::size_t{1} << 20;
 
-} // namespace
+class PayloadReadAhead {
+public:
+    struct Plane {
+        std::streamoff offset = 0;      // position of the payload in the stream
+        std::uint8_t* data = nullptr;   // sized by the caller, filled here
+        std::size_t size = 0;
+    };
 
-ImageData ImageLoader::load(const std::string& path) {
-    std::ifstream ifs(path, std::ios::binary);
-    if (!ifs) {
-        throw std::runtime_error("无法打开文件: " + path);
+    // Reads the payloads of a seekable stream on a background thread. Every
+    // slice advances each plane by the same fraction of its payload, so rows
+    // can be decoded side by side while the rest of the file is still loading.
+    PayloadReadAhead(std::istream& is, const std::array<Plane, 3>& planes, int count) : planes_(planes), count_(count) {
+        thread_ = std::thread([this, &is]() {
+            try {
+                run(is);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                error_ = std::current_exception();
+                ready_.notify_all();
+            }
+        });
     }
 
-    ImageData data;
-    data.magic = readToken(ifs);
-    if (data.magic != "P2" && data.magic != "P3" && data.magic != "P6") {
-        throw std::runtime_error("仅支持 P2/P3/P6 格式，检测到: " + data.magic);
+    // blocks until the first bytes of the plane's payload are in memory
+    void waitFor(int plane, std::size_t bytes) {
+        const auto& loaded = loaded_[static_cast<std::size_t>(plane)];
+        if (loaded.load(std::memory_order_acquire) >= bytes) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [&]() { return loaded.load(std::memory_order_acquire) >= bytes || error_; });
+        if (loaded.load(std::memory_order_acquire) < bytes) {
+            std::rethrow_exception(error_);
+        }
     }
 
-    data.width = std::stoi(readToken(ifs));
-    data.height = std::stoi(readToken(ifs));
-    data.maxValue = std::stoi(readToken(ifs));
-
-    if (data.width <= 0 || data.height <= 0) {
-        throw std::runtime_error("图像尺寸非法");
+    // waits for the rest of the payloads, which a truncated file fails to deliver
+    void finish() {
+        thread_.join();
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
     }
-    if (data.maxValue <= 0) {
-        throw std::runtime_error("最大像素值必须大于 0");
+
+    ~PayloadReadAhead() {
+        cancelled_.store(true, std::memory_order_relaxed);
+        if (thread_.joinable()) {
+            thread_.join();
+        }
     }
 
-    if (data.magic == "P2" || data.magic == "P3") {
-        data.image = readAscii(data.magic, ifs, data.width, data.height, data.maxValue);
-    } else {
-        char whitespace = static_cast<char>(ifs.get());
-        if (whitespace == '\r' && ifs.peek() == '\n') {
-            ifs.get();
+private:
+    void run(std::istream& is) {
+        std::uint64_t total = 0;
+        for (int p = 0; p < count_; ++p) {
+            total += planes_[static_cast<std::size_t>(p)].size;
+        }
+        const std::uint64_t slices = std::max<std::uint64_t>(1, (total + kReadAheadSliceBytes - 1) / kReadAheadSliceBytes);
+        for (std::uint64_t slice = 1; slice <= slices; ++slice) {
+            for (int p = 0; p < count_; ++p) {
+                if (cancelled_.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                const Plane& plane = planes_[static_cast<std::size_t>(p)];
+                auto& loaded = loaded_[static_cast<std::size_t>(p)];
+                const std::size_t begin = loaded.load(std::memory_order_relaxed);
+                const auto end = static_cast<std::size_t>(plane.size * slice / slices);
+                if (end == begin) {
+                    continue;
+                }
+                is.seekg(plane.offset + static_cast<std::streamoff>(begin));
+                is.read(reinterpret_cast<char*>(plane.data + begin), static_cast<std::streamsize>(end - begin));
+                if (!is) {
+                    throw std::runtime_error("读取压缩数据正文失败");
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                loaded.store(end, std::memory_order_release);
+                ready_.notify_all();
+            }
         }
-        data.image = readBinaryP6(ifs, data.width, data.height, data.maxValue);
     }
 
-    return data;
-}
+    std::array<Plane, 3> planes_;
+    int count_ = 0;
+    std::array<std::atomic<std::size_t>, 3> loaded_{};
+    std::atomic<bool> cancelled_{false};
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::exception_ptr error_;
+    std::thread thread_;
+};
 
-void ImageLoader::save(const std::string& path, const cv::Mat& image, int maxValue, bool useBinaryColor) {
-    if (image.empty()) {
-        throw std::runtime_error("尝试保存空图像");
+class PlaneDecoder {
+public:
+    // Resumable decoder of one coded plane, producing its residuals a row at
+    // a time so that the planes of an image can be decoded side by side.
+    // Dictionary planes decode with sharedNodes, the trie of the dictionary table.
+    PlaneDecoder(ChannelCoding coding, const std::uint8_t* payload, std::size_t size, const std::array<std::uint8_t, 256>& lengths,
+                 std::vector<DecoderNode>& nodes, std::size_t expectedCount,
+                 const std::vector<DecoderNode>* sharedNodes = nullptr)
+        : coding_(coding), data_(payload), size_(size), reader_(payload, size) {
+        if (coding_ == ChannelCoding::Stored && size_ != expectedCount) {
+            throw std::runtime_error("未压缩通道的数据长度不匹配");
+        }
+        if (coding_ == ChannelCoding::Huffman) {
+            huffman_.emplace(buildCanonicalTable(lengths), nodes);
+        }
+        if (coding_ == ChannelCoding::Dictionary) {
+            if (sharedNodes == nullptr) {
+                throw std::runtime_error("压缩数据使用了共享字典，但未提供字典");
+            }
+            huffman_.emplace(*sharedNodes);
+        }
     }
 
-    if (image.depth() != CV_8U) {
-        throw std::runtime_error("当前仅支持 8 位图像保存");
+    // rows wait for their bytes in readAhead instead of assuming the whole payload is loaded
+    void streamFrom(PayloadReadAhead& readAhead, int plane) {
+        readAhead_ = &readAhead;
+        plane_ = plane;
+    }
+
+    void readRow(std::uint8_t* out, std::size_t count) {
+        if (readAhead_ != nullptr) {
+            readAhead_->waitFor(plane_, std::min(size_, consumed() + maxRowBytes(count)));
+        }
+        switch (coding_) {
+        case ChannelCoding::Stored:
+            std::memcpy(out, data_ + index_, count);
+            index_ += count;
+            break;
+        case ChannelCoding::RunLength:
+            readRuns(out, count);
+            break;
+        case ChannelCoding::Huffman:
+        case ChannelCoding::Dictionary:
+            for (std::size_t i = 0; i < count; ++i) {
+                out[i] = huffman_->decodeSymbol(reader_);
+            }
+            break;
+        }
+    }
+
+    void finish() const {
+        // every run must have been consumed exactly by the last row
+        if (coding_ == ChannelCoding::RunLength && (runRemaining_ > 0 || index_ < size_)) {
+            throw std::runtime_error("游程编码数据超出图像范围");
+        }
+    }
+
+private:
+    std::size_t consumed() const {
+        return coding_ == ChannelCoding::Huffman || coding_ == ChannelCoding::Dictionary ? reader_.position() : index_;
+    }
+
+    std::size_t maxRowBytes(std::size_t count) const {
+        // most payload bytes a row of count samples can take
+        switch (coding_) {
+        case ChannelCoding::Stored:
+            return count;
+        case ChannelCoding::RunLength:
+            // a run per sample, plus the rest of a long run's header
+            return 2 * count + 11;
+        case ChannelCoding::Huffman:
+        case ChannelCoding::Dictionary:
+            break;
+        }
+        return (count * kMaxCodeLength + 7) / 8;
     }
 
+    void readRuns(std::uint8_t* out, std::size_t count) {
+        // (value, run length) pairs, run length as LEB128
+        while (count > 0) {
+            if (runRemaining_ == 0) {
+                if (index_ >= size_) {
+                    throw std::runtime_error("游程编码数据长度不匹配");
+                }
+                runValue_ = data_[index_++];
+                int shift = 0;
+                while (true) {
+                    if (index_ >= size_ || shift > 56) {
+                        throw std::runtime_error("游程编码数据损坏");
+                    }
+                    const std::uint8_t byte = data_[index_++];
+                    runRemaining_ |= static_cast<std::size_t>(byte & 0x7F) << shift;
+                    if ((byte & 0x80) == 0) {
+                        break;
+                    }
+                    shift += 7;
+                }
+                continue;
+            }
+            const std::size_t take = std::min(runRemaining_, count);
+            std::memset(out, runValue_, take);
+            out += take;
+            count -= take;
+            runRemaining_ -= take;
+        }
+    }
+
+    ChannelCoding coding_;
+    const std::uint8_t* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t index_ = 0;
+    BitReader reader_;
+    std::optional<HuffmanDecoder> huffman_;
+    std::uint8_t runValue_ = 0;
+    std::size_t runRemaining_ = 0;
+    PayloadReadAhead* readAhead_ = nullptr;
+    int plane_ = 0;
+};
+
+void buildResidualPlanes(const cv::Mat& image, const cv::Mat* reference, std::array<std::vector<std::uint8_t>, 3>& residuals,
+                         std::array<ChannelStatistics, 3>& statistics, std::vector<std::uint8_t>& scratch) {
+    // left-difference residuals of every channel in a single pass over the
+    // image; each residual row is counted right after it is produced. With a
+    // reference frame the left difference is taken of the temporal
+    // difference, i.e. the prediction is left + (reference - reference left).
+    const int width = image.cols;
+    const int height = image.rows;
     const int channels = image.channels();
-    const bool isColor = channels == 3;
+    const std::size_t pixelCount = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+    const std::size_t samples = static_cast<std::size_t>(width) * static_cast<std::size_t>(channels);
+    std::array<StatisticsAccumulator, 3> accumulators;
+    for (int ch = 0; ch < channels; ++ch) {
+        residuals[static_cast<std::size_t>(ch)].resize(pixelCount);
+    }
+    if (reference) {
+        scratch.resize(samples);
+    }
 
+    std::uint8_t* planes[3] = {};
+    for (int row = 0; row < height; ++row) {
+        const std::size_t offset = static_cast<std::size_t>(row) * static_cast<std::size_t>(width);
+        for (int ch = 0; ch < channels; ++ch) {
+            planes[ch] = residuals[static_cast<std::size_t>(ch)].data() + offset;
+        }
+        const std::uint8_t* source = image.ptr<std::uint8_t>(row);
+        if (reference) {
+            const std::uint8_t* previous = reference->ptr<std::uint8_t>(row);
+            for (std::size_t i = 0; i < samples; ++i) {
+                scratch[i] = static_cast<std::uint8_t>(source[i] - previous[i]);
+            }
+            source = scratch.data();
+        }
+        PixelKernels::leftDifference(source, width, channels, planes);
+        for (int ch = 0; ch < channels; ++ch) {
+            accumulators[static_cast<std::size_t>(ch)].add(planes[ch], static_cast<std::size_t>(width));
+        }
+    }
+    for (int ch = 0; ch < channels; ++ch) {
+        statistics[static_cast<std::size_t>(ch)] = accumulators[static_cast<std::size_t>(ch)].finish();
+    }
+}
+
+int quantizeError(int error, int near) {
+    // JPEG-LS style: round the prediction error to a multiple of 2 * near + 1
+    const int step = 2 * near + 1;
+    return error >= 0 ? (error + near) / step : -((near - error) / step);
+}
+
+template <int Channels>
+void quantizeRow(const std::uint8_t* samples, int width, int near, int maxSample, std::uint8_t* out) {
+    // samples points at the channel's first sample, Channels apart
+    const int step = 2 * near + 1;
+    int predicted = 0;
+    for (int col = 0; col < width; ++col) {
+        const int current = samples[col * Channels];
+        const int quantized = quantizeError(current - predicted, near);
+        predicted = std::clamp(predicted + quantized * step, 0, maxSample);
+        out[col] = static_cast<std::uint8_t>(static_cast<std::int8_t>(quantized));
+    }
+}
+
+void buildQuantizedResidualChannel(const cv::Mat& image, int channel, int near, int maxSample, std::vector<std::uint8_t>& residuals,
+                                   ChannelStatistics& statistics) {
+    // near-lossless residuals; the predictor is the reconstructed left sample,
+    // so the decoder sees exactly the same predictions and errors do not drift
+    const int width = image.cols;
+    const int height = image.rows;
+    const auto quantize = image.channels() == 3 ? &quantizeRow<3> : &quantizeRow<1>;
+    residuals.resize(static_cast<std::size_t>(width) * static_cast<std::size_t>(height));
+    StatisticsAccumulator accumulator;
+
+    for (int row = 0; row < height; ++row) {
+        std::uint8_t* out = residuals.data() + static_cast<std::size_t>(row) * width;
+        quantize(image.ptr<std::uint8_t>(row) + channel, width, near, maxSample, out);
+        accumulator.add(out, static_cast<std::size_t>(width));
+    }
+    statistics = accumulator.finish();
+}
+
+template <int Channels>
+void reconstructQuantizedRow(const std::uint8_t* residuals, int width, int near, int maxSample, std::uint8_t* row) {
+    // inverse of quantizeRow, written at the image's channel stride
+    const int step = 2 * near + 1;
+    int predicted = 0;
+    for (int col = 0; col < width; ++col) {
+        const int quantized = static_cast<std::int8_t>(residuals[col]);
+        predicted = std::clamp(predicted + quantized * step, 0, maxSample);
+        row[col * Channels] = static_cast<std::uint8_t>(predicted);
+    }
+}
+
+class ColourTable {
+public:
+    // open-addressing set of packed 24-bit colours, holding at most 256 entries
+    ColourTable() {
+        slots_.fill(kEmpty);
+    }
+
+    bool insert(std::uint32_t colour) {
+        // returns false once a 257th distinct colour shows up
+        std::size_t slot = slotOf(colour);
+        while (slots_[slot] != kEmpty) {
+            if (slots_[slot] == colour) {
+                return true;
+            }
+            slot = (slot + 1) & (kSlotCount - 1);
+        }
+        if (size_ == kMaxColours) {
+            return false;
+        }
+        slots_[slot] = colour;
+        ++size_;
+        return true;
+    }
+
+    std::uint8_t indexOf(std::uint32_t colour) const {
+        std::size_t slot = slotOf(colour);
+        while (slots_[slot] != colour) {
+            slot = (slot + 1) & (kSlotCount - 1);
+        }
+        return indices_[slot];
+    }
+
+    void assignIndices(std::vector<std::uint32_t>& palette) {
+        // sorted palette, so that similar colours get nearby indices
+        palette.clear();
+        for (std::uint32_t colour : slots_) {
+            if (colour != kEmpty) {
+                palette.push_back(colour);
+            }
+        }
+        std::sort(palette.begin(), palette.end());
+        for (std::size_t i = 0; i < palette.size(); ++i) {
+            std::size_t slot = slotOf(palette[i]);
+            while (slots_[slot] != palette[i]) {
+                slot = (slot + 1) & (kSlotCount - 1);
+            }
+            indices_[slot] = static_cast<std::uint8_t>(i);
+        }
+    }
+
+private:
+    static constexpr std::uint32_t kEmpty = 0xFFFFFFFFU;
+    static constexpr std::size_t kSlotCount = 512;
+    static constexpr std::size_t kMaxColours = 256;
+
+    static std::size_t slotOf(std::uint32_t colour) {
+        return static_cast<std::size_t>((colour * 2654435761U) >> 23);
+    }
+
+    std::array<std::uint32_t, kSlotCount> slots_;
+    std::array<std::uint8_t, kSlotCount> indices_{};
+    std::size_t size_ = 0;
+};
+
+std::uint32_t packColour(const cv::Vec3b& pixel) {
+    return (static_cast<std::uint32_t>(pixel[0]) << 16) | (static_cast<std::uint32_t>(pixel[1]) << 8) | pixel[2];
+}
+
+bool buildPaletteIndices(const cv::Mat& image, std::vector<std::uint32_t>& palette, std::vector<std::uint8_t>& indices) {
+    // detect images with at most 256 colours and map them to one index plane
+    ColourTable table;
+    for (int row = 0; row < image.rows; ++row) {
+        const auto* rowPtr = image.ptr<cv::Vec3b>(row);
+        std::uint32_t previous = 0xFFFFFFFFU;
+        for (int col = 0; col < image.cols; ++col) {
+            const std::uint32_t colour = packColour(rowPtr[col]);
+            if (colour != previous && !table.insert(colour)) {
+                return false;
+            }
+            previous = colour;
+        }
+    }
+    table.assignIndices(palette);
+
+    indices.resize(image.total());
+    std::uint8_t* out = indices.data();
+    for (int row = 0; row < image.rows; ++row) {
+        const auto* rowPtr = image.ptr<cv::Vec3b>(row);
+        std::uint32_t previous = 0xFFFFFFFFU;
+        std::uint8_t previousIndex = 0;
+        for (int col = 0; col < image.cols; ++col) {
+            const std::uint32_t colour = packColour(rowPtr[col]);
+            if (colour != previous) {
+                previous = colour;
+                previousIndex = table.indexOf(colour);
+            }
+            *out++ = previousIndex;
+        }
+    }
+    return true;
+}
+
+// Huffman has to beat a stored channel by this fraction to be worth decoding
+constexpr std::uint64_t kHuffmanSavingDivisor = 32;
+
+std::uint64_t huffmanPayloadBytes(const ChannelStatistics& stats, const std::array<std::uint8_t, 256>& lengths) {
+    std::uint64_t bits = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        bits += stats.histogram[symbol] * lengths[symbol];
+    }
+    return (bits + 7) / 8;
+}
+
+ChannelCoding chooseCoding(const ChannelStatistics& stats, const std::array<std::uint8_t, 256>& lengths, std::uint64_t storedBytes,
+                           const HuffmanTable* shared) {
+    const std::uint64_t huffmanBytes = 256 + huffmanPayloadBytes(stats, lengths);
+
+    ChannelCoding best = ChannelCoding::Stored;
+    std::uint64_t bestBytes = storedBytes;
+    if (stats.runLengthBytes < bestBytes) {
+        best = ChannelCoding::RunLength;
+        bestBytes = stats.runLengthBytes;
+    }
+    const std::uint64_t huffmanLimit = storedBytes - storedBytes / kHuffmanSavingDivisor;
+    if (huffmanBytes < bestBytes && huffmanBytes < huffmanLimit) {
+        best = ChannelCoding::Huffman;
+        bestBytes = huffmanBytes;
+    }
+    if (shared != nullptr) {
+        // the shared table costs nothing in the file
+        const std::uint64_t dictionaryBytes = huffmanPayloadBytes(stats, shared->lengths);
+        if (dictionaryBytes < bestBytes && dictionaryBytes < huffmanLimit) {
+            best = ChannelCoding::Dictionary;
+        }
+    }
+    return best;
+}
+
+void encodeResiduals(const std::vector<std::uint8_t>& residuals, const ChannelStatistics& stats, HuffmanTable& table,
+                     ChannelCoding& coding, std::vector<std::uint8_t>& encoded, const HuffmanTable* shared = nullptr) {
+    // Code the channel with the cheapest mode according to its statistics
+    const auto lengths = buildCodeLengths(stats.histogram);
+    coding = chooseCoding(stats, lengths, residuals.size(), shared);
+    switch (coding) {
+    case ChannelCoding::Stored:
+        break;  // the residuals themselves are the payload
+    case ChannelCoding::RunLength:
+        encodeRuns(residuals, encoded);
+        break;
+    case ChannelCoding::Huffman:
+        table = buildCanonicalTable(lengths);
+        encode(residuals, table, encoded);
+        break;
+    case ChannelCoding::Dictionary:
+        encode(residuals, *shared, encoded);
+        break;
+    }
+}
+
+void writeCompressedHeader(std::ostream& os, std::uint8_t flags, int width, int height, int maxValue, int channels, int near,
+                           const HuffmanDictionary* dictionary) {
+    os.write(kCompressedMagic, static_cast<std::streamsize>(kCompressedMagicSize));
+    writeUint8(os, flags);
+    writeUint32(os, static_cast<std::uint32_t>(width));
+    writeUint32(os, static_cast<std::uint32_t>(height));
+    writeUint16(os, static_cast<std::uint16_t>(maxValue));
+    writeUint8(os, static_cast<std::uint8_t>(channels));
+    if (near > 0) {
+        writeUint8(os, static_cast<std::uint8_t>(near));
+    }
+    if (dictionary != nullptr) {
+        writeUint32(os, dictionary->id());
+    }
+}
+
+void writePalette(std::ostream& os, const std::vector<std::uint32_t>& palette) {
+    writeUint8(os, static_cast<std::uint8_t>(palette.size() - 1));
+    for (std::uint32_t colour : palette) {
+        writeUint8(os, static_cast<std::uint8_t>(colour >> 16));
+        writeUint8(os, static_cast<std::uint8_t>(colour >> 8));
+        writeUint8(os, static_cast<std::uint8_t>(colour));
+    }
+}
+
+std::uint64_t writePlane(std::ostream& os, ChannelCoding coding, const HuffmanTable& table, const std::vector<std::uint8_t>& residuals,
+                         const std::vector<std::uint8_t>& encoded, bool wideSizes) {
+    // [coding] [Huffman code lengths] [payload byte count] [payload]; returns table + payload bytes
+    writeUint8(os, static_cast<std::uint8_t>(coding));
+    std::uint64_t tableBytes = 0;
+    if (coding == ChannelCoding::Huffman) {
+        os.write(reinterpret_cast<const char*>(table.lengths.data()), static_cast<std::streamsize>(table.lengths.size()));
+        tableBytes = table.lengths.size();
+    }
+    const auto& data = coding == ChannelCoding::Stored ? residuals : encoded;
+    if (wideSizes) {
+        writeUint64(os, data.size());
+    } else {
+        writeUint32(os, static_cast<std::uint32_t>(data.size()));
+    }
+    if (!data.empty()) {
+        os.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    }
+    if (!os) {
+        throw std::runtime_error("写入压缩数据失败");
+    }
+    return tableBytes + data.size();
+}
+
+const std::uint8_t* readPayload(std::istream& is, std::uint64_t byteCount, std::vector<std::uint8_t>& copy) {
+    // payloads of in-memory input are decoded where they are; streams are read into copy
+    if (auto* memory = dynamic_cast<MemoryBuffer*>(is.rdbuf())) {
+        const char* data = memory->take(static_cast<std::size_t>(byteCount));
+        if (data == nullptr) {
+            throw std::runtime_error("读取压缩数据正文失败");
+        }
+        return reinterpret_cast<const std::uint8_t*>(data);
+    }
+    copy.resize(static_cast<std::size_t>(byteCount));
+    if (byteCount > 0) {
+        is.read(reinterpret_cast<char*>(copy.data()), static_cast<std::streamsize>(byteCount));
+        if (!is) {
+            throw std::runtime_error("读取压缩数据正文失败");
+        }
+    }
+    return copy.data();
+}
+
+struct PlanePayload {
+    const std::uint8_t* data = nullptr;
+    std::size_t size = 0;
+};
+
+PlanePayload readPlane(std::istream& is, bool legacy, bool wideSizes, std::size_t pixelCount, ChannelCoding& coding,
+                       std::array<std::uint8_t, 256>& lengths, std::vector<std::uint8_t>& payload,
+                       std::streamoff* deferredAt = nullptr) {
+    // inverse of writePlane; legacy planes have no coding byte and are always Huffman coded.
+    // payload holds the bytes only when they could not be used in place. With deferredAt
+    // the payload is skipped: payload is only sized and *deferredAt gets its stream offset.
+    coding = ChannelCoding::Huffman;
+    if (!legacy) {
+        const std::uint8_t mode = readUint8(is);
+        if (mode > static_cast<std::uint8_t>(ChannelCoding::Dictionary)) {
+            throw std::runtime_error("压缩文件包含未知的通道编码方式");
+        }
+        coding = static_cast<ChannelCoding>(mode);
+    }
+
+    if (coding == ChannelCoding::Huffman) {
+        is.read(reinterpret_cast<char*>(lengths.data()), static_cast<std::streamsize>(lengths.size()));
+        if (!is) {
+            throw std::runtime_error("读取哈夫曼码长度失败");
+        }
+        // a prefix code the canonical table can hold
+        std::uint64_t kraft = 0;
+        for (std::uint8_t length : lengths) {
+            if (length > kMaxCodeLength) {
+                throw std::runtime_error("哈夫曼码长度非法");
+            }
+            if (length > 0) {
+                kraft += std::uint64_t{1} << (kMaxCodeLength - length);
+            }
+        }
+        if (kraft > (std::uint64_t{1} << kMaxCodeLength)) {
+            throw std::runtime_error("哈夫曼码长度非法");
+        }
+    }
+
+    const std::uint64_t byteCount = wideSizes ? readUint64(is) : readUint32(is);
+    if (byteCount / 2 > pixelCount + 8) {
+        // even legacy all-Huffman planes stay far below two bytes per pixel
+        throw std::runtime_error("压缩数据正文长度非法");
+    }
+    if (deferredAt != nullptr) {
+        *deferredAt = is.tellg();
+        payload.resize(static_cast<std::size_t>(byteCount));
+        is.seekg(static_cast<std::streamoff>(byteCount), std::ios::cur);
+        if (!is) {
+            throw std::runtime_error("读取压缩数据正文失败");
+        }
+        return {payload.data(), static_cast<std::size_t>(byteCount)};
+    }
+    return {readPayload(is, byteCount, payload), static_cast<std::size_t>(byteCount)};
+}
+
+// Below this many pixels per channel, thread start-up costs more than the overlap saves
+constexpr std::size_t kPipelinePixelThreshold = std::size_t{1} << 18;
+
+class ChannelWorkers {
+public:
+    // one worker thread per channel; wait() hands back the finished channels in order
+    template <typename Task>
+    void spawn(int channel, Task task) {
+        auto& error = errors_[static_cast<std::size_t>(channel)];
+        threads_[static_cast<std::size_t>(channel)] = std::thread([task, &error]() {
+            try {
+                task();
+            } catch (...) {
+                error = std::current_exception();
+            }
+        });
+    }
+
+    void wait(int channel) {
+        auto& thread = threads_[static_cast<std::size_t>(channel)];
+        if (thread.joinable()) {
+            thread.join();
+        }
+        if (auto error = errors_[static_cast<std::size_t>(channel)]) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    ~ChannelWorkers() {
+        for (auto& thread : threads_) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+private:
+    std::array<std::thread, 3> threads_;
+    std::array<std::exception_ptr, 3> errors_;
+};
+
+// Dictionary tables are trained per kind of plane: the three colour channels,
+// grey images and palette indices have quite different residual statistics
+constexpr int kDictionarySlots = 5;
+constexpr int kDictionaryGraySlot = 3;
+constexpr int kDictionaryPaletteSlot = 4;
+// Training counts are scaled to about this total, which keeps every code below 32 bits
+constexpr std::uint64_t kDictionaryScale = std::uint64_t{1} << 20;
+
+// Images with at least this many pixels are converted to triples on several threads
+constexpr std::size_t kParallelTriplePixels = std::size_t{1} << 18;
+// saveTriples formats this many triples per thread before writing them out
+constexpr std::size_t kTriplesPerTextChunk = std::size_t{1} << 16;
+
+template <int Channels, typename Visit>
+void forEachNonZeroPixel(const std::uint8_t* rowPtr, int width, Visit visit) {
+    // visit(col, pixel) for every pixel with any non-zero channel; zero stretches are skipped in bulk
+    const std::size_t rowBytes = static_cast<std::size_t>(width) * Channels;
+    for (int col = 0; col < width;) {
+        const std::size_t offset = static_cast<std::size_t>(col) * Channels;
+        const std::uint8_t* pixel = rowPtr + offset;
+        std::uint8_t any = 0;
+        for (int ch = 0; ch < Channels; ++ch) {
+            any |= pixel[ch];
+        }
+        if (any == 0) {
+            // the next pixel with a non-zero byte, or width
+            col = static_cast<int>((offset + PixelKernels::findNonZero(pixel, rowBytes - offset)) / Channels);
+            continue;
+        }
+        visit(col, pixel);
+        ++col;
+    }
+}
+
+template <int Channels>
+ImageLoader::PixelTriple* fillRowTriples(const std::uint8_t* rowPtr, int row, int width, ImageLoader::PixelTriple* out) {
+    // writes the row's triples from out on; returns the end of what was written
+    forEachNonZeroPixel<Channels>(rowPtr, width, [&out, row](int col, const std::uint8_t* pixel) {
+        out->row = row;
+        out->col = col;
+        out->channels = Channels;
+        for (int ch = 0; ch < Channels; ++ch) {
+            out->value[static_cast<std::size_t>(ch)] = pixel[ch];
+        }
+        ++out;
+    });
+    return out;
+}
+
+char* appendIndex(char* out, char* limit, int value) {
+    // limit leaves room for the separator
+    out = std::to_chars(out, limit, value).ptr;
+    *out++ = ' ';
+    return out;
+}
+
+char* appendSample(char* out, std::uint8_t value, char separator) {
+    const auto& text = kDecimalSamples[value];
+    std::memcpy(out, text.data(), 3);
+    out += text[3];
+    *out++ = separator;
+    return out;
+}
+
+void formatTriples(const ImageLoader::PixelTriple* first, const ImageLoader::PixelTriple* last, std::vector<char>& text) {
+    // "row col v0[ v1 v2]\n" per triple, as operator<< prints it
+    constexpr std::size_t kMaxLineBytes = 2 * 12 + 3 * 4;
+    text.resize(static_cast<std::size_t>(last - first) * kMaxLineBytes + 1);
+    char* out = text.data();
+    char* const limit = text.data() + text.size() - 1;
+    for (const auto* triple = first; triple != last; ++triple) {
+        out = appendIndex(out, limit, triple->row);
+        out = appendIndex(out, limit, triple->col);
+        if (triple->channels == 1) {
+            out = appendSample(out, triple->value[0], '\n');
+        } else {
+            out = appendSample(out, triple->value[0], ' ');
+            out = appendSample(out, triple->value[1], ' ');
+            out = appendSample(out, triple->value[2], '\n');
+        }
+    }
+    text.resize(static_cast<std::size_t>(out - text.data()));
+}
+
+int dictionarySlot(int channels, bool usePalette, int plane) {
+    if (usePalette) {
+        return kDictionaryPaletteSlot;
+    }
+    return channels == 1 ? kDictionaryGraySlot : plane;
+}
+
+std::array<std::uint8_t, 256> buildDictionaryLengths(const std::array<std::uint64_t, 256>& histogram) {
+    // every symbol needs a code, since the images coded later are not known yet
+    std::uint64_t total = 0;
+    for (std::uint64_t count : histogram) {
+        total += count;
+    }
+    const std::uint64_t divisor = total / kDictionaryScale + 1;
+    std::array<std::uint64_t, 256> scaled{};
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        scaled[symbol] = 1 + histogram[symbol] / divisor;
+    }
+    return buildCodeLengths(scaled);
+}
+
+std::uint32_t dictionaryId(const std::array<std::array<std::uint8_t, 256>, kDictionarySlots>& lengths) {
+    // FNV-1a over the code lengths: the same training data always yields the same ID
+    std::uint32_t hash = 2166136261U;
+    for (const auto& table : lengths) {
+        for (std::uint8_t length : table) {
+            hash = (hash ^ length) * 16777619U;
+        }
+    }
+    return hash;
+}
+
+struct SparseResidual {
+    std::size_t position;   // row-major index in the plane
+    std::uint8_t value;     // never 0
+};
+
+template <typename SampleOf>
+void buildSparseResiduals(const std::vector<ImageLoader::PixelTriple>& triples, int width, SampleOf sampleOf,
+                          std::vector<SparseResidual>& residuals) {
+    // non-zero left differences of a plane that is 0 outside the triples: one where a pixel
+    // differs from its left neighbour and one after each non-zero pixel followed by a zero
+    residuals.clear();
+    const auto stride = static_cast<std::size_t>(width);
+    int lastRow = -1;
+    int lastCol = -1;
+    std::uint8_t lastValue = 0;
+    const auto closeRun = [&]() {
+        if (lastValue != 0 && lastCol + 1 < width) {
+            const std::size_t position = static_cast<std::size_t>(lastRow) * stride + static_cast<std::size_t>(lastCol + 1);
+            residuals.push_back({position, static_cast<std::uint8_t>(-lastValue)});
+        }
+    };
+    for (std::size_t i = 0; i < triples.size(); ++i) {
+        const auto& triple = triples[i];
+        const std::uint8_t value = sampleOf(i);
+        const bool adjacent = triple.row == lastRow && triple.col == lastCol + 1;
+        if (!adjacent) {
+            closeRun();
+        }
+        const auto residual = static_cast<std::uint8_t>(value - (adjacent ? lastValue : 0));
+        if (residual != 0) {
+            residuals.push_back({static_cast<std::size_t>(triple.row) * stride + static_cast<std::size_t>(triple.col), residual});
+        }
+        lastRow = triple.row;
+        lastCol = triple.col;
+        lastValue = value;
+    }
+    closeRun();
+}
+
+class RunWriter {
+public:
+    // run-length payload fed runs that may continue each other, as encodeRuns would write it
+    explicit RunWriter(std::vector<std::uint8_t>& output) : output_(output) {
+        output_.clear();
+    }
+
+    void add(std::uint8_t value, std::size_t count) {
+        if (count == 0) {
+            return;
+        }
+        if (length_ > 0 && value == value_) {
+            length_ += count;
+            return;
+        }
+        finish();
+        value_ = value;
+        length_ = count;
+    }
+
+    void finish() {
+        if (length_ > 0) {
+            appendRun(output_, value_, length_);
+            length_ = 0;
+        }
+    }
+
+private:
+    std::vector<std::uint8_t>& output_;
+    std::uint8_t value_ = 0;
+    std::size_t length_ = 0;
+};
+
+void encodeSparse(const std::vector<SparseResidual>& residuals, std::size_t pixelCount, const HuffmanTable& table,
+                  std::vector<std::uint8_t>& output) {
+    // every position still gets a code, so this is linear in the payload rather than the triples
+    BitWriter writer(output);
+    std::size_t cursor = 0;
+    const auto writeZeros = [&writer, &table](std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            writer.writeBits(table.codes[0], table.lengths[0]);
+        }
+    };
+    for (const SparseResidual& residual : residuals) {
+        writeZeros(residual.position - cursor);
+        writer.writeBits(table.codes[residual.value], table.lengths[residual.value]);
+        cursor = residual.position + 1;
+    }
+    writeZeros(pixelCount - cursor);
+    writer.finish();
+}
+
+void encodeSparseResiduals(const std::vector<SparseResidual>& residuals, std::size_t pixelCount, HuffmanTable& table,
+                           ChannelCoding& coding, std::vector<std::uint8_t>& stored, std::vector<std::uint8_t>& encoded,
+                           const HuffmanTable* shared) {
+    // same statistics and choice as encodeResiduals, derived from the non-zero residuals
+    ChannelStatistics stats;
+    for (const SparseResidual& residual : residuals) {
+        ++stats.histogram[residual.value];
+    }
+    stats.histogram[0] = pixelCount - residuals.size();
+
+    // the run-length payload is only O(residuals), so it is built outright to get its size
+    std::vector<std::uint8_t> runs;
+    RunWriter writer(runs);
+    std::size_t cursor = 0;
+    for (const SparseResidual& residual : residuals) {
+        writer.add(0, residual.position - cursor);
+        writer.add(residual.value, 1);
+        cursor = residual.position + 1;
+    }
+    writer.add(0, pixelCount - cursor);
+    writer.finish();
+    stats.runLengthBytes = runs.size();
+
+    const auto lengths = buildCodeLengths(stats.histogram);
+    coding = chooseCoding(stats, lengths, pixelCount, shared);
+    switch (coding) {
+    case ChannelCoding::Stored:
+        stored.assign(pixelCount, 0);
+        for (const SparseResidual& residual : residuals) {
+            stored[residual.position] = residual.value;
+        }
+        break;
+    case ChannelCoding::RunLength:
+        encoded = std::move(runs);
+        break;
+    case ChannelCoding::Huffman:
+        table = buildCanonicalTable(lengths);
+        encodeSparse(residuals, pixelCount, table, encoded);
+        break;
+    case ChannelCoding::Dictionary:
+        encodeSparse(residuals, pixelCount, *shared, encoded);
+        break;
+    }
+}
+
+} // namespace
+
+struct HuffmanDictionary::Tables {
+    std::array<std::array<std::uint8_t, 256>, kDictionarySlots> lengths{};
+    std::array<HuffmanTable, kDictionarySlots> encode;
+    std::array<std::vector<DecoderNode>, kDictionarySlots> decode;
+
+    void build() {
+        for (int slot = 0; slot < kDictionarySlots; ++slot) {
+            const auto index = static_cast<std::size_t>(slot);
+            encode[index] = buildCanonicalTable(lengths[index]);
+            buildDecoderNodes(encode[index], decode[index]);
+        }
+    }
+};
+
+HuffmanDictionary::HuffmanDictionary() : tables_(std::make_unique<Tables>()) {}
+HuffmanDictionary::~HuffmanDictionary() = default;
+HuffmanDictionary::HuffmanDictionary(HuffmanDictionary&&) noexcept = default;
+HuffmanDictionary& HuffmanDictionary::operator=(HuffmanDictionary&&) noexcept = default;
+
+/*
+ * Dictionary format:
+ * [magic "HFD" (3 bytes)]
+ * [ID (4 bytes): FNV-1a of the code lengths]
+ * [slot count (1 byte)]
+ * per slot (red, green, blue, grey, palette indices): [Huffman code lengths (256 bytes)]
+ *
+ * Every symbol has a code, so any residual plane can be coded with a slot.
+ */
+
+HuffmanDictionary HuffmanDictionary::train(const std::vector<std::string>& samplePaths) {
+    if (samplePaths.empty()) {
+        throw std::runtime_error("训练字典至少需要一张样本图像");
+    }
+
+    // residual histograms aggregated over the corpus, per slot
+    std::array<std::array<std::uint64_t, 256>, kDictionarySlots> histograms{};
+    std::array<std::vector<std::uint8_t>, 3> residuals;
+    std::array<ChannelStatistics, 3> statistics;
+    std::vector<std::uint32_t> palette;
+    std::vector<std::uint8_t> indices;
+    std::vector<std::uint8_t> scratch;
+    for (const auto& path : samplePaths) {
+        const cv::Mat image = ImageLoader::load(path).image;
+        const int channels = image.channels();
+        const bool usePalette = channels == 3 && buildPaletteIndices(image, palette, indices);
+        const cv::Mat source = usePalette ? cv::Mat(image.rows, image.cols, CV_8UC1, indices.data()) : image;
+        buildResidualPlanes(source, nullptr, residuals, statistics, scratch);
+        for (int plane = 0; plane < source.channels(); ++plane) {
+            auto& histogram = histograms[static_cast<std::size_t>(dictionarySlot(channels, usePalette, plane))];
+            const auto& counts = statistics[static_cast<std::size_t>(plane)].histogram;
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                histogram[symbol] += counts[symbol];
+            }
+        }
+    }
+
+    HuffmanDictionary dictionary;
+    for (int slot = 0; slot < kDictionarySlots; ++slot) {
+        const auto index = static_cast<std::size_t>(slot);
+        dictionary.tables_->lengths[index] = buildDictionaryLengths(histograms[index]);
+    }
+    dictionary.tables_->build();
+    dictionary.id_ = dictionaryId(dictionary.tables_->lengths);
+    return dictionary;
+}
+
+std::shared_ptr<const HuffmanDictionary> HuffmanDictionary::load(const std::string& path) {
+    // tables are parsed and their tries built once per path and process
+    static std::mutex mutex;
+    static std::map<std::string, std::shared_ptr<const HuffmanDictionary>> loaded;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto it = loaded.find(path); it != loaded.end()) {
+        return it->second;
+    }
+
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        throw std::runtime_error("无法打开字典文件: " + path);
+    }
+    char magicBuffer[kCompressedMagicSize];
+    ifs.read(magicBuffer, static_cast<std::streamsize>(kCompressedMagicSize));
+    if (!ifs || std::memcmp(magicBuffer, kDictionaryMagic, kCompressedMagicSize) != 0) {
+        throw std::runtime_error("字典文件魔术字不匹配: " + path);
+    }
+    HuffmanDictionary dictionary;
+    dictionary.id_ = readUint32(ifs);
+    if (readUint8(ifs) != kDictionarySlots) {
+        throw std::runtime_error("字典文件的表数量不受支持");
+    }
+    for (auto& lengths : dictionary.tables_->lengths) {
+        ifs.read(reinterpret_cast<char*>(lengths.data()), static_cast<std::streamsize>(lengths.size()));
+        if (!ifs) {
+            throw std::runtime_error("读取字典码长度失败");
+        }
+        // a complete prefix code over all 256 symbols
+        std::uint64_t kraft = 0;
+        for (std::uint8_t length : lengths) {
+            if (length == 0 || length > kMaxCodeLength) {
+                throw std::runtime_error("字典文件已损坏");
+            }
+            kraft += std::uint64_t{1} << (kMaxCodeLength - length);
+        }
+        if (kraft > (std::uint64_t{1} << kMaxCodeLength)) {
+            throw std::runtime_error("字典文件已损坏");
+        }
+    }
+    if (dictionary.id_ != dictionaryId(dictionary.tables_->lengths)) {
+        throw std::runtime_error("字典文件已损坏");
+    }
+    dictionary.tables_->build();
+
+    auto shared = std::make_shared<const HuffmanDictionary>(std::move(dictionary));
+    loaded.emplace(path, shared);
+    return shared;
+}
+
+void HuffmanDictionary::save(const std::string& path) const {
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs) {
+        throw std::runtime_error("无法写入字典文件: " + path);
+    }
+    ofs.write(kDictionaryMagic, static_cast<std::streamsize>(kCompressedMagicSize));
+    writeUint32(ofs, id_);
+    writeUint8(ofs, static_cast<std::uint8_t>(kDictionarySlots));
+    for (const auto& lengths : tables_->lengths) {
+        ofs.write(reinterpret_cast<const char*>(lengths.data()), static_cast<std::streamsize>(lengths.size()));
+    }
+    if (!ofs) {
+        throw std::runtime_error("写入字典文件失败: " + path);
+    }
+}
+
+struct CompressionContext::Buffers {
+    std::array<std::vector<std::uint8_t>, 3> residuals;
+    std::array<ChannelStatistics, 3> statistics;
+    std::array<std::vector<std::uint8_t>, 3> encoded;
+    std::array<HuffmanTable, 3> tables;
+    std::array<ChannelCoding, 3> coding{};
+    std::vector<std::uint32_t> palette;
+    std::vector<std::uint8_t> indices;
+    std::vector<std::uint8_t> scratch;
+};
+
+CompressionContext::CompressionContext() : buffers_(std::make_unique<Buffers>()) {}
+CompressionContext::~CompressionContext() = default;
+CompressionContext::CompressionContext(CompressionContext&&) noexcept = default;
+CompressionContext& CompressionContext::operator=(CompressionContext&&) noexcept = default;
+
+struct DecompressionContext::Buffers {
+    std::array<std::vector<DecoderNode>, 3> nodes;
+    std::array<cv::Vec3b, 256> palette{};
+    std::array<ChannelCoding, 3> coding{};
+    std::array<std::array<std::uint8_t, 256>, 3> lengths;
+    std::array<std::vector<std::uint8_t>, 3> payloads;
+    std::array<std::vector<std::uint8_t>, 3> rows;
+};
+
+DecompressionContext::DecompressionContext() : buffers_(std::make_unique<Buffers>()) {}
+DecompressionContext::~DecompressionContext() = default;
+DecompressionContext::DecompressionContext(DecompressionContext&&) noexcept = default;
+DecompressionContext& DecompressionContext::operator=(DecompressionContext&&) noexcept = default;
+
+ImageData ImageLoader::load(const std::string& path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        throw std::runtime_error("无法打开文件: " + path);
+    }
+
+    ImageData data = readHeader(ifs);
+    data.image = data.magic == "P6" ? readImage(ifs, data) : readAsciiImage(ifs, data);
+    return data;
+}
+
+void ImageLoader::save(const std::string& path, const cv::Mat& image, int maxValue, bool useBinaryColor) {
     std::ofstream ofs(path, std::ios::binary);
     if (!ofs) {
         throw std::runtime_error("无法写入文件: " + path);
     }
+    writeImage(ofs, image, maxValue, useBinaryColor);
+}
 
-    if (isColor) {
-        if (useBinaryColor) {
-            writeHeader(ofs, "P6", image.cols, image.rows, maxValue);
-            writeBinaryP6(image, ofs);
-        } else {
-            writeHeader(ofs, "P3", image.cols, image.rows, maxValue);
-            writeAscii(image, ofs, maxValue, true);
+ImageData ImageLoader::loadFromMemory(const std::vector<char>& bytes) {
+    MemoryBuffer buffer(bytes.data(), bytes.size());
+    std::istream is(&buffer);
+    ImageData data = readHeader(is);
+    if (data.magic == "P6") {
+        data.image = readImage(is, data);
+    } else {
+        // ASCII bodies are parsed in place, without the copy readAsciiImage makes
+        const std::streamoff start = is.tellg();
+        if (start < 0 || static_cast<std::size_t>(start) >= bytes.size()) {
+            throw std::runtime_error("意外到达文件末尾，PPM 数据不完整");
+        }
+        data.image = parseAsciiBody(bytes.data() + start, bytes.data() + bytes.size(), data);
+    }
+    return data;
+}
+
+std::vector<char> ImageLoader::saveToMemory(const cv::Mat& image, int maxValue, bool useBinaryColor) {
+    std::vector<char> bytes;
+    VectorSink sink(bytes);
+    std::ostream os(&sink);
+    writeImage(os, image, maxValue, useBinaryColor);
+    return bytes;
+}
+
+ImageReader::ImageReader(const std::string& path) : ifs_(path, std::ios::binary) {
+    if (!ifs_) {
+        throw std::runtime_error("无法打开文件: " + path);
+    }
+    header_ = readHeader(ifs_);
+}
+
+void ImageReader::readRow(cv::Mat& row) {
+    if (nextRow_ >= header_.height) {
+        throw std::runtime_error("图像行已全部读取");
+    }
+    const int channels = this->channels();
+    row.create(1, header_.width, channels == 1 ? CV_8UC1 : CV_8UC3);
+    const std::size_t samples = static_cast<std::size_t>(header_.width) * static_cast<std::size_t>(channels);
+    if (header_.magic == "P6") {
+        readBinaryRow(ifs_, row.ptr<std::uint8_t>(0), samples);
+    } else {
+        readAsciiRow(ifs_, header_.maxValue, row.ptr<std::uint8_t>(0), samples);
+    }
+    ++nextRow_;
+}
+
+void ImageReader::readRows(cv::Mat& band, int count) {
+    if (count <= 0 || count > header_.height - nextRow_) {
+        throw std::runtime_error("图像行已全部读取");
+    }
+    const int channels = this->channels();
+    band.create(count, header_.width, channels == 1 ? CV_8UC1 : CV_8UC3);
+    const std::size_t samples = static_cast<std::size_t>(header_.width) * static_cast<std::size_t>(channels);
+    if (header_.magic == "P6" && band.isContinuous()) {
+        // one read for the whole band
+        readBinaryRow(ifs_, band.ptr<std::uint8_t>(0), samples * static_cast<std::size_t>(count));
+    } else {
+        for (int row = 0; row < count; ++row) {
+            if (header_.magic == "P6") {
+                readBinaryRow(ifs_, band.ptr<std::uint8_t>(row), samples);
+            } else {
+                readAsciiRow(ifs_, header_.maxValue, band.ptr<std::uint8_t>(row), samples);
+            }
         }
+    }
+    nextRow_ += count;
+}
+
+ImageWriter::ImageWriter(const std::string& path, int width, int height, int channels, int maxValue, bool useBinaryColor)
+    : ofs_(path, std::ios::binary), path_(path), width_(width), height_(height), channels_(channels),
+      binary_(channels == 3 && useBinaryColor) {
+    if (!ofs_) {
+        throw std::runtime_error("无法写入文件: " + path);
+    }
+    writeHeader(ofs_, channels == 3 ? (binary_ ? "P6" : "P3") : "P2", width, height, maxValue);
+}
+
+void ImageWriter::writeRow(const cv::Mat& row) {
+    if (row.depth() != CV_8U || row.channels() != channels_ || row.cols != width_ || row.rows != 1) {
+        throw std::runtime_error("写入的图像行与输出尺寸不匹配");
+    }
+    if (rowsWritten_ >= height_) {
+        throw std::runtime_error("写入的图像行数超出输出高度");
+    }
+    const std::uint8_t* rowPtr = row.ptr<std::uint8_t>(0);
+    if (binary_) {
+        ofs_.write(reinterpret_cast<const char*>(rowPtr), static_cast<std::streamsize>(static_cast<std::size_t>(width_) * 3));
     } else {
-        writeHeader(ofs, "P2", image.cols, image.rows, maxValue);
-        writeAscii(image, ofs, maxValue, false);
+        writeAsciiRow(ofs_, rowPtr, width_, channels_ == 3);
+    }
+    ++rowsWritten_;
+}
+
+void ImageWriter::finish() {
+    ofs_.flush();
+    if (rowsWritten_ != height_ || !ofs_) {
+        throw std::runtime_error("无法写入文件: " + path_);
     }
 }
 
 /*
  * Compression format:
- * [magic "HFM" (3 bytes)]
+ * [magic "HF2" (3 bytes)]
+ * [flags (1 byte): bit 0 palette, bit 1 near-lossless, bit 2 wide sizes, bit 3 dictionary, bit 4 archive]
  * [width (4 bytes)]
  * [height (4 bytes)]
  * [maxValue (2 bytes)]
  * [channels (1 byte)]
- * [Huffman tables (256 bytes each channel)]
- * [dataBitCount (4 bytes)] [encoded data (variable)]
+ * near-lossless only: [NEAR (1 byte)]
+ * dictionary only: [dictionary ID (4 bytes)]
+ * palette only: [colour count - 1 (1 byte)] [RGB entries (3 bytes each)]
+ * per coded plane (channels planes, or one index plane for palette images):
+ *   [coding (1 byte): 0 stored, 1 run length, 2 Huffman, 3 dictionary Huffman]
+ *   [Huffman code lengths (256 bytes, Huffman only)]
+ *   [payload byte count (4 bytes, 8 with wide sizes)] [payload (variable)]
+ *
+ * Near-lossless residuals are signed multiples of 2 * NEAR + 1 (stored as
+ * int8), predicted from the reconstructed left sample; every decoded sample
+ * is within NEAR of the original.
+ *
+ * Wide sizes are set only for planes of more than 2^32 - 1 pixels, so
+ * smaller files are unchanged.
+ *
+ * Dictionary planes use the table of the matching slot of the HFD file with
+ * that ID; the decoder has to be given the same dictionary. The flag and ID
+ * are only written when at least one plane is dictionary coded.
+ *
+ * Archive files (lossless only, no palette or dictionary) replace the planes
+ * with [payload byte count (8 bytes)] [payload]: all channels coded together
+ * by ContextCoder. The archive level falls back to the planes whenever they
+ * come out smaller, or the payload exceeds pixels * channels + 64 bytes,
+ * which decompress rejects as corrupt.
+ *
+ * Legacy "HFM" files have no flags byte and no coding byte; every channel is
+ * Huffman coded. They are still accepted by decompress.
  */
 
-void ImageLoader::compress(const std::string& path, const cv::Mat& image, int maxValue) {
+CompressionSummary ImageLoader::compress(const std::string& path, const cv::Mat& image, int maxValue,
+                                         const CompressionOptions& options) {
+    CompressionContext context;
+    return compress(path, image, maxValue, context, options);
+}
+
+CompressionSummary ImageLoader::compress(const std::string& path, const cv::Mat& image, int maxValue, CompressionContext& context,
+                                         const CompressionOptions& options) {
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs) {
+        throw std::runtime_error("无法写入压缩文件: " + path);
+    }
+    return compressTo(ofs, image, maxValue, context, options);
+}
+
+CompressionSummary ImageLoader::compressToMemory(std::vector<char>& bytes, const cv::Mat& image, int maxValue,
+                                                 CompressionContext& context, const CompressionOptions& options) {
+    bytes.clear();
+    VectorSink sink(bytes);
+    std::ostream os(&sink);
+    return compressTo(os, image, maxValue, context, options);
+}
+
+CompressionSummary ImageLoader::compressTo(std::ostream& os, const cv::Mat& image, int maxValue, CompressionContext& context,
+                                           const CompressionOptions& options) {
     if (image.empty()) {
         throw std::runtime_error("无法压缩空图像");
     }
@@ -576,65 +1951,317 @@ void ImageLoader::compress(const std::string& path, const cv::Mat& image, int ma
     if (channels != 1 && channels != 3) {
         throw std::runtime_error("当前压缩仅支持单通道或三通道图像");
     }
+    const int near = options.nearLossless;
+    if (near < 0 || near > 255) {
+        throw std::runtime_error("NEAR 参数必须位于 0 到 255 之间");
+    }
+    const int maxSample = std::clamp(maxValue, 1, 255);
 
     const int width = image.cols;
     const int height = image.rows;
+    const std::size_t pixelCount = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+
+    if (options.level == CompressionLevel::Archive) {
+        if (near > 0) {
+            throw std::runtime_error("归档级别仅支持无损压缩");
+        }
+        // code both ways and keep the smaller file; palette and flat images often
+        // do better with the default planes
+        CompressionOptions planeOptions = options;
+        planeOptions.level = CompressionLevel::Default;
+        std::vector<char> planeFile;
+        VectorSink planeSink(planeFile);
+        std::ostream planeStream(&planeSink);
+        const CompressionSummary planeSummary = compressTo(planeStream, image, maxValue, context, planeOptions);
+
+        const std::vector<std::uint8_t> payload = ContextCoder::encode(image);
+        constexpr std::size_t kArchiveHeaderBytes = kCompressedMagicSize + 12 + 8;
+        if (payload.size() > maxArchivePayload(pixelCount, channels) ||
+            kArchiveHeaderBytes + payload.size() >= planeFile.size()) {
+            os.write(planeFile.data(), static_cast<std::streamsize>(planeFile.size()));
+            if (!os) {
+                throw std::runtime_error("写入压缩数据失败");
+            }
+            return planeSummary;
+        }
+        writeCompressedHeader(os, kFlagArchive, width, height, maxValue, channels, 0, nullptr);
+        writeUint64(os, payload.size());
+        os.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+        if (!os) {
+            throw std::runtime_error("写入压缩数据失败");
+        }
+        CompressionSummary summary;
+        summary.channels = channels;
+        summary.archive = true;
+        summary.payloadBytes[0] = payload.size();
+        return summary;
+    }
 
-    std::vector<HuffmanTable> tables(static_cast<std::size_t>(channels));
-    std::vector<std::vector<std::uint8_t>> encodedChannels(static_cast<std::size_t>(channels));
+    auto& buffers = *context.buffers_;
 
-    for (int ch = 0; ch < channels; ++ch) {
-        // Build residuals, histogram, code lengths, and Huffman table for each channel
-        const auto residuals = buildResidualChannel(image, ch);
-        const auto histogram = buildHistogram(residuals);
-        const auto lengths = buildCodeLengths(histogram);
-        tables[static_cast<std::size_t>(ch)] = buildCanonicalTable(lengths);
-        encodedChannels[static_cast<std::size_t>(ch)] = encode(residuals, tables[static_cast<std::size_t>(ch)]);
+    // Images with at most 256 colours are coded as a single plane of palette indices
+    // (indices must stay exact, so near-lossless coding never uses the palette)
+    const bool usePalette = channels == 3 && near == 0 && buildPaletteIndices(image, buffers.palette, buffers.indices);
+    const cv::Mat source = usePalette ? cv::Mat(height, width, CV_8UC1, buffers.indices.data()) : image;
+    const int planes = usePalette ? 1 : channels;
+
+    // Lossless residuals of all planes come from one vectorized pass over the
+    // image; near-lossless residuals depend on the previous decoded sample and
+    // are built per channel by its encoder.
+    if (near == 0) {
+        buildResidualPlanes(source, nullptr, buffers.residuals, buffers.statistics, buffers.scratch);
     }
 
-    std::ofstream ofs(path, std::ios::binary);
-    if (!ofs) {
-        throw std::runtime_error("无法写入压缩文件: " + path);
+    const HuffmanDictionary* dictionary = options.dictionary.get();
+    const auto encodeChannelAt = [&source, &buffers, dictionary, channels, usePalette, near, maxSample](int ch) {
+        const auto index = static_cast<std::size_t>(ch);
+        if (near > 0) {
+            buildQuantizedResidualChannel(source, ch, near, maxSample, buffers.residuals[index], buffers.statistics[index]);
+        }
+        const HuffmanTable* shared = nullptr;
+        if (dictionary != nullptr) {
+            shared = &dictionary->tables_->encode[static_cast<std::size_t>(dictionarySlot(channels, usePalette, ch))];
+        }
+        encodeResiduals(buffers.residuals[index], buffers.statistics[index], buffers.tables[index], buffers.coding[index],
+                        buffers.encoded[index], shared);
+    };
+
+    // Large colour images encode their channels concurrently while this
+    // thread acts as the writer, flushing each channel as soon as it is done.
+    const bool pipelined = planes > 1 && pixelCount >= kPipelinePixelThreshold;
+    ChannelWorkers workers;
+    if (pipelined) {
+        for (int ch = 0; ch < planes; ++ch) {
+            workers.spawn(ch, [&encodeChannelAt, ch]() { encodeChannelAt(ch); });
+        }
     }
 
-    ofs.write(kCompressedMagic, static_cast<std::streamsize>(kCompressedMagicSize));
-    writeUint32(ofs, static_cast<std::uint32_t>(width));
-    writeUint32(ofs, static_cast<std::uint32_t>(height));
-    writeUint16(ofs, static_cast<std::uint16_t>(maxValue));
-    writeUint8(ofs, static_cast<std::uint8_t>(channels));
+    std::array<bool, 3> finished{};
+    const auto finishChannel = [&](int ch) {
+        if (!finished[static_cast<std::size_t>(ch)]) {
+            if (pipelined) {
+                workers.wait(ch);
+            } else {
+                encodeChannelAt(ch);
+            }
+            finished[static_cast<std::size_t>(ch)] = true;
+        }
+    };
 
-    for (int ch = 0; ch < channels; ++ch) {
-        const auto& table = tables[static_cast<std::size_t>(ch)];
-        ofs.write(reinterpret_cast<const char*>(table.lengths.data()), static_cast<std::streamsize>(table.lengths.size()));
-        const auto& data = encodedChannels[static_cast<std::size_t>(ch)];
-        writeUint32(ofs, static_cast<std::uint32_t>(data.size()));
-        if (!data.empty()) {
-            ofs.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
-        }
-        if (!ofs) {
-            throw std::runtime_error("写入压缩数据失败");
+    // The dictionary flag and ID are only written when some plane picked the
+    // shared tables, so with a dictionary every plane is coded before the header.
+    bool usesDictionary = false;
+    if (dictionary != nullptr) {
+        for (int ch = 0; ch < planes; ++ch) {
+            finishChannel(ch);
+            usesDictionary = usesDictionary || buffers.coding[static_cast<std::size_t>(ch)] == ChannelCoding::Dictionary;
+        }
+    }
+
+    // a plane is only coded when it beats storing its residuals, so no payload
+    // exceeds pixelCount bytes and the size width can be chosen up front
+    const bool wideSizes = pixelCount > std::numeric_limits<std::uint32_t>::max();
+
+    std::uint8_t flags = 0;
+    flags |= usePalette ? kFlagPalette : 0;
+    flags |= near > 0 ? kFlagNearLossless : 0;
+    flags |= wideSizes ? kFlagWideSizes : 0;
+    flags |= usesDictionary ? kFlagDictionary : 0;
+    writeCompressedHeader(os, flags, width, height, maxValue, channels, near, usesDictionary ? dictionary : nullptr);
+
+    CompressionSummary summary;
+    summary.channels = planes;
+    summary.nearLossless = near;
+
+    if (usePalette) {
+        writePalette(os, buffers.palette);
+        summary.paletteSize = static_cast<int>(buffers.palette.size());
+    }
+
+    for (int ch = 0; ch < planes; ++ch) {
+        finishChannel(ch);
+        const auto index = static_cast<std::size_t>(ch);
+        summary.coding[index] = buffers.coding[index];
+        summary.payloadBytes[index] = writePlane(os, buffers.coding[index], buffers.tables[index], buffers.residuals[index],
+                                                 buffers.encoded[index], wideSizes);
+    }
+    return summary;
+}
+
+CompressionSummary ImageLoader::compress(const std::string& path, const SparseImage& image, int maxValue,
+                                         const CompressionOptions& options) {
+    // Produces the same file as compressing image.toDense(): palette detection, residuals,
+    // statistics and run-length payloads all come from the non-zero pixels alone.
+    if (options.nearLossless != 0) {
+        throw std::runtime_error("稀疏图像仅支持无损压缩");
+    }
+    if (options.level == CompressionLevel::Archive) {
+        // the context model needs every neighbour, so the archive level works on the dense image
+        return compress(path, image.toDense(), maxValue, options);
+    }
+    const int width = image.cols();
+    const int height = image.rows();
+    const int channels = image.channels();
+    const std::size_t pixelCount = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+    const auto& triples = image.triples();
+
+    // the palette holds the colours of the triples, plus black if any pixel is zero
+    std::vector<std::uint32_t> palette;
+    std::vector<std::uint8_t> indices;
+    bool usePalette = false;
+    if (channels == 3) {
+        const auto colourOf = [&triples](std::size_t i) {
+            const auto& value = triples[i].value;
+            return (static_cast<std::uint32_t>(value[0]) << 16) | (static_cast<std::uint32_t>(value[1]) << 8) | value[2];
+        };
+        ColourTable table;
+        usePalette = true;
+        if (triples.size() < pixelCount) {
+            table.insert(0);
+        }
+        for (std::size_t i = 0; i < triples.size() && usePalette; ++i) {
+            usePalette = table.insert(colourOf(i));
+        }
+        if (usePalette) {
+            table.assignIndices(palette);
+            indices.reserve(triples.size());
+            for (std::size_t i = 0; i < triples.size(); ++i) {
+                indices.push_back(table.indexOf(colourOf(i)));
+            }
+        }
+    }
+    const int planes = usePalette ? 1 : channels;
+    const bool wideSizes = pixelCount > std::numeric_limits<std::uint32_t>::max();
+    const HuffmanDictionary* dictionary = options.dictionary.get();
+
+    // every plane is coded before the header, which carries the dictionary
+    // flag and ID only when some plane picked the shared tables
+    CompressionSummary summary;
+    summary.channels = planes;
+    std::vector<SparseResidual> residuals;
+    std::array<HuffmanTable, 3> tables;
+    std::array<std::vector<std::uint8_t>, 3> stored;
+    std::array<std::vector<std::uint8_t>, 3> encoded;
+    bool usesDictionary = false;
+    for (int ch = 0; ch < planes; ++ch) {
+        if (usePalette) {
+            buildSparseResiduals(triples, width, [&indices](std::size_t i) { return indices[i]; }, residuals);
+        } else {
+            const auto index = static_cast<std::size_t>(ch);
+            buildSparseResiduals(triples, width, [&triples, index](std::size_t i) { return triples[i].value[index]; }, residuals);
         }
+        const HuffmanTable* shared = nullptr;
+        if (dictionary != nullptr) {
+            shared = &dictionary->tables_->encode[static_cast<std::size_t>(dictionarySlot(channels, usePalette, ch))];
+        }
+        const auto index = static_cast<std::size_t>(ch);
+        encodeSparseResiduals(residuals, pixelCount, tables[index], summary.coding[index], stored[index], encoded[index], shared);
+        usesDictionary = usesDictionary || summary.coding[index] == ChannelCoding::Dictionary;
+    }
+
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs) {
+        throw std::runtime_error("无法写入压缩文件: " + path);
     }
+    std::uint8_t flags = 0;
+    flags |= usePalette ? kFlagPalette : 0;
+    flags |= wideSizes ? kFlagWideSizes : 0;
+    flags |= usesDictionary ? kFlagDictionary : 0;
+    writeCompressedHeader(ofs, flags, width, height, maxValue, channels, 0, usesDictionary ? dictionary : nullptr);
+
+    if (usePalette) {
+        writePalette(ofs, palette);
+        summary.paletteSize = static_cast<int>(palette.size());
+    }
+    for (int ch = 0; ch < planes; ++ch) {
+        const auto index = static_cast<std::size_t>(ch);
+        summary.payloadBytes[index] = writePlane(ofs, summary.coding[index], tables[index], stored[index], encoded[index], wideSizes);
+    }
+    return summary;
+}
+
+ImageData ImageLoader::decompress(const std::string& path, const HuffmanDictionary* dictionary) {
+    DecompressionContext context;
+    return decompress(path, context, dictionary);
 }
 
-ImageData ImageLoader::decompress(const std::string& path) {
+ImageData ImageLoader::decompress(const std::string& path, DecompressionContext& context, const HuffmanDictionary* dictionary) {
     std::ifstream ifs(path, std::ios::binary);
     if (!ifs) {
         throw std::runtime_error("无法打开压缩文件: " + path);
     }
+    return decompressFrom(ifs, context, dictionary);
+}
+
+ImageData ImageLoader::decompressFromMemory(const std::vector<char>& bytes, DecompressionContext& context,
+                                            const HuffmanDictionary* dictionary) {
+    return decompressFromMemory(bytes.data(), bytes.size(), context, dictionary);
+}
+
+ImageData ImageLoader::decompressFromMemory(const char* data, std::size_t size, DecompressionContext& context,
+                                            const HuffmanDictionary* dictionary) {
+    // plane payloads are decoded straight from data (see readPayload)
+    MemoryBuffer buffer(data, size);
+    std::istream is(&buffer);
+    return decompressFrom(is, context, dictionary);
+}
+
+ImageData ImageLoader::compressedHeader(const char* data, std::size_t size) {
+    // the fixed part of an HF2 / HFM header: magic, [flags,] width, height, maxValue, channels
+    const bool legacy = size >= kCompressedMagicSize && std::memcmp(data, kLegacyMagic, kCompressedMagicSize) == 0;
+    if (!legacy && (size < kCompressedMagicSize || std::memcmp(data, kCompressedMagic, kCompressedMagicSize) != 0)) {
+        throw std::runtime_error("压缩文件魔术字不匹配或文件损坏");
+    }
+    MemoryBuffer buffer(data + kCompressedMagicSize, size - kCompressedMagicSize);
+    std::istream is(&buffer);
+    if (!legacy) {
+        readUint8(is);
+    }
+    const std::uint32_t width = readUint32(is);
+    const std::uint32_t height = readUint32(is);
+    const std::uint16_t maxValue = readUint16(is);
+    const std::uint8_t channels = readUint8(is);
+    if (width == 0 || height == 0 || width > static_cast<std::uint32_t>(std::numeric_limits<int>::max()) ||
+        height > static_cast<std::uint32_t>(std::numeric_limits<int>::max())) {
+        throw std::runtime_error("压缩文件的图像尺寸非法");
+    }
+    if (channels != 1 && channels != 3) {
+        throw std::runtime_error("压缩文件包含不受支持的通道数");
+    }
+    ImageData header;
+    header.magic = channels == 3 ? "P6" : "P2";
+    header.width = static_cast<int>(width);
+    header.height = static_cast<int>(height);
+    header.maxValue = maxValue;
+    return header;
+}
+
+ImageData ImageLoader::decompressFrom(std::istream& is, DecompressionContext& context, const HuffmanDictionary* dictionary) {
 
     char magicBuffer[kCompressedMagicSize];
-    ifs.read(magicBuffer, static_cast<std::streamsize>(kCompressedMagicSize));
-    if (!ifs || std::memcmp(magicBuffer, kCompressedMagic, kCompressedMagicSize) != 0) {
+    is.read(magicBuffer, static_cast<std::streamsize>(kCompressedMagicSize));
+    if (!is) {
         throw std::runtime_error("压缩文件魔术字不匹配或文件损坏");
     }
+    const bool legacy = std::memcmp(magicBuffer, kLegacyMagic, kCompressedMagicSize) == 0;
+    std::uint8_t flags = 0;
+    if (!legacy) {
+        if (std::memcmp(magicBuffer, kCompressedMagic, kCompressedMagicSize) != 0) {
+            throw std::runtime_error("压缩文件魔术字不匹配或文件损坏");
+        }
+        flags = readUint8(is);
+        if ((flags & ~kSupportedFlags) != 0) {
+            throw std::runtime_error("压缩文件使用了不受支持的格式特性");
+        }
+    }
 
-    const std::uint32_t width = readUint32(ifs);
-    const std::uint32_t height = readUint32(ifs);
-    const std::uint16_t maxValue = readUint16(ifs);
-    const std::uint8_t channels = readUint8(ifs);
+    const std::uint32_t width = readUint32(is);
+    const std::uint32_t height = readUint32(is);
+    const std::uint16_t maxValue = readUint16(is);
+    const std::uint8_t channels = readUint8(is);
 
-    if (width == 0 || height == 0) {
+    if (width == 0 || height == 0 || width > static_cast<std::uint32_t>(std::numeric_limits<int>::max()) ||
+        height > static_cast<std::uint32_t>(std::numeric_limits<int>::max())) {
         throw std::runtime_error("压缩文件的图像尺寸非法");
     }
     if (channels != 1 && channels != 3) {
@@ -643,48 +2270,131 @@ ImageData ImageLoader::decompress(const std::string& path) {
 
     const std::size_t pixelCount = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
 
-    std::vector<HuffmanTable> tables(static_cast<std::size_t>(channels));
-    std::vector<std::vector<std::uint8_t>> channelValues(static_cast<std::size_t>(channels));
+    auto& buffers = *context.buffers_;
 
-    for (int ch = 0; ch < channels; ++ch) {
-        std::array<std::uint8_t, 256> lengths{};
-        ifs.read(reinterpret_cast<char*>(lengths.data()), static_cast<std::streamsize>(lengths.size()));
-        if (!ifs) {
-            throw std::runtime_error("读取哈夫曼码长度失败");
+    if ((flags & kFlagArchive) != 0) {
+        if ((flags & (kFlagPalette | kFlagNearLossless | kFlagDictionary)) != 0) {
+            throw std::runtime_error("压缩文件使用了不受支持的格式特性");
+        }
+        const std::uint64_t byteCount = readUint64(is);
+        if (byteCount > maxArchivePayload(pixelCount, channels)) {
+            throw std::runtime_error("压缩数据正文长度非法");
+        }
+        const std::uint8_t* payload = readPayload(is, byteCount, buffers.payloads[0]);
+        ImageData data;
+        data.magic = (channels == 3) ? "P6" : "P2";
+        data.width = static_cast<int>(width);
+        data.height = static_cast<int>(height);
+        data.maxValue = maxValue;
+        data.image = ContextCoder::decode(payload, static_cast<std::size_t>(byteCount), data.width, data.height, channels);
+        return data;
+    }
+
+    const int near = (flags & kFlagNearLossless) != 0 ? readUint8(is) : 0;
+    const int maxSample = std::clamp(static_cast<int>(maxValue), 1, 255);
+
+    const bool usesDictionary = (flags & kFlagDictionary) != 0;
+    if (usesDictionary) {
+        const std::uint32_t id = readUint32(is);
+        if (dictionary == nullptr) {
+            throw std::runtime_error("压缩文件引用了共享字典 (ID " + std::to_string(id) + ")，请使用 --dict 指定字典文件");
         }
-        tables[static_cast<std::size_t>(ch)] = buildCanonicalTable(lengths);
+        if (dictionary->id() != id) {
+            throw std::runtime_error("共享字典 ID 不匹配: 文件需要 " + std::to_string(id) + "，提供的是 " +
+                                     std::to_string(dictionary->id()));
+        }
+    }
 
-        const std::uint32_t byteCount = readUint32(ifs);
-        std::vector<std::uint8_t> buffer(byteCount);
-        if (byteCount > 0) {
-            ifs.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(byteCount));
-            if (!ifs) {
-                throw std::runtime_error("读取压缩数据正文失败");
+    const bool usePalette = (flags & kFlagPalette) != 0;
+    int paletteSize = 0;
+    if (usePalette) {
+        if (channels != 3) {
+            throw std::runtime_error("调色板压缩文件的通道数非法");
+        }
+        if (near > 0) {
+            throw std::runtime_error("调色板压缩文件不支持近无损模式");
+        }
+        paletteSize = readUint8(is) + 1;
+        for (int i = 0; i < paletteSize; ++i) {
+            auto& entry = buffers.palette[static_cast<std::size_t>(i)];
+            for (int ch = 0; ch < 3; ++ch) {
+                entry[ch] = readUint8(is);
             }
         }
-        auto residual = decode(buffer, tables[static_cast<std::size_t>(ch)], pixelCount);
-        auto reconstructed = reconstruct(residual, static_cast<int>(width), static_cast<int>(height));
-        channelValues[static_cast<std::size_t>(ch)] = std::move(reconstructed);
+    }
+    const int planes = usePalette ? 1 : channels;
+
+    const bool wideSizes = (flags & kFlagWideSizes) != 0;
+    // Large files are not read up front: only the plane headers are, and the
+    // payloads load on a background thread while the first rows decode.
+    const bool readAhead = pixelCount >= kPipelinePixelThreshold && dynamic_cast<MemoryBuffer*>(is.rdbuf()) == nullptr &&
+                           is.tellg() != std::streampos(-1);
+    std::array<PlanePayload, 3> payloads;
+    std::array<PayloadReadAhead::Plane, 3> deferred;
+    for (int ch = 0; ch < planes; ++ch) {
+        const auto index = static_cast<std::size_t>(ch);
+        payloads[index] = readPlane(is, legacy, wideSizes, pixelCount, buffers.coding[index], buffers.lengths[index],
+                                    buffers.payloads[index], readAhead ? &deferred[index].offset : nullptr);
+        deferred[index].data = buffers.payloads[index].data();
+        deferred[index].size = payloads[index].size;
+    }
+    std::optional<PayloadReadAhead> reader;
+    if (readAhead) {
+        reader.emplace(is, deferred, planes);
+    }
+
+    // The planes are decoded side by side, one row at a time, and each row is
+    // reconstructed straight into the output image; besides the compressed
+    // payloads only one row per plane is buffered.
+    std::array<std::optional<PlaneDecoder>, 3> decoders;
+    std::uint8_t* planeRows[3] = {};
+    for (int ch = 0; ch < planes; ++ch) {
+        const auto index = static_cast<std::size_t>(ch);
+        const std::vector<DecoderNode>* sharedNodes = nullptr;
+        if (usesDictionary) {
+            sharedNodes = &dictionary->tables_->decode[static_cast<std::size_t>(dictionarySlot(channels, usePalette, ch))];
+        }
+        decoders[index].emplace(buffers.coding[index], payloads[index].data, payloads[index].size, buffers.lengths[index],
+                                buffers.nodes[index], pixelCount, sharedNodes);
+        if (reader) {
+            decoders[index]->streamFrom(*reader, ch);
+        }
+        buffers.rows[index].resize(width);
+        planeRows[ch] = buffers.rows[index].data();
     }
 
     cv::Mat image(static_cast<int>(height), static_cast<int>(width), channels == 3 ? CV_8UC3 : CV_8UC1);
+    const auto reconstructQuantized = channels == 3 ? &reconstructQuantizedRow<3> : &reconstructQuantizedRow<1>;
     for (std::uint32_t row = 0; row < height; ++row) {
-        if (channels == 1) {
-            auto* rowPtr = image.ptr<std::uint8_t>(static_cast<int>(row));
-            for (std::uint32_t col = 0; col < width; ++col) {
-                const std::size_t index = static_cast<std::size_t>(row) * static_cast<std::size_t>(width) + col;
-                rowPtr[col] = channelValues[0][index];
+        for (int ch = 0; ch < planes; ++ch) {
+            decoders[static_cast<std::size_t>(ch)]->readRow(planeRows[ch], width);
+        }
+        auto* rowPtr = image.ptr<std::uint8_t>(static_cast<int>(row));
+        if (near > 0) {
+            for (int ch = 0; ch < channels; ++ch) {
+                reconstructQuantized(planeRows[ch], static_cast<int>(width), near, maxSample, rowPtr + ch);
             }
-        } else {
-            auto* rowPtr = image.ptr<cv::Vec3b>(static_cast<int>(row));
+        } else if (usePalette) {
+            // indices are prefix-summed in place, then expanded through the colour table
+            std::uint8_t* indices = planeRows[0];
+            PixelKernels::reconstructInterleaved(planeRows, static_cast<int>(width), 1, indices);
+            auto* pixels = reinterpret_cast<cv::Vec3b*>(rowPtr);
             for (std::uint32_t col = 0; col < width; ++col) {
-                const std::size_t index = static_cast<std::size_t>(row) * static_cast<std::size_t>(width) + col;
-                rowPtr[col][0] = channelValues[0][index];
-                rowPtr[col][1] = channelValues[1][index];
-                rowPtr[col][2] = channelValues[2][index];
+                if (indices[col] >= paletteSize) {
+                    throw std::runtime_error("调色板索引超出范围");
+                }
+                pixels[col] = buffers.palette[indices[col]];
             }
+        } else {
+            PixelKernels::reconstructInterleaved(planeRows, static_cast<int>(width), channels, rowPtr);
         }
     }
+    for (int ch = 0; ch < planes; ++ch) {
+        decoders[static_cast<std::size_t>(ch)]->finish();
+    }
+    if (reader) {
+        reader->finish();
+    }
 
     ImageData data;
     data.magic = (channels == 3) ? "P6" : "P2";
@@ -696,57 +2406,341 @@ ImageData ImageLoader::decompress(const std::string& path) {
     return data;
 }
 
-std::vector<ImageLoader::PixelTriple> ImageLoader::toTriples(const cv::Mat& image) {
+/*
+ * Sequence format:
+ * [magic "HFS" (3 bytes)]
+ * [width (4 bytes)] [height (4 bytes)] [maxValue (2 bytes)] [channels (1 byte)]
+ * [frame count (4 bytes)] [keyframe interval (4 bytes)]
+ * [frame offsets (8 bytes each, from the start of the file)]
+ * per frame:
+ *   [type (1 byte): 0 keyframe, 1 delta]
+ *   per channel: [coding (1 byte)] [Huffman code lengths (256 bytes, Huffman only)]
+ *                [payload byte count (8 bytes)] [payload (variable)]
+ *
+ * Keyframe residuals are the usual left differences. Delta frames code the
+ * left difference of (frame - previous frame), so a static scene costs a run
+ * of zeros. Frame i is a keyframe when i is a multiple of the interval; a
+ * frame range is decoded starting from the keyframe at or before it.
+ */
+
+std::vector<ImageData> ImageLoader::loadFrames(const std::string& path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        throw std::runtime_error("无法打开文件: " + path);
+    }
+
+    std::vector<ImageData> frames;
+    while (true) {
+        ImageData frame = readHeader(ifs);
+        if (!frames.empty() && (frame.width != frames.front().width || frame.height != frames.front().height ||
+                                (frame.magic == "P2") != (frames.front().magic == "P2"))) {
+            throw std::runtime_error("序列中各帧的尺寸或格式不一致");
+        }
+        frame.image = readImage(ifs, frame);
+        frames.push_back(std::move(frame));
+
+        ifs >> std::ws;
+        if (ifs.peek() == std::char_traits<char>::eof()) {
+            break;
+        }
+    }
+    return frames;
+}
+
+void ImageLoader::saveFrames(const std::string& path, const std::vector<ImageData>& frames) {
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs) {
+        throw std::runtime_error("无法写入文件: " + path);
+    }
+    for (const ImageData& frame : frames) {
+        writeImage(ofs, frame.image, frame.maxValue, frame.image.channels() == 3);
+    }
+    if (!ofs) {
+        throw std::runtime_error("无法写入文件: " + path);
+    }
+}
+
+bool ImageLoader::isSequence(const std::string& path) {
+    std::ifstream ifs(path, std::ios::binary);
+    char magicBuffer[kCompressedMagicSize];
+    ifs.read(magicBuffer, static_cast<std::streamsize>(kCompressedMagicSize));
+    return ifs && std::memcmp(magicBuffer, kSequenceMagic, kCompressedMagicSize) == 0;
+}
+
+SequenceSummary ImageLoader::compressSequence(const std::string& path, const std::vector<ImageData>& frames,
+                                              const SequenceOptions& options) {
+    if (frames.empty()) {
+        throw std::runtime_error("序列中没有可压缩的帧");
+    }
+    if (options.keyframeInterval <= 0) {
+        throw std::runtime_error("关键帧间隔必须大于 0");
+    }
+    const cv::Mat& first = frames.front().image;
+    if (first.depth() != CV_8U || (first.channels() != 1 && first.channels() != 3)) {
+        throw std::runtime_error("当前压缩仅支持单通道或三通道 8 位图像");
+    }
+    for (const ImageData& frame : frames) {
+        if (frame.image.size() != first.size() || frame.image.type() != first.type()) {
+            throw std::runtime_error("序列中各帧的尺寸或格式不一致");
+        }
+    }
+
+    const int channels = first.channels();
+    const std::size_t pixelCount = first.total();
+    const auto frameCount = static_cast<std::uint32_t>(frames.size());
+
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs) {
+        throw std::runtime_error("无法写入压缩文件: " + path);
+    }
+    ofs.write(kSequenceMagic, static_cast<std::streamsize>(kCompressedMagicSize));
+    writeUint32(ofs, static_cast<std::uint32_t>(first.cols));
+    writeUint32(ofs, static_cast<std::uint32_t>(first.rows));
+    writeUint16(ofs, static_cast<std::uint16_t>(frames.front().maxValue));
+    writeUint8(ofs, static_cast<std::uint8_t>(channels));
+    writeUint32(ofs, frameCount);
+    writeUint32(ofs, static_cast<std::uint32_t>(options.keyframeInterval));
+
+    // the offset table is filled in once every frame has been written
+    const std::streamoff tableOffset = ofs.tellp();
+    std::vector<std::uint64_t> offsets(frames.size());
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        writeUint64(ofs, 0);
+    }
+
+    CompressionContext context;
+    auto& buffers = *context.buffers_;
+    SequenceSummary summary;
+    summary.frames = static_cast<int>(frameCount);
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        const bool key = i % static_cast<std::size_t>(options.keyframeInterval) == 0;
+        offsets[i] = static_cast<std::uint64_t>(ofs.tellp());
+        writeUint8(ofs, key ? kFrameKey : kFrameDelta);
+        buildResidualPlanes(frames[i].image, key ? nullptr : &frames[i - 1].image, buffers.residuals, buffers.statistics,
+                            buffers.scratch);
+        for (int ch = 0; ch < channels; ++ch) {
+            const auto index = static_cast<std::size_t>(ch);
+            encodeResiduals(buffers.residuals[index], buffers.statistics[index], buffers.tables[index], buffers.coding[index],
+                            buffers.encoded[index]);
+            writePlane(ofs, buffers.coding[index], buffers.tables[index], buffers.residuals[index], buffers.encoded[index], true);
+        }
+        summary.keyframes += key ? 1 : 0;
+    }
+    summary.compressedBytes = static_cast<std::uint64_t>(ofs.tellp());
+    summary.rawBytes = static_cast<std::uint64_t>(pixelCount) * static_cast<std::uint64_t>(channels) * frames.size();
+
+    ofs.seekp(tableOffset);
+    for (std::uint64_t offset : offsets) {
+        writeUint64(ofs, offset);
+    }
+    if (!ofs) {
+        throw std::runtime_error("写入压缩数据失败");
+    }
+    return summary;
+}
+
+std::vector<ImageData> ImageLoader::decompressSequence(const std::string& path, int firstFrame, int lastFrame) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        throw std::runtime_error("无法打开压缩文件: " + path);
+    }
+    char magicBuffer[kCompressedMagicSize];
+    ifs.read(magicBuffer, static_cast<std::streamsize>(kCompressedMagicSize));
+    if (!ifs || std::memcmp(magicBuffer, kSequenceMagic, kCompressedMagicSize) != 0) {
+        throw std::runtime_error("压缩文件魔术字不匹配或文件损坏");
+    }
+
+    const std::uint32_t width = readUint32(ifs);
+    const std::uint32_t height = readUint32(ifs);
+    const std::uint16_t maxValue = readUint16(ifs);
+    const std::uint8_t channels = readUint8(ifs);
+    const std::uint32_t frameCount = readUint32(ifs);
+    const std::uint32_t keyframeInterval = readUint32(ifs);
+    if (width == 0 || height == 0 || width > static_cast<std::uint32_t>(std::numeric_limits<int>::max()) ||
+        height > static_cast<std::uint32_t>(std::numeric_limits<int>::max())) {
+        throw std::runtime_error("压缩文件的图像尺寸非法");
+    }
+    if (channels != 1 && channels != 3) {
+        throw std::runtime_error("压缩文件包含不受支持的通道数");
+    }
+    if (frameCount == 0 || keyframeInterval == 0) {
+        throw std::runtime_error("序列文件的帧信息非法");
+    }
+
+    if (lastFrame < 0) {
+        lastFrame = static_cast<int>(frameCount) - 1;
+    }
+    if (firstFrame < 0 || firstFrame > lastFrame || static_cast<std::uint32_t>(lastFrame) >= frameCount) {
+        throw std::runtime_error("帧范围超出序列长度 (共 " + std::to_string(frameCount) + " 帧)");
+    }
+
+    std::vector<std::uint64_t> offsets(frameCount);
+    for (std::uint64_t& offset : offsets) {
+        offset = readUint64(ifs);
+    }
+
+    const std::size_t pixelCount = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+    const int start = firstFrame - firstFrame % static_cast<int>(keyframeInterval);
+
+    DecompressionContext context;
+    auto& buffers = *context.buffers_;
+    std::uint8_t* planeRows[3] = {};
+    for (int ch = 0; ch < channels; ++ch) {
+        buffers.rows[static_cast<std::size_t>(ch)].resize(width);
+        planeRows[ch] = buffers.rows[static_cast<std::size_t>(ch)].data();
+    }
+    const std::size_t samples = static_cast<std::size_t>(width) * channels;
+
+    std::vector<ImageData> frames;
+    frames.reserve(static_cast<std::size_t>(lastFrame - firstFrame + 1));
+    cv::Mat previous;
+    for (int frame = start; frame <= lastFrame; ++frame) {
+        ifs.seekg(static_cast<std::streamoff>(offsets[static_cast<std::size_t>(frame)]));
+        const std::uint8_t type = readUint8(ifs);
+        if (type != kFrameKey && type != kFrameDelta) {
+            throw std::runtime_error("序列文件包含未知的帧类型");
+        }
+        if (type == kFrameDelta && previous.empty()) {
+            throw std::runtime_error("序列文件缺少关键帧");
+        }
+
+        std::array<std::optional<PlaneDecoder>, 3> decoders;
+        for (int ch = 0; ch < channels; ++ch) {
+            const auto index = static_cast<std::size_t>(ch);
+            const PlanePayload payload =
+                readPlane(ifs, false, true, pixelCount, buffers.coding[index], buffers.lengths[index], buffers.payloads[index]);
+            decoders[index].emplace(buffers.coding[index], payload.data, payload.size, buffers.lengths[index], buffers.nodes[index],
+                                    pixelCount);
+        }
+
+        cv::Mat image(static_cast<int>(height), static_cast<int>(width), channels == 3 ? CV_8UC3 : CV_8UC1);
+        for (std::uint32_t row = 0; row < height; ++row) {
+            for (int ch = 0; ch < channels; ++ch) {
+                decoders[static_cast<std::size_t>(ch)]->readRow(planeRows[ch], width);
+            }
+            auto* rowPtr = image.ptr<std::uint8_t>(static_cast<int>(row));
+            PixelKernels::reconstructInterleaved(planeRows, static_cast<int>(width), channels, rowPtr);
+            if (type == kFrameDelta) {
+                const auto* reference = previous.ptr<std::uint8_t>(static_cast<int>(row));
+                for (std::size_t i = 0; i < samples; ++i) {
+                    rowPtr[i] = static_cast<std::uint8_t>(rowPtr[i] + reference[i]);
+                }
+            }
+        }
+        for (int ch = 0; ch < channels; ++ch) {
+            decoders[static_cast<std::size_t>(ch)]->finish();
+        }
+
+        previous = image;
+        if (frame >= firstFrame) {
+            ImageData data;
+            data.magic = (channels == 3) ? "P6" : "P2";
+            data.width = static_cast<int>(width);
+            data.height = static_cast<int>(height);
+            data.maxValue = maxValue;
+            data.image = std::move(image);
+            frames.push_back(std::move(data));
+        }
+    }
+    return frames;
+}
+
+namespace {
+
+std::size_t tripleBands(const cv::Mat& image) {
+    // bands of rows that toTriples converts on separate threads
     if (image.empty()) {
         throw std::runtime_error("无法从空图像构造三元组");
     }
     if (image.depth() != CV_8U) {
         throw std::runtime_error("仅支持 8 位图像转换为三元组");
     }
+    if (image.channels() != 1 && image.channels() != 3) {
+        throw std::runtime_error("仅支持单通道或三通道图像转换为三元组");
+    }
+    if (static_cast<std::size_t>(image.total()) < kParallelTriplePixels) {
+        return 1;
+    }
+    return std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), static_cast<std::size_t>(image.rows));
+}
+
+} // namespace
+
+std::vector<ImageLoader::PixelTriple> ImageLoader::toTriples(const cv::Mat& image) {
+    const std::size_t bandCount = tripleBands(image);
+    if (bandCount == 1) {
+        // counting first would only scan the image twice
+        return *toTriples(image, std::numeric_limits<std::size_t>::max());
+    }
 
+    // Two passes over bands of rows: count the triples of every band, prefix-sum the
+    // counts, then let each band fill its own part of exactly sized storage.
     const int channels = image.channels();
-    if (channels != 1 && channels != 3) {
-        throw std::runtime_error("仅支持单通道或三通道图像转换为三元组");
+    const auto bandRow = [&](std::size_t band) {
+        return static_cast<int>(static_cast<std::size_t>(image.rows) * band / bandCount);
+    };
+    const auto fillRow = channels == 1 ? &fillRowTriples<1> : &fillRowTriples<3>;
+
+    std::vector<std::size_t> bandStarts(bandCount + 1, 0);
+    runOnThreads(bandCount, [&](std::size_t band) {
+        std::size_t count = 0;
+        for (int row = bandRow(band); row < bandRow(band + 1); ++row) {
+            count += PixelKernels::countNonZeroPixels(image.ptr<std::uint8_t>(row), image.cols, channels);
+        }
+        bandStarts[band + 1] = count;
+    });
+    for (std::size_t band = 0; band < bandCount; ++band) {
+        bandStarts[band + 1] += bandStarts[band];
     }
 
-    std::vector<PixelTriple> triples;
-    triples.reserve(static_cast<std::size_t>(image.total()) / 8 + 1);
+    std::vector<PixelTriple> triples(bandStarts[bandCount]);
+    runOnThreads(bandCount, [&](std::size_t band) {
+        PixelTriple* out = triples.data() + bandStarts[band];
+        for (int row = bandRow(band); row < bandRow(band + 1); ++row) {
+            out = fillRow(image.ptr<std::uint8_t>(row), row, image.cols, out);
+        }
+    });
+    return triples;
+}
 
-    for (int row = 0; row < image.rows; ++row) {
-        if (channels == 1) {
-            const auto* rowPtr = image.ptr<std::uint8_t>(row);
-            for (int col = 0; col < image.cols; ++col) {
-                const std::uint8_t value = rowPtr[col];
-                if (value == 0) {
-                    continue;
-                }
-                PixelTriple triple;
-                triple.row = row;
-                triple.col = col;
-                triple.channels = 1;
-                triple.value[0] = value;
-                triples.push_back(triple);
+std::optional<std::vector<ImageLoader::PixelTriple>> ImageLoader::toTriples(const cv::Mat& image, std::size_t maxTriples) {
+    // One pass over bands of rows: each band gathers its triples a row at a time and
+    // stops once the bands together have found more than maxTriples. The bands are
+    // joined afterwards, which costs little when few pixels are non-zero.
+    const std::size_t bandCount = tripleBands(image);
+    const auto bandRow = [&](std::size_t band) {
+        return static_cast<int>(static_cast<std::size_t>(image.rows) * band / bandCount);
+    };
+    const auto fillRow = image.channels() == 1 ? &fillRowTriples<1> : &fillRowTriples<3>;
+
+    std::vector<std::vector<PixelTriple>> bands(bandCount);
+    std::atomic<std::size_t> found{0};
+    runOnThreads(bandCount, [&](std::size_t band) {
+        std::vector<PixelTriple> row(static_cast<std::size_t>(image.cols));
+        auto& triples = bands[band];
+        for (int y = bandRow(band); y < bandRow(band + 1); ++y) {
+            if (found.load(std::memory_order_relaxed) > maxTriples) {
+                return;
             }
-        } else {
-            const auto* rowPtr = image.ptr<cv::Vec3b>(row);
-            for (int col = 0; col < image.cols; ++col) {
-                const cv::Vec3b pixel = rowPtr[col];
-                if (pixel[0] == 0 && pixel[1] == 0 && pixel[2] == 0) {
-                    continue;
-                }
-                PixelTriple triple;
-                triple.row = row;
-                triple.col = col;
-                triple.channels = 3;
-                triple.value[0] = pixel[0];
-                triple.value[1] = pixel[1];
-                triple.value[2] = pixel[2];
-                triples.push_back(triple);
+            PixelTriple* end = fillRow(image.ptr<std::uint8_t>(y), y, image.cols, row.data());
+            const auto count = static_cast<std::size_t>(end - row.data());
+            if (found.fetch_add(count, std::memory_order_relaxed) + count > maxTriples) {
+                return;
             }
+            triples.insert(triples.end(), row.data(), end);
         }
+    });
+    if (found.load() > maxTriples) {
+        return std::nullopt;
+    }
+    if (bandCount == 1) {
+        return std::move(bands.front());
+    }
+    std::vector<PixelTriple> triples;
+    triples.reserve(found.load());
+    for (const auto& band : bands) {
+        triples.insert(triples.end(), band.begin(), band.end());
     }
-
-    triples.shrink_to_fit();
     return triples;
 }
 
@@ -760,15 +2754,26 @@ void ImageLoader::saveTriples(const std::string& path, const cv::Mat& image, int
 
     ofs << "# rows cols maxValue channels triples_count\n";
     ofs << image.rows << ' ' << image.cols << ' ' << maxValue << ' ' << image.channels() << ' ' << triples.size() << '\n';
-    for (const auto& triple : triples) {
-        ofs << triple.row << ' ' << triple.col << ' ';
-        if (triple.channels == 1) {
-            ofs << static_cast<int>(triple.value[0]);
-        } else {
-            ofs << static_cast<int>(triple.value[0]) << ' '
-                << static_cast<int>(triple.value[1]) << ' '
-                << static_cast<int>(triple.value[2]);
+
+    // Each thread formats one chunk of triples into its own buffer; the buffers are
+    // written in order, so only a few chunks of text are held at a time.
+    std::size_t threadCount = 1;
+    if (triples.size() >= 2 * kTriplesPerTextChunk) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<std::vector<char>> buffers(threadCount);
+    for (std::size_t first = 0; first < triples.size(); first += threadCount * kTriplesPerTextChunk) {
+        const std::size_t chunks = std::min(threadCount, (triples.size() - first + kTriplesPerTextChunk - 1) / kTriplesPerTextChunk);
+        runOnThreads(chunks, [&](std::size_t i) {
+            const std::size_t begin = first + i * kTriplesPerTextChunk;
+            const std::size_t end = std::min(triples.size(), begin + kTriplesPerTextChunk);
+            formatTriples(triples.data() + begin, triples.data() + end, buffers[i]);
+        });
+        for (std::size_t i = 0; i < chunks; ++i) {
+            ofs.write(buffers[i].data(), static_cast<std::streamsize>(buffers[i].size()));
         }
-        ofs << '\n';
+    }
+    if (!ofs) {
+        throw std::runtime_error("写入三元组文件失败: " + path);
     }
 }
\ No newline at end of file
@@ -1,9 +1,26 @@
 #include "ImageOps.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <numeric>
 #include <stdexcept>
+#include <utility>
+
+#include "Resampler.hpp"
 
 namespace ImageOps {
 
+int scaledLength(int length, double scale) {
+    // rounded like cv::resize, half to even
+    const double scaled = std::nearbyint(length * scale);
+    if (scaled < 1.0 || scaled > std::numeric_limits<int>::max()) {
+        throw std::runtime_error("缩放后的图像尺寸非法");
+    }
+    return static_cast<int>(scaled);
+}
+
 cv::Mat toGrayscale(const cv::Mat& image) {
     if (image.channels() == 1) {
         return image.clone();
@@ -29,8 +46,492 @@ cv::Mat scaleByPercentage(const cv::Mat& image, double scale, int interpolation)
     }
 
     cv::Mat result;
+    // Only where a plan measured faster: bilinear halving stays with cv::resize, which
+    // switches to area averaging for it, and so does single-channel nearest, whose
+    // vectorized copy beats the plan's per-pixel one.
+    const bool linear = interpolation == cv::INTER_LINEAR && scale != 0.5 &&
+                        (image.channels() == 1 || image.channels() == 3);
+    const bool nearest = interpolation == cv::INTER_NEAREST && image.channels() == 3;
+    if (image.depth() == CV_8U && (linear || nearest)) {
+        // batches resize many images of the same size by the same factor; the plan is built once
+        ResamplePlanCache::shared().plan(image.size(), scale, interpolation, image.channels())->execute(image, result);
+        return result;
+    }
     cv::resize(image, result, cv::Size(), scale, scale, interpolation);
     return result;
 }
 
+namespace {
+
+class GrayscaleRows : public RowSource {
+public:
+    explicit GrayscaleRows(std::unique_ptr<RowSource> source) : source_(std::move(source)) {}
+
+    int rows() const override { return source_->rows(); }
+    int cols() const override { return source_->cols(); }
+    int channels() const override { return 1; }
+
+    void nextRow(cv::Mat& row) override {
+        source_->nextRow(input_);
+        row = toGrayscale(input_);
+    }
+
+private:
+    std::unique_ptr<RowSource> source_;
+    cv::Mat input_;
+};
+
+class ScaledRows : public RowSource {
+public:
+    // the bilinear ResamplePlan of the whole-image path, run a row at a time, so
+    // results are the same; only the horizontal passes of the two source rows
+    // around the current output row are kept
+    ScaledRows(std::unique_ptr<RowSource> source, double scale)
+        : source_(std::move(source)),
+          plan_(ResamplePlanCache::shared().plan(cv::Size(source_->cols(), source_->rows()), scale, cv::INTER_LINEAR,
+                                                 source_->channels())) {
+        for (auto& pass : passes_) {
+            pass.resize(plan_->rowSamples());
+        }
+    }
+
+    int rows() const override { return plan_->destinationSize().height; }
+    int cols() const override { return plan_->destinationSize().width; }
+    int channels() const override { return source_->channels(); }
+
+    void nextRow(cv::Mat& row) override {
+        const auto [upper, lower] = plan_->sourceRows(nextRow_);
+        advanceTo(lower);
+        const std::int16_t* top = pass(upper, lower);
+        const std::int16_t* bottom = pass(lower, upper);
+        row.create(1, cols(), channels() == 1 ? CV_8UC1 : CV_8UC3);
+        plan_->blendRow(nextRow_++, top, bottom, row.ptr<std::uint8_t>(0));
+    }
+
+private:
+    void advanceTo(int index) {
+        // source rows are consumed in order; rows between samples are skipped
+        while (lastRead_ < index) {
+            std::swap(previous_, current_);
+            source_->nextRow(current_);
+            ++lastRead_;
+        }
+    }
+
+    const std::int16_t* pass(int index, int keep) {
+        // horizontal pass of source row index (the last row read or the one before),
+        // evicting the pass that is not keep
+        for (int slot = 0; slot < 2; ++slot) {
+            if (held_[slot] == index) {
+                return passes_[slot].data();
+            }
+        }
+        const int slot = held_[0] == keep ? 1 : 0;
+        const cv::Mat& in = index == lastRead_ ? current_ : previous_;
+        plan_->resampleRow(in.ptr<std::uint8_t>(0), passes_[slot].data());
+        held_[slot] = index;
+        return passes_[slot].data();
+    }
+
+    std::unique_ptr<RowSource> source_;
+    std::shared_ptr<const ResamplePlan> plan_;
+    std::vector<std::int16_t> passes_[2];
+    int held_[2] = {-1, -1};
+    int nextRow_ = 0;
+    int lastRead_ = -1;
+    cv::Mat previous_;
+    cv::Mat current_;
+};
+
+class SparseRowCursor {
+public:
+    // pixel lookups along one row of a sparse image, for columns that never decrease
+    SparseRowCursor(const SparseImage& image, int row)
+        : triples_(image.triples()), next_(image.rowBegin(row)), end_(image.rowBegin(row + 1)) {}
+
+    const std::uint8_t* at(int col) {
+        while (next_ < end_ && triples_[next_].col < col) {
+            ++next_;
+        }
+        return next_ < end_ && triples_[next_].col == col ? triples_[next_].value.data() : kZeros;
+    }
+
+private:
+    static constexpr std::uint8_t kZeros[3] = {0, 0, 0};
+
+    const std::vector<SparseImage::Triple>& triples_;
+    std::size_t next_;
+    std::size_t end_;
+};
+
+SparseImage scaleSparseNearest(const SparseImage& image, double scale, int outRows, int outCols) {
+    // output pixel (y, x) copies source (floor(y / scale), floor(x / scale)) as cv::resize does;
+    // the output rows and columns copying one source index form a contiguous range
+    const double inverse = 1.0 / scale;
+    const auto outputRanges = [inverse](int size, int outSize) {
+        std::vector<std::pair<int, int>> ranges(static_cast<std::size_t>(size), {0, 0});
+        for (int out = 0; out < outSize; ++out) {
+            const int source = std::min(static_cast<int>(std::floor(out * inverse)), size - 1);
+            auto& range = ranges[static_cast<std::size_t>(source)];
+            if (range.first == range.second) {
+                range.first = out;
+            }
+            range.second = out + 1;
+        }
+        return ranges;
+    };
+    const auto rowRanges = outputRanges(image.rows(), outRows);
+    const auto colRanges = outputRanges(image.cols(), outCols);
+
+    const auto& triples = image.triples();
+    std::vector<SparseImage::Triple> result;
+    for (int row = 0; row < image.rows(); ++row) {
+        const std::size_t begin = image.rowBegin(row);
+        const std::size_t end = image.rowBegin(row + 1);
+        const auto& rows = rowRanges[static_cast<std::size_t>(row)];
+        for (int y = rows.first; y < rows.second; ++y) {
+            for (std::size_t i = begin; i < end; ++i) {
+                const auto& cols = colRanges[static_cast<std::size_t>(triples[i].col)];
+                for (int x = cols.first; x < cols.second; ++x) {
+                    SparseImage::Triple triple = triples[i];
+                    triple.row = y;
+                    triple.col = x;
+                    result.push_back(triple);
+                }
+            }
+        }
+    }
+    return SparseImage(outRows, outCols, image.channels(), std::move(result));
+}
+
+SparseImage scaleSparseLinear(const SparseImage& image, double scale, int outRows, int outCols) {
+    // The whole-image ResamplePlan evaluated at single samples, so results are the same.
+    // Only output pixels reading a non-zero source pixel can be non-zero. For each output row
+    // whose two source rows are not both empty, the candidate columns are the outputs that read
+    // a non-zero column of those rows.
+    const int channels = image.channels();
+    const auto plan =
+        ResamplePlanCache::shared().plan(cv::Size(image.cols(), image.rows()), scale, cv::INTER_LINEAR, channels);
+    std::vector<std::pair<int, int>> columns(static_cast<std::size_t>(outCols));
+    std::vector<std::pair<int, int>> readers(static_cast<std::size_t>(image.cols()), {outCols, 0});
+    for (int x = 0; x < outCols; ++x) {
+        const auto taps = plan->columnTaps(x);
+        columns[static_cast<std::size_t>(x)] = taps;
+        for (const int source : {taps.first, taps.second}) {
+            auto& range = readers[static_cast<std::size_t>(source)];
+            range.first = std::min(range.first, x);
+            range.second = std::max(range.second, x + 1);
+        }
+    }
+
+    const auto& triples = image.triples();
+    const auto readersOf = [&image, &triples, &readers](int row, std::vector<int>& out) {
+        // output columns reading a non-zero pixel of the row, ascending; the reader
+        // ranges only move right along the row, so no sort is needed
+        out.clear();
+        int next = 0;
+        for (std::size_t i = image.rowBegin(row); i < image.rowBegin(row + 1); ++i) {
+            const auto& range = readers[static_cast<std::size_t>(triples[i].col)];
+            for (int x = std::max(range.first, next); x < range.second; ++x) {
+                out.push_back(x);
+            }
+            next = std::max(next, range.second);
+        }
+    };
+
+    std::vector<int> top;
+    std::vector<int> bottom;
+    std::vector<int> candidates;
+    std::vector<SparseImage::Triple> result;
+    for (int y = 0; y < outRows; ++y) {
+        const auto [upper, lower] = plan->sourceRows(y);
+        if (image.rowEmpty(upper) && image.rowEmpty(lower)) {
+            continue;
+        }
+        readersOf(upper, top);
+        if (lower != upper) {
+            readersOf(lower, bottom);
+            candidates.clear();
+            std::set_union(top.begin(), top.end(), bottom.begin(), bottom.end(), std::back_inserter(candidates));
+        } else {
+            candidates.swap(top);
+        }
+
+        // candidates ascend, so each source pixel is found by a cursor moving right
+        SparseRowCursor topLeft(image, upper);
+        SparseRowCursor topRight(image, upper);
+        SparseRowCursor bottomLeft(image, lower);
+        SparseRowCursor bottomRight(image, lower);
+        for (const int x : candidates) {
+            const auto& taps = columns[static_cast<std::size_t>(x)];
+            const std::uint8_t* upperLeft = topLeft.at(taps.first);
+            const std::uint8_t* upperRight = topRight.at(taps.second);
+            const std::uint8_t* lowerLeft = bottomLeft.at(taps.first);
+            const std::uint8_t* lowerRight = bottomRight.at(taps.second);
+
+            SparseImage::Triple triple;
+            triple.row = y;
+            triple.col = x;
+            triple.channels = channels;
+            std::uint8_t any = 0;
+            for (int ch = 0; ch < channels; ++ch) {
+                const std::size_t i = static_cast<std::size_t>(x) * static_cast<std::size_t>(channels) +
+                                      static_cast<std::size_t>(ch);
+                const std::int16_t a = plan->resampleSample(i, upperLeft[ch], upperRight[ch]);
+                const std::int16_t b = plan->resampleSample(i, lowerLeft[ch], lowerRight[ch]);
+                const std::uint8_t value = plan->blendSample(y, i, a, b);
+                triple.value[static_cast<std::size_t>(ch)] = value;
+                any |= value;
+            }
+            if (any != 0) {
+                result.push_back(triple);
+            }
+        }
+    }
+    return SparseImage(outRows, outCols, channels, std::move(result));
+}
+
+struct AreaTap {
+    int source;
+    int output;
+    float weight;
+};
+
+std::vector<AreaTap> areaTaps(int size, int outSize, double inverse) {
+    // cv::resize's table for shrinking by a non-integer factor: output cell
+    // [out * inverse, (out + 1) * inverse) weighs each source pixel by the share
+    // of the cell it covers, computed the same way in double and stored as float
+    std::vector<AreaTap> taps;
+    for (int out = 0; out < outSize; ++out) {
+        const double begin = out * inverse;
+        const double end = begin + inverse;
+        const double cell = std::min(inverse, size - begin);
+        const int last = std::min(static_cast<int>(std::floor(end)), size - 1);
+        const int first = std::min(static_cast<int>(std::ceil(begin)), last);
+        if (first - begin > 1e-3) {
+            taps.push_back({first - 1, out, static_cast<float>((first - begin) / cell)});
+        }
+        for (int source = first; source < last; ++source) {
+            taps.push_back({source, out, static_cast<float>(1.0 / cell)});
+        }
+        if (end - last > 1e-3) {
+            taps.push_back({last, out, static_cast<float>(std::min(std::min(end - last, 1.0), cell) / cell)});
+        }
+    }
+    return taps;
+}
+
+SparseImage scaleSparseBlocks(const SparseImage& image, int factor, int outRows, int outCols) {
+    // Shrinking by an integer factor: cv::resize averages factor x factor blocks,
+    // rounding whole blocks of 2 x 2 up and the rest in float, and averages blocks
+    // cut short by the image edge over the pixels they hold.
+    const int channels = image.channels();
+    const auto& triples = image.triples();
+    const float wholeBlock = 1.0F / static_cast<float>(factor * factor);
+    std::vector<int> sums(static_cast<std::size_t>(outCols) * static_cast<std::size_t>(channels));
+    std::vector<int> touched;
+    std::vector<char> seen(static_cast<std::size_t>(outCols));
+    std::vector<SparseImage::Triple> result;
+    for (int y = 0; y < outRows; ++y) {
+        const int rowBegin = y * factor;
+        const int rowEnd = std::min(rowBegin + factor, image.rows());
+        for (std::size_t i = image.rowBegin(rowBegin); i < image.rowBegin(rowEnd); ++i) {
+            const int x = triples[i].col / factor;
+            if (x >= outCols) {
+                continue;   // past the last block when the width rounds down
+            }
+            if (seen[static_cast<std::size_t>(x)] == 0) {
+                seen[static_cast<std::size_t>(x)] = 1;
+                touched.push_back(x);
+            }
+            for (int ch = 0; ch < channels; ++ch) {
+                sums[static_cast<std::size_t>(x * channels + ch)] += triples[i].value[static_cast<std::size_t>(ch)];
+            }
+        }
+
+        std::sort(touched.begin(), touched.end());
+        for (const int x : touched) {
+            const int count = (rowEnd - rowBegin) * (std::min((x + 1) * factor, image.cols()) - x * factor);
+            SparseImage::Triple triple;
+            triple.row = y;
+            triple.col = x;
+            triple.channels = channels;
+            std::uint8_t any = 0;
+            for (int ch = 0; ch < channels; ++ch) {
+                int& sum = sums[static_cast<std::size_t>(x * channels + ch)];
+                std::uint8_t value = 0;
+                if (count != factor * factor) {
+                    value = cv::saturate_cast<std::uint8_t>(static_cast<float>(sum) / static_cast<float>(count));
+                } else if (factor == 2) {
+                    value = static_cast<std::uint8_t>((sum + 2) >> 2);
+                } else {
+                    value = cv::saturate_cast<std::uint8_t>(static_cast<float>(sum) * wholeBlock);
+                }
+                sum = 0;
+                triple.value[static_cast<std::size_t>(ch)] = value;
+                any |= value;
+            }
+            seen[static_cast<std::size_t>(x)] = 0;
+            if (any != 0) {
+                result.push_back(triple);
+            }
+        }
+        touched.clear();
+    }
+    return SparseImage(outRows, outCols, channels, std::move(result));
+}
+
+SparseImage scaleSparseArea(const SparseImage& image, double scale, int outRows, int outCols) {
+    const double inverse = 1.0 / scale;
+    const int factor = static_cast<int>(std::lround(inverse));
+    if (factor >= 2 && std::abs(inverse - factor) < std::numeric_limits<double>::epsilon()) {
+        return scaleSparseBlocks(image, factor, outRows, outCols);
+    }
+
+    // Each source row weighted into an output row adds its weight times the row's
+    // horizontal cell sums. Sums are accumulated in float in cv::resize's order;
+    // zero pixels only ever add an exact 0, so skipping them changes nothing.
+    const int channels = image.channels();
+    const auto& triples = image.triples();
+    std::vector<AreaTap> columnTaps = areaTaps(image.cols(), outCols, inverse);
+    std::stable_sort(columnTaps.begin(), columnTaps.end(),
+                     [](const AreaTap& a, const AreaTap& b) { return a.source < b.source; });
+    std::vector<std::size_t> columnStarts(static_cast<std::size_t>(image.cols()) + 1, 0);
+    for (const AreaTap& tap : columnTaps) {
+        ++columnStarts[static_cast<std::size_t>(tap.source) + 1];
+    }
+    std::partial_sum(columnStarts.begin(), columnStarts.end(), columnStarts.begin());
+    const std::vector<AreaTap> rowTaps = areaTaps(image.rows(), outRows, inverse);
+
+    const std::size_t samples = static_cast<std::size_t>(outCols) * static_cast<std::size_t>(channels);
+    std::vector<float> cells(samples);
+    std::vector<float> sums(samples);
+    std::vector<int> rowTouched;
+    std::vector<int> cellTouched;
+    std::vector<char> inRow(static_cast<std::size_t>(outCols));
+    std::vector<char> inCells(static_cast<std::size_t>(outCols));
+    std::vector<SparseImage::Triple> result;
+    for (std::size_t t = 0; t < rowTaps.size();) {
+        const int y = rowTaps[t].output;
+        for (; t < rowTaps.size() && rowTaps[t].output == y; ++t) {
+            const int row = rowTaps[t].source;
+            for (std::size_t i = image.rowBegin(row); i < image.rowBegin(row + 1); ++i) {
+                const auto col = static_cast<std::size_t>(triples[i].col);
+                for (std::size_t k = columnStarts[col]; k < columnStarts[col + 1]; ++k) {
+                    const int x = columnTaps[k].output;
+                    if (inCells[static_cast<std::size_t>(x)] == 0) {
+                        inCells[static_cast<std::size_t>(x)] = 1;
+                        cellTouched.push_back(x);
+                    }
+                    for (int ch = 0; ch < channels; ++ch) {
+                        cells[static_cast<std::size_t>(x * channels + ch)] +=
+                            triples[i].value[static_cast<std::size_t>(ch)] * columnTaps[k].weight;
+                    }
+                }
+            }
+            for (const int x : cellTouched) {
+                for (int ch = 0; ch < channels; ++ch) {
+                    float& cell = cells[static_cast<std::size_t>(x * channels + ch)];
+                    sums[static_cast<std::size_t>(x * channels + ch)] += rowTaps[t].weight * cell;
+                    cell = 0.0F;
+                }
+                inCells[static_cast<std::size_t>(x)] = 0;
+                if (inRow[static_cast<std::size_t>(x)] == 0) {
+                    inRow[static_cast<std::size_t>(x)] = 1;
+                    rowTouched.push_back(x);
+                }
+            }
+            cellTouched.clear();
+        }
+
+        std::sort(rowTouched.begin(), rowTouched.end());
+        for (const int x : rowTouched) {
+            SparseImage::Triple triple;
+            triple.row = y;
+            triple.col = x;
+            triple.channels = channels;
+            std::uint8_t any = 0;
+            for (int ch = 0; ch < channels; ++ch) {
+                float& sum = sums[static_cast<std::size_t>(x * channels + ch)];
+                const auto value = cv::saturate_cast<std::uint8_t>(sum);
+                sum = 0.0F;
+                triple.value[static_cast<std::size_t>(ch)] = value;
+                any |= value;
+            }
+            inRow[static_cast<std::size_t>(x)] = 0;
+            if (any != 0) {
+                result.push_back(triple);
+            }
+        }
+        rowTouched.clear();
+    }
+    return SparseImage(outRows, outCols, channels, std::move(result));
+}
+
+} // namespace
+
+SparseImage toGrayscale(const SparseImage& image) {
+    if (image.channels() == 1) {
+        return image;
+    }
+    // the fixed-point weights and rounding of cv::cvtColor(RGB2GRAY), so the result is exact
+    std::vector<SparseImage::Triple> result;
+    result.reserve(image.triples().size());
+    for (const SparseImage::Triple& pixel : image.triples()) {
+        const int gray = (pixel.value[0] * 4899 + pixel.value[1] * 9617 + pixel.value[2] * 1868 + (1 << 13)) >> 14;
+        if (gray != 0) {
+            SparseImage::Triple triple;
+            triple.row = pixel.row;
+            triple.col = pixel.col;
+            triple.channels = 1;
+            triple.value[0] = static_cast<std::uint8_t>(gray);
+            result.push_back(triple);
+        }
+    }
+    return SparseImage(image.rows(), image.cols(), 1, std::move(result));
+}
+
+SparseImage scaleByPercentage(const SparseImage& image, double scale, int interpolation) {
+    if (scale <= 0.0) {
+        throw std::runtime_error("缩放比例必须大于 0");
+    }
+    if (scale == 1.0) {
+        return image;
+    }
+    const int outRows = scaledLength(image.rows(), scale);
+    const int outCols = scaledLength(image.cols(), scale);
+    if (outRows == image.rows() && outCols == image.cols()) {
+        // cv::resize copies rather than resamples when the size does not change
+        return image;
+    }
+    switch (interpolation) {
+    case cv::INTER_NEAREST:
+        return scaleSparseNearest(image, scale, outRows, outCols);
+    case cv::INTER_LINEAR:
+        return scaleSparseLinear(image, scale, outRows, outCols);
+    case cv::INTER_AREA:
+        if (scale > 1.0) {
+            throw std::runtime_error("稀疏图像的区域插值仅支持缩小");
+        }
+        return scaleSparseArea(image, scale, outRows, outCols);
+    default:
+        throw std::runtime_error("稀疏图像仅支持最近邻、双线性与区域插值缩放");
+    }
+}
+
+std::unique_ptr<RowSource> grayscaleRows(std::unique_ptr<RowSource> source) {
+    return std::make_unique<GrayscaleRows>(std::move(source));
+}
+
+std::unique_ptr<RowSource> scaleRowsByPercentage(std::unique_ptr<RowSource> source, double scale) {
+    if (scale <= 0.0) {
+        throw std::runtime_error("缩放比例必须大于 0");
+    }
+    if (scaledLength(source->cols(), scale) == source->cols() && scaledLength(source->rows(), scale) == source->rows()) {
+        // cv::resize copies rather than resamples when the size does not change
+        return source;
+    }
+    return std::make_unique<ScaledRows>(std::move(source), scale);
+}
+
 } // namespace ImageOps
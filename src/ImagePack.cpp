@@ -0,0 +1,205 @@
+#include "ImagePack.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+/*
+ * Pack format:
+ * [magic "HFP" (3 bytes)] [version (1 byte)]
+ * members: the bytes of each HF2/HFM file, back to back, in the order added
+ * [zero padding to a multiple of 8 bytes]
+ * index, one entry per member, sorted by name (32 bytes each):
+ *   [offset (8 bytes)] [size (8 bytes)] [name offset (4 bytes)]
+ *   [width (4 bytes)] [height (4 bytes)] [name length (2 bytes)]
+ *   [channels (1 byte)] [reserved (1 byte)]
+ * [name table (variable): the names, not terminated]
+ * trailer (20 bytes):
+ *   [index offset (8 bytes)] [member count (4 bytes)] [name table size (4 bytes)]
+ *   [magic "HFP" (3 bytes)] [version (1 byte)]
+ *
+ * The trailer sits at the end so members can be streamed in before their
+ * count is known. Entries have a fixed size, so entry i is read directly and
+ * checked only when it is used.
+ */
+
+namespace {
+
+constexpr char kPackMagic[] = "HFP";
+constexpr std::size_t kPackMagicSize = sizeof(kPackMagic) - 1;
+constexpr std::uint8_t kPackVersion = 1;
+constexpr std::size_t kPackHeaderSize = kPackMagicSize + 1;
+constexpr std::size_t kEntrySize = 32;
+constexpr std::size_t kTrailerSize = 20;
+constexpr std::size_t kIndexAlignment = 8;
+
+template <typename T>
+void put(std::vector<char>& out, T value) {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(value));
+}
+
+template <typename T>
+T get(const char* data) {
+    T value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+} // namespace
+
+PackWriter::PackWriter(const std::string& path) : path_(path), ofs_(path, std::ios::binary) {
+    if (!ofs_) {
+        throw std::runtime_error("无法创建打包文件: " + path);
+    }
+    ofs_.write(kPackMagic, static_cast<std::streamsize>(kPackMagicSize));
+    ofs_.put(static_cast<char>(kPackVersion));
+    position_ = kPackHeaderSize;
+}
+
+void PackWriter::add(const std::string& name, const char* data, std::size_t size) {
+    if (name.empty() || name.size() > std::numeric_limits<std::uint16_t>::max()) {
+        throw std::runtime_error("打包成员名称长度非法: " + name);
+    }
+    // only single images can be packed; this also rejects sequences and damaged files
+    const ImageData header = ImageLoader::compressedHeader(data, size);
+
+    Pending entry;
+    entry.name = name;
+    entry.offset = position_;
+    entry.size = size;
+    entry.width = static_cast<std::uint32_t>(header.width);
+    entry.height = static_cast<std::uint32_t>(header.height);
+    entry.channels = header.magic == "P6" ? 3 : 1;
+    ofs_.write(data, static_cast<std::streamsize>(size));
+    if (!ofs_) {
+        throw std::runtime_error("写入打包文件失败: " + path_);
+    }
+    position_ += size;
+    entries_.push_back(std::move(entry));
+}
+
+void PackWriter::finish() {
+    std::sort(entries_.begin(), entries_.end(), [](const Pending& a, const Pending& b) { return a.name < b.name; });
+    for (std::size_t i = 1; i < entries_.size(); ++i) {
+        if (entries_[i - 1].name == entries_[i].name) {
+            throw std::runtime_error("打包成员名称重复: " + entries_[i].name);
+        }
+    }
+    if (entries_.size() > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("打包成员数量过多");
+    }
+
+    std::vector<char> tail(static_cast<std::size_t>((kIndexAlignment - position_ % kIndexAlignment) % kIndexAlignment), 0);
+    const std::uint64_t indexOffset = position_ + tail.size();
+    tail.reserve(tail.size() + entries_.size() * kEntrySize + kTrailerSize);
+    std::uint64_t nameOffset = 0;
+    for (const Pending& entry : entries_) {
+        put<std::uint64_t>(tail, entry.offset);
+        put<std::uint64_t>(tail, entry.size);
+        put<std::uint32_t>(tail, static_cast<std::uint32_t>(nameOffset));
+        put<std::uint32_t>(tail, entry.width);
+        put<std::uint32_t>(tail, entry.height);
+        put<std::uint16_t>(tail, static_cast<std::uint16_t>(entry.name.size()));
+        put<std::uint8_t>(tail, entry.channels);
+        put<std::uint8_t>(tail, 0);
+        nameOffset += entry.name.size();
+        if (nameOffset > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::runtime_error("打包成员名称总长度过大");
+        }
+    }
+    for (const Pending& entry : entries_) {
+        tail.insert(tail.end(), entry.name.begin(), entry.name.end());
+    }
+    put<std::uint64_t>(tail, indexOffset);
+    put<std::uint32_t>(tail, static_cast<std::uint32_t>(entries_.size()));
+    put<std::uint32_t>(tail, static_cast<std::uint32_t>(nameOffset));
+    tail.insert(tail.end(), kPackMagic, kPackMagic + kPackMagicSize);
+    tail.push_back(static_cast<char>(kPackVersion));
+
+    ofs_.write(tail.data(), static_cast<std::streamsize>(tail.size()));
+    ofs_.close();
+    if (!ofs_) {
+        throw std::runtime_error("写入打包文件失败: " + path_);
+    }
+}
+
+ImagePack::ImagePack(const std::string& path) : file_(path) {
+    const char* data = file_.data();
+    const std::size_t size = file_.size();
+    if (size < kPackHeaderSize + kTrailerSize || std::memcmp(data, kPackMagic, kPackMagicSize) != 0) {
+        throw std::runtime_error("打包文件魔术字不匹配或文件损坏: " + path);
+    }
+    const char* trailer = data + size - kTrailerSize;
+    if (std::memcmp(trailer + 16, kPackMagic, kPackMagicSize) != 0) {
+        throw std::runtime_error("打包文件不完整: " + path);
+    }
+    if (static_cast<std::uint8_t>(data[kPackMagicSize]) != kPackVersion ||
+        static_cast<std::uint8_t>(trailer[16 + kPackMagicSize]) != kPackVersion) {
+        throw std::runtime_error("打包文件版本不受支持: " + path);
+    }
+    const auto indexOffset = get<std::uint64_t>(trailer);
+    count_ = get<std::uint32_t>(trailer + 8);
+    namesSize_ = get<std::uint32_t>(trailer + 12);
+    // index and name table must exactly fill the space between the members and the trailer
+    const std::uint64_t tailSize = static_cast<std::uint64_t>(count_) * kEntrySize + namesSize_ + kTrailerSize;
+    if (indexOffset < kPackHeaderSize || indexOffset > size || size - indexOffset != tailSize) {
+        throw std::runtime_error("打包文件索引损坏: " + path);
+    }
+    dataEnd_ = indexOffset;
+    index_ = data + indexOffset;
+    names_ = index_ + count_ * kEntrySize;
+}
+
+bool ImagePack::isPack(const std::string& path) {
+    std::ifstream ifs(path, std::ios::binary);
+    char magic[kPackMagicSize];
+    return ifs.read(magic, static_cast<std::streamsize>(kPackMagicSize)) &&
+           std::memcmp(magic, kPackMagic, kPackMagicSize) == 0;
+}
+
+PackEntry ImagePack::entry(std::size_t index) const {
+    if (index >= count_) {
+        throw std::out_of_range("打包成员序号越界");
+    }
+    const char* raw = index_ + index * kEntrySize;
+    PackEntry entry;
+    entry.offset = get<std::uint64_t>(raw);
+    entry.size = get<std::uint64_t>(raw + 8);
+    const auto nameOffset = get<std::uint32_t>(raw + 16);
+    const auto width = get<std::uint32_t>(raw + 20);
+    const auto height = get<std::uint32_t>(raw + 24);
+    const auto nameLength = get<std::uint16_t>(raw + 28);
+    entry.channels = static_cast<std::uint8_t>(raw[30]);
+    if (entry.offset < kPackHeaderSize || entry.offset > dataEnd_ || entry.size > dataEnd_ - entry.offset ||
+        static_cast<std::uint64_t>(nameOffset) + nameLength > namesSize_ ||
+        width > static_cast<std::uint32_t>(std::numeric_limits<int>::max()) ||
+        height > static_cast<std::uint32_t>(std::numeric_limits<int>::max())) {
+        throw std::runtime_error("打包文件索引损坏");
+    }
+    entry.name = std::string_view(names_ + nameOffset, nameLength);
+    entry.width = static_cast<int>(width);
+    entry.height = static_cast<int>(height);
+    return entry;
+}
+
+std::size_t ImagePack::find(std::string_view name) const {
+    std::size_t low = 0;
+    std::size_t high = count_;
+    while (low < high) {
+        const std::size_t middle = low + (high - low) / 2;
+        if (entry(middle).name < name) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return (low < count_ && entry(low).name == name) ? low : count_;
+}
+
+ImageData ImagePack::decode(std::size_t index, DecompressionContext& context, const HuffmanDictionary* dictionary) const {
+    const PackEntry member = entry(index);
+    return ImageLoader::decompressFromMemory(file_.data() + member.offset, static_cast<std::size_t>(member.size), context,
+                                             dictionary);
+}
@@ -0,0 +1,609 @@
+#include "PixelKernels.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define IMAGICK_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define IMAGICK_X86_SIMD 0
+#endif
+
+namespace PixelKernels {
+
+namespace {
+
+using LeftDifferenceFn = void (*)(const std::uint8_t*, int, int, std::uint8_t* const*);
+using ReconstructFn = void (*)(const std::uint8_t* const*, int, int, std::uint8_t*);
+using CountNonZeroFn = std::size_t (*)(const std::uint8_t*, int, int);
+using ResampleRowFn = void (*)(const std::uint8_t*, const std::int32_t*, const std::int16_t*, int, std::size_t, std::size_t,
+                               std::int16_t*);
+using ResampleRowLocalFn = void (*)(const std::uint8_t*, const std::int32_t*, const std::int16_t*, const std::uint8_t*,
+                                    std::size_t, std::int16_t*);
+using BlendRowsFn = void (*)(const std::int16_t*, const std::int16_t*, std::int16_t, std::int16_t, std::size_t, std::uint8_t*);
+
+// Scalar kernels are templates on the channel count, so each specialization
+// has a fixed stride the compiler can unroll; 0 means "given at run time".
+template <int Channels>
+void leftDifferenceTail(const std::uint8_t* row, int begin, int width, int channels, std::uint8_t* const* planes) {
+    // scalar residuals for columns [begin, width)
+    const int stride = Channels > 0 ? Channels : channels;
+    if (begin == 0 && width > 0) {
+        for (int ch = 0; ch < stride; ++ch) {
+            planes[ch][0] = row[ch];
+        }
+        begin = 1;
+    }
+    for (int col = begin; col < width; ++col) {
+        const std::uint8_t* current = row + col * stride;
+        for (int ch = 0; ch < stride; ++ch) {
+            planes[ch][col] = static_cast<std::uint8_t>(current[ch] - current[ch - stride]);
+        }
+    }
+}
+
+template <int Channels>
+void reconstructTail(const std::uint8_t* const* planes, int begin, int width, int channels, std::uint8_t* row) {
+    // scalar prefix sums for columns [begin, width), continuing from row[begin - 1]
+    const int stride = Channels > 0 ? Channels : channels;
+    if (begin == 0 && width > 0) {
+        for (int ch = 0; ch < stride; ++ch) {
+            row[ch] = planes[ch][0];
+        }
+        begin = 1;
+    }
+    for (int col = begin; col < width; ++col) {
+        std::uint8_t* current = row + col * stride;
+        for (int ch = 0; ch < stride; ++ch) {
+            current[ch] = static_cast<std::uint8_t>(current[ch - stride] + planes[ch][col]);
+        }
+    }
+}
+
+void leftDifferenceTail(const std::uint8_t* row, int begin, int width, int channels, std::uint8_t* const* planes) {
+    switch (channels) {
+    case 1:
+        return leftDifferenceTail<1>(row, begin, width, channels, planes);
+    case 3:
+        return leftDifferenceTail<3>(row, begin, width, channels, planes);
+    default:
+        return leftDifferenceTail<0>(row, begin, width, channels, planes);
+    }
+}
+
+void reconstructTail(const std::uint8_t* const* planes, int begin, int width, int channels, std::uint8_t* row) {
+    switch (channels) {
+    case 1:
+        return reconstructTail<1>(planes, begin, width, channels, row);
+    case 3:
+        return reconstructTail<3>(planes, begin, width, channels, row);
+    default:
+        return reconstructTail<0>(planes, begin, width, channels, row);
+    }
+}
+
+void leftDifferenceScalar(const std::uint8_t* row, int width, int channels, std::uint8_t* const* planes) {
+    leftDifferenceTail(row, 0, width, channels, planes);
+}
+
+void reconstructScalar(const std::uint8_t* const* planes, int width, int channels, std::uint8_t* row) {
+    reconstructTail(planes, 0, width, channels, row);
+}
+
+template <int Channels>
+std::size_t countNonZeroTail(const std::uint8_t* row, int begin, int width, int channels) {
+    // pixels in [begin, width) with any non-zero channel, without branching on the data
+    const int stride = Channels > 0 ? Channels : channels;
+    std::size_t count = 0;
+    for (int col = begin; col < width; ++col) {
+        const std::uint8_t* pixel = row + col * stride;
+        std::uint8_t any = 0;
+        for (int ch = 0; ch < stride; ++ch) {
+            any |= pixel[ch];
+        }
+        count += any != 0;
+    }
+    return count;
+}
+
+std::size_t countNonZeroTail(const std::uint8_t* row, int begin, int width, int channels) {
+    switch (channels) {
+    case 1:
+        return countNonZeroTail<1>(row, begin, width, channels);
+    case 3:
+        return countNonZeroTail<3>(row, begin, width, channels);
+    default:
+        return countNonZeroTail<0>(row, begin, width, channels);
+    }
+}
+
+std::size_t countNonZeroScalar(const std::uint8_t* row, int width, int channels) {
+    return countNonZeroTail(row, 0, width, channels);
+}
+
+void resampleRowTail(const std::uint8_t* src, const std::int32_t* offsets, const std::int16_t* weights, int step,
+                     std::size_t begin, std::size_t count, std::int16_t* out) {
+    for (std::size_t i = begin; i < count; ++i) {
+        const std::uint8_t* taps = src + offsets[i];
+        out[i] = static_cast<std::int16_t>((taps[0] * weights[2 * i] + taps[step] * weights[2 * i + 1]) >> 4);
+    }
+}
+
+void resampleRowScalar(const std::uint8_t* src, const std::int32_t* offsets, const std::int16_t* weights, int step,
+                       std::size_t count, std::size_t, std::int16_t* out) {
+    resampleRowTail(src, offsets, weights, step, 0, count, out);
+}
+
+void resampleRowLocalScalar(const std::uint8_t* src, const std::int32_t* windows, const std::int16_t* weights,
+                            const std::uint8_t* shuffles, std::size_t count, std::int16_t* out) {
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::uint8_t* window = src + windows[i / 8];
+        const std::uint8_t* pair = shuffles + 2 * i;
+        out[i] = static_cast<std::int16_t>((window[pair[0]] * weights[2 * i] + window[pair[1]] * weights[2 * i + 1]) >> 4);
+    }
+}
+
+void blendRowsTail(const std::int16_t* top, const std::int16_t* bottom, std::int16_t topWeight, std::int16_t bottomWeight,
+                   std::size_t begin, std::size_t count, std::uint8_t* out) {
+    for (std::size_t i = begin; i < count; ++i) {
+        const int value = (((top[i] * topWeight) >> 16) + ((bottom[i] * bottomWeight) >> 16) + 2) >> 2;
+        out[i] = static_cast<std::uint8_t>(std::clamp(value, 0, 255));
+    }
+}
+
+void blendRowsScalar(const std::int16_t* top, const std::int16_t* bottom, std::int16_t topWeight, std::int16_t bottomWeight,
+                     std::size_t count, std::uint8_t* out) {
+    blendRowsTail(top, bottom, topWeight, bottomWeight, 0, count, out);
+}
+
+#if IMAGICK_X86_SIMD
+
+__attribute__((target("sse2"))) inline __m128i prefixSum16(__m128i x) {
+    // inclusive byte-wise prefix sum inside one vector
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+    return x;
+}
+
+__attribute__((target("sse2"))) inline __m128i broadcastLastByte(__m128i x) {
+    __m128i last = _mm_srli_si128(x, 15);
+    last = _mm_unpacklo_epi8(last, last);
+    last = _mm_unpacklo_epi16(last, last);
+    return _mm_shuffle_epi32(last, 0);
+}
+
+__attribute__((target("sse2")))
+void leftDifferenceSse2(const std::uint8_t* row, int width, int channels, std::uint8_t* const* planes) {
+    if (width <= 0) {
+        return;
+    }
+    leftDifferenceTail(row, 0, 1, channels, planes);
+    int col = 1;
+    if (channels == 1) {
+        for (; col + 16 <= width; col += 16) {
+            const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + col));
+            const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + col - 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[0] + col), _mm_sub_epi8(current, left));
+        }
+    } else {
+        // subtract in interleaved order (left neighbour is 3 bytes back), then split the planes
+        alignas(16) std::uint8_t block[48];
+        for (; col + 16 <= width; col += 16) {
+            const std::uint8_t* source = row + col * 3;
+            for (int k = 0; k < 3; ++k) {
+                const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16 * k));
+                const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16 * k - 3));
+                _mm_store_si128(reinterpret_cast<__m128i*>(block + 16 * k), _mm_sub_epi8(current, left));
+            }
+            for (int i = 0; i < 16; ++i) {
+                planes[0][col + i] = block[3 * i];
+                planes[1][col + i] = block[3 * i + 1];
+                planes[2][col + i] = block[3 * i + 2];
+            }
+        }
+    }
+    leftDifferenceTail(row, col, width, channels, planes);
+}
+
+__attribute__((target("sse2")))
+void reconstructSse2(const std::uint8_t* const* planes, int width, int channels, std::uint8_t* row) {
+    int col = 0;
+    if (channels == 1) {
+        __m128i carry = _mm_setzero_si128();
+        for (; col + 16 <= width; col += 16) {
+            __m128i values = prefixSum16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[0] + col)));
+            values = _mm_add_epi8(values, carry);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row + col), values);
+            carry = broadcastLastByte(values);
+        }
+    } else {
+        alignas(16) std::uint8_t block[48];
+        __m128i carry[3] = {_mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()};
+        for (; col + 16 <= width; col += 16) {
+            for (int ch = 0; ch < 3; ++ch) {
+                __m128i values = prefixSum16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[ch] + col)));
+                values = _mm_add_epi8(values, carry[ch]);
+                carry[ch] = broadcastLastByte(values);
+                _mm_store_si128(reinterpret_cast<__m128i*>(block + 16 * ch), values);
+            }
+            std::uint8_t* target = row + col * 3;
+            for (int i = 0; i < 16; ++i) {
+                target[3 * i] = block[i];
+                target[3 * i + 1] = block[16 + i];
+                target[3 * i + 2] = block[32 + i];
+            }
+        }
+    }
+    reconstructTail(planes, col, width, channels, row);
+}
+
+__attribute__((target("sse2")))
+std::size_t countNonZeroSse2(const std::uint8_t* row, int width, int channels) {
+    // one bit per byte from movemask; for RGB the bits of each pixel are OR-ed into
+    // its first bit, and every third bit is counted
+    const __m128i zero = _mm_setzero_si128();
+    std::size_t count = 0;
+    int col = 0;
+    if (channels == 1) {
+        for (; col + 16 <= width; col += 16) {
+            const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + col));
+            const auto zeros = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(values, zero)));
+            count += 16 - static_cast<std::size_t>(__builtin_popcount(zeros));
+        }
+    } else if (channels == 3) {
+        constexpr std::uint64_t kFirstOfPixel = 0x249249249249ULL;    // bits 0, 3, ..., 45
+        for (; col + 16 <= width; col += 16) {
+            std::uint64_t zeros = 0;
+            for (int k = 0; k < 3; ++k) {
+                const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + col * 3 + 16 * k));
+                zeros |= static_cast<std::uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(values, zero))))
+                         << (16 * k);
+            }
+            const std::uint64_t nonZero = ~zeros;
+            count += static_cast<std::size_t>(__builtin_popcountll((nonZero | nonZero >> 1 | nonZero >> 2) & kFirstOfPixel));
+        }
+    }
+    return count + countNonZeroTail(row, col, width, channels);
+}
+
+__attribute__((target("sse2")))
+void blendRowsSse2(const std::int16_t* top, const std::int16_t* bottom, std::int16_t topWeight, std::int16_t bottomWeight,
+                   std::size_t count, std::uint8_t* out) {
+    const __m128i wTop = _mm_set1_epi16(topWeight);
+    const __m128i wBottom = _mm_set1_epi16(bottomWeight);
+    const __m128i two = _mm_set1_epi16(2);
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i sums[2];
+        for (int k = 0; k < 2; ++k) {
+            const __m128i upper = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + i + 8 * k));
+            const __m128i lower = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + i + 8 * k));
+            const __m128i sum = _mm_add_epi16(_mm_mulhi_epi16(upper, wTop), _mm_mulhi_epi16(lower, wBottom));
+            sums[k] = _mm_srai_epi16(_mm_add_epi16(sum, two), 2);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(sums[0], sums[1]));
+    }
+    blendRowsTail(top, bottom, topWeight, bottomWeight, i, count, out);
+}
+
+// pshufb masks indexed [output vector][input vector]: kSplitMasks[ch][k] gathers
+// plane ch from the k-th 16 bytes of 48 interleaved bytes, kMergeMasks[k][ch]
+// places plane ch into the k-th 16 bytes of the interleaved output
+alignas(16) constexpr std::int8_t kSplitMasks[3][3][16] = {
+    {{0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}},
+    {{1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}},
+    {{2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}},
+};
+
+alignas(16) constexpr std::int8_t kMergeMasks[3][3][16] = {
+    {{0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5},
+     {-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1},
+     {-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1}},
+    {{-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1},
+     {5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10},
+     {-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1}},
+    {{-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1},
+     {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1},
+     {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}},
+};
+
+__attribute__((target("avx2"))) inline __m128i loadMask(const std::int8_t* mask) {
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(mask));
+}
+
+__attribute__((target("avx2"))) inline void shuffle48(const __m128i in[3], const std::int8_t (*masks)[3][16], __m128i out[3]) {
+    // out[i] = pshufb(in[0], masks[i][0]) | pshufb(in[1], masks[i][1]) | pshufb(in[2], masks[i][2])
+    for (int i = 0; i < 3; ++i) {
+        __m128i merged = _mm_setzero_si128();
+        for (int j = 0; j < 3; ++j) {
+            merged = _mm_or_si128(merged, _mm_shuffle_epi8(in[j], loadMask(masks[i][j])));
+        }
+        out[i] = merged;
+    }
+}
+
+__attribute__((target("avx2")))
+void leftDifferenceAvx2(const std::uint8_t* row, int width, int channels, std::uint8_t* const* planes) {
+    if (width <= 0) {
+        return;
+    }
+    leftDifferenceTail(row, 0, 1, channels, planes);
+    int col = 1;
+    if (channels == 1) {
+        for (; col + 32 <= width; col += 32) {
+            const __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + col));
+            const __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + col - 1));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(planes[0] + col), _mm256_sub_epi8(current, left));
+        }
+    } else {
+        for (; col + 16 <= width; col += 16) {
+            const std::uint8_t* source = row + col * 3;
+            __m128i diff[3];
+            for (int k = 0; k < 3; ++k) {
+                const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16 * k));
+                const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16 * k - 3));
+                diff[k] = _mm_sub_epi8(current, left);
+            }
+            __m128i split[3];
+            shuffle48(diff, kSplitMasks, split);
+            for (int ch = 0; ch < 3; ++ch) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[ch] + col), split[ch]);
+            }
+        }
+    }
+    leftDifferenceTail(row, col, width, channels, planes);
+}
+
+__attribute__((target("avx2")))
+void reconstructAvx2(const std::uint8_t* const* planes, int width, int channels, std::uint8_t* row) {
+    if (channels == 1) {
+        // a prefix sum gains nothing from 256-bit lanes
+        reconstructSse2(planes, width, channels, row);
+        return;
+    }
+    int col = 0;
+    __m128i carry[3] = {_mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()};
+    for (; col + 16 <= width; col += 16) {
+        __m128i values[3];
+        for (int ch = 0; ch < 3; ++ch) {
+            values[ch] = prefixSum16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[ch] + col)));
+            values[ch] = _mm_add_epi8(values[ch], carry[ch]);
+            carry[ch] = broadcastLastByte(values[ch]);
+        }
+        __m128i merged[3];
+        shuffle48(values, kMergeMasks, merged);
+        std::uint8_t* target = row + col * 3;
+        for (int k = 0; k < 3; ++k) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + 16 * k), merged[k]);
+        }
+    }
+    reconstructTail(planes, col, width, channels, row);
+}
+
+__attribute__((target("avx2")))
+void resampleRowAvx2(const std::uint8_t* src, const std::int32_t* offsets, const std::int16_t* weights, int step,
+                     std::size_t count, std::size_t gatherSafe, std::int16_t* out) {
+    std::size_t i = 0;
+    if (step == 3) {
+        // RGB: both taps of a pixel are in the 8 bytes at its first offset. A shuffle turns
+        // them into (tap 0, tap 1) word pairs per channel for madd; two pixels per step
+        const __m128i spread = _mm_setr_epi8(0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1);
+        const __m128i compact = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1);
+        for (; i + 8 <= gatherSafe; i += 6) {
+            __m128i sums[2];
+            for (int k = 0; k < 2; ++k) {
+                const std::size_t pixel = i + 3 * static_cast<std::size_t>(k);
+                const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + offsets[pixel]));
+                const __m128i pairs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + 2 * pixel));
+                sums[k] = _mm_srai_epi32(_mm_madd_epi16(_mm_shuffle_epi8(bytes, spread), pairs), 4);
+            }
+            // 8 samples are stored, the last 2 are overwritten by the next step or the tail
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_shuffle_epi8(_mm_packs_epi32(sums[0], sums[1]), compact));
+        }
+        resampleRowTail(src, offsets, weights, step, i, count, out);
+        return;
+    }
+    // each gather fetches 4 bytes per sample, holding both taps; they are split into
+    // 16-bit halves so that one madd applies the interleaved weight pairs
+    const __m128i shift = _mm_cvtsi32_si128(8 * step);
+    const __m256i low = _mm256_set1_epi32(0xFF);
+    const int* base = reinterpret_cast<const int*>(src);
+    for (; i + 16 <= gatherSafe; i += 16) {
+        __m256i sums[2];
+        for (int k = 0; k < 2; ++k) {
+            const __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets + i + 8 * k));
+            const __m256i bytes = _mm256_i32gather_epi32(base, index, 1);
+            const __m256i first = _mm256_and_si256(bytes, low);
+            const __m256i second = _mm256_and_si256(_mm256_srl_epi32(bytes, shift), low);
+            const __m256i taps = _mm256_or_si256(first, _mm256_slli_epi32(second, 16));
+            const __m256i pairs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + 2 * (i + 8 * k)));
+            sums[k] = _mm256_srai_epi32(_mm256_madd_epi16(taps, pairs), 4);
+        }
+        // packs works per 128-bit lane; the permute restores sample order
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(sums[0], sums[1]), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+    }
+    resampleRowTail(src, offsets, weights, step, i, count, out);
+}
+
+__attribute__((target("avx2"))) inline __m256i resampleGroup(const std::uint8_t* window, const std::uint8_t* shuffle,
+                                                             const std::int16_t* weights) {
+    // one shuffle lays out the group's tap pairs, widened to words for madd
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(window));
+    const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffle));
+    const __m256i taps = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(bytes, mask));
+    const __m256i pairs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights));
+    return _mm256_srai_epi32(_mm256_madd_epi16(taps, pairs), 4);
+}
+
+__attribute__((target("avx2")))
+void resampleRowLocalAvx2(const std::uint8_t* src, const std::int32_t* windows, const std::int16_t* weights,
+                          const std::uint8_t* shuffles, std::size_t count, std::int16_t* out) {
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256i first = resampleGroup(src + windows[i / 8], shuffles + 2 * i, weights + 2 * i);
+        const __m256i second = resampleGroup(src + windows[i / 8 + 1], shuffles + 2 * (i + 8), weights + 2 * (i + 8));
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(first, second), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+    }
+    if (i < count) {
+        const __m256i sums = resampleGroup(src + windows[i / 8], shuffles + 2 * i, weights + 2 * i);
+        const __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+    }
+}
+
+__attribute__((target("avx2")))
+void blendRowsAvx2(const std::int16_t* top, const std::int16_t* bottom, std::int16_t topWeight, std::int16_t bottomWeight,
+                   std::size_t count, std::uint8_t* out) {
+    const __m256i wTop = _mm256_set1_epi16(topWeight);
+    const __m256i wBottom = _mm256_set1_epi16(bottomWeight);
+    const __m256i two = _mm256_set1_epi16(2);
+    std::size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i sums[2];
+        for (int k = 0; k < 2; ++k) {
+            const __m256i upper = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + i + 16 * k));
+            const __m256i lower = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bottom + i + 16 * k));
+            const __m256i sum = _mm256_add_epi16(_mm256_mulhi_epi16(upper, wTop), _mm256_mulhi_epi16(lower, wBottom));
+            sums[k] = _mm256_srai_epi16(_mm256_add_epi16(sum, two), 2);
+        }
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(sums[0], sums[1]), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+    }
+    // the rest stays in this function: calling the non-VEX SSE2 kernel with dirty
+    // upper halves costs a state transition on every row
+    for (; i + 16 <= count; i += 16) {
+        const __m256i upper = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + i));
+        const __m256i lower = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bottom + i));
+        const __m256i sum = _mm256_add_epi16(_mm256_mulhi_epi16(upper, wTop), _mm256_mulhi_epi16(lower, wBottom));
+        const __m256i rounded = _mm256_srai_epi16(_mm256_add_epi16(sum, two), 2);
+        const __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(rounded), _mm256_extracti128_si256(rounded, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+    }
+    blendRowsTail(top, bottom, topWeight, bottomWeight, i, count, out);
+}
+
+#endif // IMAGICK_X86_SIMD
+
+struct KernelTable {
+    Level level = Level::Scalar;
+    LeftDifferenceFn leftDifference = leftDifferenceScalar;
+    ReconstructFn reconstruct = reconstructScalar;
+    CountNonZeroFn countNonZero = countNonZeroScalar;
+    ResampleRowFn resampleRow = resampleRowScalar;
+    ResampleRowLocalFn resampleRowLocal = resampleRowLocalScalar;
+    BlendRowsFn blendRows = blendRowsScalar;
+};
+
+KernelTable tableFor(Level level) {
+    KernelTable table;
+#if IMAGICK_X86_SIMD
+    if (level == Level::AVX2) {
+        table = {Level::AVX2, leftDifferenceAvx2, reconstructAvx2, countNonZeroSse2, resampleRowAvx2,
+                 resampleRowLocalAvx2, blendRowsAvx2};
+    } else if (level == Level::SSE2) {
+        // without a gather or a byte shuffle the horizontal pass stays scalar
+        table = {Level::SSE2, leftDifferenceSse2, reconstructSse2, countNonZeroSse2, resampleRowScalar,
+                 resampleRowLocalScalar, blendRowsSse2};
+    }
+#else
+    (void)level;
+#endif
+    return table;
+}
+
+KernelTable& activeTable() {
+    static KernelTable table = tableFor(detectedLevel());
+    return table;
+}
+
+} // namespace
+
+Level detectedLevel() {
+#if IMAGICK_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return Level::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return Level::SSE2;
+    }
+#endif
+    return Level::Scalar;
+}
+
+Level activeLevel() {
+    return activeTable().level;
+}
+
+void setLevel(Level level) {
+    activeTable() = tableFor(std::min(level, detectedLevel()));
+}
+
+const char* levelName(Level level) {
+    switch (level) {
+    case Level::Scalar:
+        return "scalar";
+    case Level::SSE2:
+        return "sse2";
+    case Level::AVX2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+void leftDifference(const std::uint8_t* row, int width, int channels, std::uint8_t* const* planes) {
+    activeTable().leftDifference(row, width, channels, planes);
+}
+
+void reconstructInterleaved(const std::uint8_t* const* planes, int width, int channels, std::uint8_t* row) {
+    activeTable().reconstruct(planes, width, channels, row);
+}
+
+std::size_t countNonZeroPixels(const std::uint8_t* row, int width, int channels) {
+    return activeTable().countNonZero(row, width, channels);
+}
+
+void resampleRow(const std::uint8_t* src, const std::int32_t* offsets, const std::int16_t* weights, int step,
+                 std::size_t count, std::size_t gatherSafe, std::int16_t* out) {
+    activeTable().resampleRow(src, offsets, weights, step, count, gatherSafe, out);
+}
+
+void resampleRowLocal(const std::uint8_t* src, const std::int32_t* windows, const std::int16_t* weights,
+                      const std::uint8_t* shuffles, std::size_t count, std::int16_t* out) {
+    activeTable().resampleRowLocal(src, windows, weights, shuffles, count, out);
+}
+
+void blendRows(const std::int16_t* top, const std::int16_t* bottom, std::int16_t topWeight, std::int16_t bottomWeight,
+               std::size_t count, std::uint8_t* out) {
+    activeTable().blendRows(top, bottom, topWeight, bottomWeight, count, out);
+}
+
+std::size_t findNonZero(const std::uint8_t* data, std::size_t size) {
+    // the black stretches of mask-like images are skipped 32 bytes at a time
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        std::uint64_t words[4];
+        std::memcpy(words, data + i, sizeof(words));
+        if ((words[0] | words[1] | words[2] | words[3]) != 0) {
+            break;
+        }
+    }
+    while (i < size && data[i] == 0) {
+        ++i;
+    }
+    return i;
+}
+
+} // namespace PixelKernels
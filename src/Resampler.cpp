@@ -0,0 +1,442 @@
+#include "Resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include <opencv2/imgproc.hpp>
+
+#include "ImageOps.hpp"
+#include "PixelKernels.hpp"
+
+namespace ImageOps {
+
+namespace {
+
+constexpr int kWeightBits = 11;     // INTER_RESIZE_COEF_BITS of cv::resize
+constexpr float kWeightScale = 1 << kWeightBits;
+// smaller outputs are not worth waking the workers for
+constexpr std::size_t kParallelResampleSamples = std::size_t{1} << 16;
+constexpr int kMinBandRows = 16;
+
+std::int16_t fixedWeight(float weight) {
+    return static_cast<std::int16_t>(std::lrint(weight * kWeightScale));
+}
+
+std::uint8_t halfEven(int twice) {
+    // twice / 2 rounded half to even, as cv::resize rounds block averages
+    return static_cast<std::uint8_t>((twice + ((twice >> 1) & 1)) >> 1);
+}
+
+// Threads kept across calls, so that resizing many small images does not pay
+// for starting threads each time. One job runs at a time; the caller works on
+// it too.
+class WorkerPool {
+public:
+    static WorkerPool& instance() {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    std::size_t size() const { return workers_.size() + 1; }
+
+    // task(i) for every i < count, spread over the pool; returns once all are done
+    void run(std::size_t count, const std::function<void(std::size_t)>& task) {
+        if (count <= 1 || workers_.empty()) {
+            for (std::size_t i = 0; i < count; ++i) {
+                task(i);
+            }
+            return;
+        }
+        std::lock_guard<std::mutex> job(jobMutex_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            count_ = count;
+            next_ = 0;
+            pending_ = count;
+            ++generation_;
+        }
+        wake_.notify_all();
+        work();
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+        task_ = nullptr;
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+private:
+    WorkerPool() {
+        const unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 1; i < threads; ++i) {
+            workers_.emplace_back([this] { loop(); });
+        }
+    }
+
+    void loop() {
+        std::uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+            }
+            work();
+        }
+    }
+
+    void work() {
+        // claims indices of the current job until none are left
+        while (true) {
+            const std::function<void(std::size_t)>* task = nullptr;
+            std::size_t index = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (task_ == nullptr || next_ >= count_) {
+                    return;
+                }
+                task = task_;
+                index = next_++;
+            }
+            (*task)(index);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_ == 0) {
+                done_.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex jobMutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(std::size_t)>* task_ = nullptr;
+    std::size_t count_ = 0;
+    std::size_t next_ = 0;
+    std::size_t pending_ = 0;
+    std::uint64_t generation_ = 0;
+    bool stop_ = false;
+};
+
+} // namespace
+
+ResamplePlan::ResamplePlan(cv::Size source, double scale, int interpolation, int channels)
+    : source_(source), channels_(channels) {
+    if (source.width <= 0 || source.height <= 0) {
+        throw std::runtime_error("无法缩放空图像");
+    }
+    if (scale <= 0.0) {
+        throw std::runtime_error("缩放比例必须大于 0");
+    }
+    if (channels != 1 && channels != 3) {
+        throw std::runtime_error("缩放仅支持单通道或三通道图像");
+    }
+    if (interpolation != cv::INTER_NEAREST && interpolation != cv::INTER_LINEAR) {
+        throw std::runtime_error("缩放计划仅支持最近邻与双线性插值");
+    }
+    if (static_cast<std::int64_t>(source.width) * channels > std::numeric_limits<std::int32_t>::max()) {
+        throw std::runtime_error("图像过宽，无法缩放");
+    }
+    destination_ = cv::Size(scaledLength(source.width, scale), scaledLength(source.height, scale));
+    nearest_ = interpolation == cv::INTER_NEAREST;
+    const double inverse = 1.0 / scale;
+    rows_.resize(static_cast<std::size_t>(destination_.height));
+
+    if (nearest_) {
+        // floor(x / scale) as cv::resize computes it; each output pixel copies one source pixel
+        offsets_.resize(static_cast<std::size_t>(destination_.width));
+        for (int x = 0; x < destination_.width; ++x) {
+            offsets_[static_cast<std::size_t>(x)] = std::min(static_cast<int>(std::floor(x * inverse)), source.width - 1) * channels;
+        }
+        for (int y = 0; y < destination_.height; ++y) {
+            rows_[static_cast<std::size_t>(y)] = std::min(static_cast<int>(std::floor(y * inverse)), source.height - 1);
+        }
+        return;
+    }
+
+    // Bilinear positions as cv::resize computes them, in float from the pixel centres.
+    // A tap pair reaching past the right edge is moved one pixel left with all weight
+    // on its second tap, so both taps stay inside the row.
+    step_ = source.width > 1 ? channels : 0;
+    const std::size_t samples = static_cast<std::size_t>(destination_.width) * static_cast<std::size_t>(channels);
+    offsets_.resize(samples);
+    columnWeights_.resize(2 * samples);
+    for (int x = 0; x < destination_.width; ++x) {
+        const auto position = static_cast<float>((x + 0.5) * inverse - 0.5);
+        int first = static_cast<int>(std::floor(position));
+        float weight = position - static_cast<float>(first);
+        if (first < 0) {
+            first = 0;
+            weight = 0.0F;
+        }
+        std::int16_t firstWeight = fixedWeight(1.0F - weight);
+        std::int16_t secondWeight = fixedWeight(weight);
+        if (first >= source.width - 1) {
+            first = source.width - 1;
+            firstWeight = static_cast<std::int16_t>(kWeightScale);
+            secondWeight = 0;
+            if (step_ > 0) {
+                first = source.width - 2;
+                std::swap(firstWeight, secondWeight);
+            }
+        }
+        for (int ch = 0; ch < channels; ++ch) {
+            const std::size_t i = static_cast<std::size_t>(x) * static_cast<std::size_t>(channels) + static_cast<std::size_t>(ch);
+            offsets_[i] = first * channels + ch;
+            columnWeights_[2 * i] = firstWeight;
+            columnWeights_[2 * i + 1] = secondWeight;
+        }
+    }
+    const std::int64_t rowBytes = static_cast<std::int64_t>(source.width) * channels;
+    while (gatherSafe_ < samples && offsets_[gatherSafe_] + 8 <= rowBytes) {
+        ++gatherSafe_;
+    }
+    // When enlarging or mildly shrinking, 8 neighbouring samples fit in one 16-byte
+    // window. The prefix is cut to whole pixels so the rest starts on a pixel.
+    const std::size_t groupSize = 8;
+    while (localCount_ + groupSize <= samples) {
+        const auto group = offsets_.begin() + static_cast<std::ptrdiff_t>(localCount_);
+        const auto [low, high] = std::minmax_element(group, group + groupSize);
+        if (*low + 16 > rowBytes || *high - *low + step_ > 15) {
+            break;
+        }
+        windows_.push_back(*low);
+        localCount_ += groupSize;
+    }
+    localCount_ -= localCount_ % (groupSize * static_cast<std::size_t>(channels));
+    windows_.resize(localCount_ / groupSize);
+    shuffles_.resize(2 * localCount_);
+    for (std::size_t i = 0; i < localCount_; ++i) {
+        const std::int32_t position = offsets_[i] - windows_[i / groupSize];
+        shuffles_[2 * i] = static_cast<std::uint8_t>(position);
+        shuffles_[2 * i + 1] = static_cast<std::uint8_t>(position + step_);
+    }
+
+    // cv::resize averages 2x2 blocks when halving; a block is cut short where 2 * size - 1 source pixels remain
+    halving_ = scale == 0.5;
+    partialColumn_ = halving_ && 2 * destination_.width - 1 == source.width;
+    partialRow_ = halving_ && 2 * destination_.height - 1 == source.height;
+
+    // rows: cv::resize clamps the two row indices but keeps the unclamped weights
+    rowWeights_.resize(2 * rows_.size());
+    for (int y = 0; y < destination_.height; ++y) {
+        const auto position = static_cast<float>((y + 0.5) * inverse - 0.5);
+        const int first = static_cast<int>(std::floor(position));
+        const float weight = position - static_cast<float>(first);
+        rows_[static_cast<std::size_t>(y)] = first;
+        rowWeights_[2 * static_cast<std::size_t>(y)] = fixedWeight(1.0F - weight);
+        rowWeights_[2 * static_cast<std::size_t>(y) + 1] = fixedWeight(weight);
+    }
+}
+
+void ResamplePlan::execute(const cv::Mat& source, cv::Mat& destination) const {
+    if (source.size() != source_ || source.channels() != channels_ || source.depth() != CV_8U) {
+        throw std::runtime_error("缩放计划与图像尺寸或类型不匹配");
+    }
+    if (destination_ == source_) {
+        // cv::resize copies rather than resamples when the size does not change
+        source.copyTo(destination);
+        return;
+    }
+    destination.create(destination_, source.type());
+
+    const std::size_t samples = static_cast<std::size_t>(destination_.width) * static_cast<std::size_t>(channels_);
+    std::size_t bands = 1;
+    if (samples * static_cast<std::size_t>(destination_.height) >= kParallelResampleSamples) {
+        bands = std::min(WorkerPool::instance().size(),
+                         static_cast<std::size_t>(std::max(1, destination_.height / kMinBandRows)));
+    }
+    // two horizontal rows per band, allocated up front so the bands cannot fail
+    std::vector<std::int16_t> scratch(nearest_ ? 0 : bands * 2 * samples);
+    const int height = destination_.height;
+    WorkerPool::instance().run(bands, [&](std::size_t band) {
+        const int begin = static_cast<int>(static_cast<std::size_t>(height) * band / bands);
+        const int end = static_cast<int>(static_cast<std::size_t>(height) * (band + 1) / bands);
+        if (nearest_) {
+            copyRows(source, destination, begin, end);
+        } else {
+            executeRows(source, destination, begin, end, scratch.data() + band * 2 * samples);
+        }
+    });
+}
+
+void ResamplePlan::copyRows(const cv::Mat& source, cv::Mat& destination, int begin, int end) const {
+    // nearest neighbour: pixel copies, and a plain row copy when the source row repeats
+    const std::size_t rowBytes = static_cast<std::size_t>(destination_.width) * static_cast<std::size_t>(channels_);
+    for (int y = begin; y < end; ++y) {
+        std::uint8_t* out = destination.ptr<std::uint8_t>(y);
+        const int row = rows_[static_cast<std::size_t>(y)];
+        if (y > begin && row == rows_[static_cast<std::size_t>(y) - 1]) {
+            std::memcpy(out, destination.ptr<std::uint8_t>(y - 1), rowBytes);
+            continue;
+        }
+        const std::uint8_t* in = source.ptr<std::uint8_t>(row);
+        if (channels_ == 1) {
+            for (int x = 0; x < destination_.width; ++x) {
+                out[x] = in[offsets_[static_cast<std::size_t>(x)]];
+            }
+        } else {
+            for (int x = 0; x < destination_.width; ++x) {
+                std::memcpy(out + 3 * x, in + offsets_[static_cast<std::size_t>(x)], 3);
+            }
+        }
+    }
+}
+
+std::pair<int, int> ResamplePlan::sourceRows(int y) const {
+    const int first = rows_[static_cast<std::size_t>(y)];
+    const int lastRow = source_.height - 1;
+    return {std::clamp(first, 0, lastRow), std::clamp(first + 1, 0, lastRow)};
+}
+
+void ResamplePlan::resampleRow(const std::uint8_t* in, std::int16_t* out) const {
+    const std::size_t samples = offsets_.size();
+    PixelKernels::resampleRowLocal(in, windows_.data(), columnWeights_.data(), shuffles_.data(), localCount_, out);
+    PixelKernels::resampleRow(in, offsets_.data() + localCount_, columnWeights_.data() + 2 * localCount_, step_,
+                              samples - localCount_, gatherSafe_ > localCount_ ? gatherSafe_ - localCount_ : 0,
+                              out + localCount_);
+}
+
+void ResamplePlan::blendRow(int y, const std::int16_t* top, const std::int16_t* bottom, std::uint8_t* out) const {
+    const std::size_t samples = offsets_.size();
+    PixelKernels::blendRows(top, bottom, rowWeights_[2 * static_cast<std::size_t>(y)],
+                            rowWeights_[2 * static_cast<std::size_t>(y) + 1], samples, out);
+    if (!halving_) {
+        return;
+    }
+    // Blocks cut short by an odd side hold 2 pixels (or 1 in the corner, which the
+    // blend already gets right); cv::resize rounds their average half to even where
+    // the blend rounds up. Horizontal samples there are exact: 128 * pixel, or
+    // 64 * the sum of two pixels.
+    const std::size_t full = partialColumn_ ? samples - static_cast<std::size_t>(channels_) : samples;
+    if (partialRow_ && y == destination_.height - 1) {
+        for (std::size_t i = 0; i < full; ++i) {
+            out[i] = halfEven(top[i] >> 6);
+        }
+    } else if (partialColumn_) {
+        for (std::size_t i = full; i < samples; ++i) {
+            out[i] = halfEven((top[i] + bottom[i]) >> 7);
+        }
+    }
+}
+
+std::pair<int, int> ResamplePlan::columnTaps(int x) const {
+    const int first = offsets_[static_cast<std::size_t>(x) * static_cast<std::size_t>(channels_)] / channels_;
+    return {first, step_ > 0 ? first + 1 : first};
+}
+
+std::int16_t ResamplePlan::resampleSample(std::size_t i, std::uint8_t first, std::uint8_t second) const {
+    return static_cast<std::int16_t>((first * columnWeights_[2 * i] + second * columnWeights_[2 * i + 1]) >> 4);
+}
+
+std::uint8_t ResamplePlan::blendSample(int y, std::size_t i, std::int16_t top, std::int16_t bottom) const {
+    // blendRow for one sample, with the same halving fix-up
+    const std::size_t samples = offsets_.size();
+    const bool lastColumn = partialColumn_ && i >= samples - static_cast<std::size_t>(channels_);
+    if (partialRow_ && y == destination_.height - 1) {
+        if (!lastColumn) {
+            return halfEven(top >> 6);
+        }
+    } else if (lastColumn) {
+        return halfEven((top + bottom) >> 7);
+    }
+    std::uint8_t out = 0;
+    PixelKernels::blendRows(&top, &bottom, rowWeights_[2 * static_cast<std::size_t>(y)],
+                            rowWeights_[2 * static_cast<std::size_t>(y) + 1], 1, &out);
+    return out;
+}
+
+void ResamplePlan::executeRows(const cv::Mat& source, cv::Mat& destination, int begin, int end,
+                               std::int16_t* scratch) const {
+    // two horizontally resampled source rows are held; an output row reuses them
+    // whenever it reads the same source rows as the previous one
+    const std::size_t samples = offsets_.size();
+    std::int16_t* slots[2] = {scratch, scratch + samples};
+    int held[2] = {-1, -1};
+    const auto fetch = [&](int row, int keep) {
+        for (int slot = 0; slot < 2; ++slot) {
+            if (held[slot] == row) {
+                return slots[slot];
+            }
+        }
+        const int slot = held[0] == keep ? 1 : 0;
+        resampleRow(source.ptr<std::uint8_t>(row), slots[slot]);
+        held[slot] = row;
+        return slots[slot];
+    };
+
+    for (int y = begin; y < end; ++y) {
+        const auto [upper, lower] = sourceRows(y);
+        const std::int16_t* top = fetch(upper, lower);
+        const std::int16_t* bottom = fetch(lower, upper);
+        blendRow(y, top, bottom, destination.ptr<std::uint8_t>(y));
+    }
+}
+
+ResamplePlanCache::ResamplePlanCache(std::size_t capacity) : capacity_(std::max<std::size_t>(capacity, 1)) {}
+
+ResamplePlanCache& ResamplePlanCache::shared() {
+    // batches see few distinct geometries; this comfortably holds them
+    static ResamplePlanCache cache(64);
+    return cache;
+}
+
+std::shared_ptr<const ResamplePlan> ResamplePlanCache::plan(cv::Size source, double scale, int interpolation, int channels) {
+    const cv::Size destination(scaledLength(source.width, scale), scaledLength(source.height, scale));
+    const Key key{source.width, source.height, scale, destination.width, destination.height, interpolation, channels};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto found = plans_.find(key);
+        if (found != plans_.end()) {
+            found->second.lastUse = ++clock_;
+            ++stats_.hits;
+            return found->second.plan;
+        }
+        ++stats_.misses;
+    }
+
+    // built outside the lock; if two threads race, both plans are equal and either may be kept
+    auto built = std::make_shared<const ResamplePlan>(source, scale, interpolation, channels);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (plans_.size() >= capacity_ && plans_.find(key) == plans_.end()) {
+        const auto oldest = std::min_element(plans_.begin(), plans_.end(), [](const auto& a, const auto& b) {
+            return a.second.lastUse < b.second.lastUse;
+        });
+        plans_.erase(oldest);
+    }
+    Entry& entry = plans_[key];
+    entry.plan = built;
+    entry.lastUse = ++clock_;
+    return built;
+}
+
+ResamplePlanCache::Stats ResamplePlanCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void ResamplePlanCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    plans_.clear();
+}
+
+} // namespace ImageOps
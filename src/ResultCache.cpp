@@ -0,0 +1,272 @@
+#include "ResultCache.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kEntrySuffix[] = ".bin";
+constexpr char kTemporaryMarker[] = ".bin.tmp.";
+// a store copies one file, so a temporary this old was left by an interrupted process
+constexpr auto kStaleTemporaryAge = std::chrono::hours(1);
+
+std::string toHex(std::uint64_t value) {
+    char buffer[17];
+    std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+    return buffer;
+}
+
+// files are hashed in blocks of this size, so a key costs no more memory for a gigapixel input
+constexpr std::size_t kHashBlockSize = std::size_t{1} << 20;
+
+// Incremental 128-bit hash of a byte stream: two MurmurHash64A-style lanes with
+// different multipliers consume the same 8-byte words. Bytes that do not fill a
+// word are carried to the next update; the total length is folded in at the end.
+class StreamingHash {
+public:
+    void update(const char* data, std::size_t size) {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(data);
+        size_ += size;
+        while (size > 0 && pendingSize_ > 0) {
+            pending_[pendingSize_++] = *bytes++;
+            --size;
+            if (pendingSize_ == 8) {
+                mixWord(pending_);
+                pendingSize_ = 0;
+            }
+        }
+        for (; size >= 8; bytes += 8, size -= 8) {
+            mixWord(bytes);
+        }
+        std::memcpy(pending_, bytes, size);
+        pendingSize_ = size;
+    }
+
+    std::pair<std::uint64_t, std::uint64_t> finish() {
+        std::uint64_t tail = 0;
+        for (std::size_t i = pendingSize_; i > 0; --i) {
+            tail |= static_cast<std::uint64_t>(pending_[i - 1]) << (8 * (i - 1));
+        }
+        std::uint64_t low = low_ ^ tail ^ (size_ * kLowMul);
+        std::uint64_t high = high_ ^ tail ^ (size_ * kHighMul);
+        low = finalize(low * kLowMul, kLowMul);
+        high = finalize(high * kHighMul, kHighMul);
+        // let each half depend on both lanes
+        low += high;
+        high += low;
+        return {low, high};
+    }
+
+private:
+    static constexpr std::uint64_t kLowMul = 0xc6a4a7935bd1e995ULL;
+    static constexpr std::uint64_t kHighMul = 0x87c37b91114253d5ULL;
+    static constexpr int kShift = 47;
+
+    static std::uint64_t finalize(std::uint64_t hash, std::uint64_t mul) {
+        hash ^= hash >> kShift;
+        hash *= mul;
+        hash ^= hash >> kShift;
+        return hash;
+    }
+
+    void mixWord(const unsigned char* word) {
+        std::uint64_t k = 0;
+        std::memcpy(&k, word, sizeof(k));
+        low_ ^= finalize(k * kLowMul, kLowMul);
+        low_ *= kLowMul;
+        high_ ^= finalize(k * kHighMul, kHighMul);
+        high_ *= kHighMul;
+    }
+
+    std::uint64_t low_ = 0x0123456789abcdefULL;
+    std::uint64_t high_ = 0xfedcba9876543210ULL;
+    std::uint64_t size_ = 0;
+    unsigned char pending_[8] = {};
+    std::size_t pendingSize_ = 0;
+};
+
+std::string uniqueSuffix() {
+    // temporary file names must not collide between processes sharing the cache
+    static std::mt19937_64 engine{std::random_device{}()};
+    return toHex(engine());
+}
+
+} // namespace
+
+ResultCache::ResultCache(std::string directory, std::uint64_t maxBytes)
+    : directory_(std::move(directory)), maxBytes_(maxBytes) {
+    std::error_code ec;
+    fs::create_directories(directory_, ec);
+    if (ec) {
+        throw std::runtime_error("无法创建缓存目录: " + directory_);
+    }
+}
+
+std::uint64_t ResultCache::hashBytes(const void* data, std::size_t size, std::uint64_t seed) {
+    // MurmurHash64A: 8 bytes per step, good enough to address cache entries
+    constexpr std::uint64_t kMul = 0xc6a4a7935bd1e995ULL;
+    constexpr int kShift = 47;
+
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    std::uint64_t hash = seed ^ (static_cast<std::uint64_t>(size) * kMul);
+
+    const std::size_t blocks = size / 8;
+    for (std::size_t i = 0; i < blocks; ++i) {
+        std::uint64_t k = 0;
+        std::memcpy(&k, bytes + i * 8, sizeof(k));
+        k *= kMul;
+        k ^= k >> kShift;
+        k *= kMul;
+        hash ^= k;
+        hash *= kMul;
+    }
+
+    const unsigned char* tail = bytes + blocks * 8;
+    const std::size_t rest = size & 7U;
+    if (rest > 0) {
+        for (std::size_t i = rest; i > 0; --i) {
+            hash ^= static_cast<std::uint64_t>(tail[i - 1]) << (8 * (i - 1));
+        }
+        hash *= kMul;
+    }
+
+    hash ^= hash >> kShift;
+    hash *= kMul;
+    hash ^= hash >> kShift;
+    return hash;
+}
+
+std::string ResultCache::makeKey(const std::string& inputPath, const std::string& recipe) const {
+    std::ifstream ifs(inputPath, std::ios::binary);
+    if (!ifs) {
+        throw std::runtime_error("无法打开文件: " + inputPath);
+    }
+
+    // one pass over fixed-size blocks; the input is never held in memory as a whole
+    StreamingHash inputHash;
+    std::vector<char> block(kHashBlockSize);
+    while (ifs) {
+        ifs.read(block.data(), static_cast<std::streamsize>(block.size()));
+        inputHash.update(block.data(), static_cast<std::size_t>(ifs.gcount()));
+    }
+    if (ifs.bad()) {
+        throw std::runtime_error("无法读取文件: " + inputPath);
+    }
+
+    const auto [inputLow, inputHigh] = inputHash.finish();
+    const std::uint64_t low = hashBytes(recipe.data(), recipe.size(), inputLow);
+    const std::uint64_t high = hashBytes(recipe.data(), recipe.size(), inputHigh);
+    return toHex(high) + toHex(low);
+}
+
+std::string ResultCache::entryPath(const std::string& key) const {
+    return (fs::path(directory_) / (key + kEntrySuffix)).string();
+}
+
+bool ResultCache::fetch(const std::string& key, const std::string& outputPath) {
+    const std::string entry = entryPath(key);
+    std::error_code ec;
+    if (!fs::is_regular_file(entry, ec)) {
+        ++stats_.misses;
+        return false;
+    }
+
+    // another process may evict the entry at any time; treat that as a miss
+    fs::copy_file(entry, outputPath, fs::copy_options::overwrite_existing, ec);
+    if (ec) {
+        ++stats_.misses;
+        return false;
+    }
+
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);   // LRU touch
+    ++stats_.hits;
+    return true;
+}
+
+void ResultCache::store(const std::string& key, const std::string& producedPath) {
+    const std::string entry = entryPath(key);
+    const std::string temporary = entry + ".tmp." + uniqueSuffix();
+
+    std::error_code ec;
+    fs::copy_file(producedPath, temporary, fs::copy_options::overwrite_existing, ec);
+    if (ec) {
+        fs::remove(temporary, ec);
+        throw std::runtime_error("无法写入缓存条目: " + temporary);
+    }
+    fs::rename(temporary, entry, ec);
+    if (ec) {
+        fs::remove(temporary, ec);
+        throw std::runtime_error("无法发布缓存条目: " + entry);
+    }
+    ++stats_.stores;
+
+    evict();
+}
+
+void ResultCache::evict() {
+    struct Entry {
+        fs::path path;
+        std::uint64_t size = 0;
+        fs::file_time_type lastUse;
+    };
+
+    std::vector<Entry> entries;
+    std::uint64_t totalBytes = 0;
+    const auto staleBefore = fs::file_time_type::clock::now() - kStaleTemporaryAge;
+    std::error_code ec;
+    for (fs::directory_iterator it(directory_, ec), end; !ec && it != end; it.increment(ec)) {
+        const fs::path& path = it->path();
+        const bool temporary = path.filename().string().find(kTemporaryMarker) != std::string::npos;
+        if (!temporary && path.extension() != kEntrySuffix) {
+            continue;
+        }
+        std::error_code entryError;
+        const auto size = it->file_size(entryError);
+        const auto lastUse = it->last_write_time(entryError);
+        if (entryError) {
+            continue;   // removed by a concurrent eviction
+        }
+        if (temporary) {
+            // temporaries of running stores count against the limit; abandoned ones are swept
+            if (lastUse < staleBefore && fs::remove(path, entryError)) {
+                ++stats_.evictions;
+            } else {
+                totalBytes += size;
+            }
+            continue;
+        }
+        entries.push_back({path, static_cast<std::uint64_t>(size), lastUse});
+        totalBytes += size;
+    }
+
+    if (totalBytes <= maxBytes_) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs) {
+        return lhs.lastUse < rhs.lastUse;
+    });
+
+    for (const Entry& entry : entries) {
+        if (totalBytes <= maxBytes_) {
+            break;
+        }
+        std::error_code removeError;
+        if (fs::remove(entry.path, removeError)) {
+            ++stats_.evictions;
+        }
+        totalBytes -= entry.size;
+    }
+}
@@ -0,0 +1,79 @@
+#include "SparseImage.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+SparseImage::SparseImage(int rows, int cols, int channels, std::vector<Triple> triples)
+    : rows_(rows), cols_(cols), channels_(channels), triples_(std::move(triples)) {
+    if (rows <= 0 || cols <= 0) {
+        throw std::runtime_error("稀疏图像的尺寸非法");
+    }
+    if (channels != 1 && channels != 3) {
+        throw std::runtime_error("稀疏图像仅支持单通道或三通道");
+    }
+
+    // row offsets, checking the triples are in range and strictly row-major
+    rowStarts_.assign(static_cast<std::size_t>(rows) + 1, 0);
+    int lastRow = 0;
+    int lastCol = -1;
+    for (std::size_t i = 0; i < triples_.size(); ++i) {
+        const Triple& triple = triples_[i];
+        if (triple.row < 0 || triple.row >= rows || triple.col < 0 || triple.col >= cols || triple.channels != channels) {
+            throw std::runtime_error("稀疏图像的三元组超出图像范围");
+        }
+        if (triple.row < lastRow || (triple.row == lastRow && triple.col <= lastCol)) {
+            throw std::runtime_error("稀疏图像的三元组必须按行优先顺序排列且不重复");
+        }
+        while (lastRow < triple.row) {
+            rowStarts_[static_cast<std::size_t>(++lastRow)] = i;
+        }
+        lastCol = triple.col;
+    }
+    while (lastRow < rows) {
+        rowStarts_[static_cast<std::size_t>(++lastRow)] = triples_.size();
+    }
+}
+
+SparseImage SparseImage::fromDense(const cv::Mat& image) {
+    return SparseImage(image.rows, image.cols, image.channels(), ImageLoader::toTriples(image));
+}
+
+std::optional<SparseImage> SparseImage::fromDenseIfSparse(const cv::Mat& image, double maxDensity) {
+    if (image.empty() || image.depth() != CV_8U || (image.channels() != 1 && image.channels() != 3)) {
+        return std::nullopt;
+    }
+    // fewer than limit non-zero pixels means at most ceil(limit) - 1
+    const double limit = std::ceil(maxDensity * static_cast<double>(image.total()));
+    if (limit < 1.0) {
+        return std::nullopt;
+    }
+    auto triples = ImageLoader::toTriples(image, static_cast<std::size_t>(limit) - 1);
+    if (!triples) {
+        return std::nullopt;
+    }
+    return SparseImage(image.rows, image.cols, image.channels(), std::move(*triples));
+}
+
+double SparseImage::density() const {
+    return static_cast<double>(triples_.size()) / (static_cast<double>(rows_) * static_cast<double>(cols_));
+}
+
+const std::uint8_t* SparseImage::find(int row, int col) const {
+    const auto begin = triples_.begin() + static_cast<std::ptrdiff_t>(rowBegin(row));
+    const auto end = triples_.begin() + static_cast<std::ptrdiff_t>(rowBegin(row + 1));
+    const auto it = std::lower_bound(begin, end, col, [](const Triple& triple, int value) { return triple.col < value; });
+    return it != end && it->col == col ? it->value.data() : nullptr;
+}
+
+cv::Mat SparseImage::toDense() const {
+    cv::Mat image = cv::Mat::zeros(rows_, cols_, channels_ == 1 ? CV_8UC1 : CV_8UC3);
+    for (const Triple& triple : triples_) {
+        std::uint8_t* pixel = image.ptr<std::uint8_t>(triple.row) + static_cast<std::size_t>(triple.col) * channels_;
+        for (int ch = 0; ch < channels_; ++ch) {
+            pixel[ch] = triple.value[static_cast<std::size_t>(ch)];
+        }
+    }
+    return image;
+}
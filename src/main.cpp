@@ -1,18 +1,54 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "FileIO.hpp"
 #include "ImageLoader.hpp"
 #include "ImageOps.hpp"
+#include "ImagePack.hpp"
+#include "Resampler.hpp"
+#include "ResultCache.hpp"
+#include "SparseImage.hpp"
 
 namespace {
 
+namespace fs = std::filesystem;
+
+constexpr char kToolVersion[] = "imagick-1.1";  // part of every cache key
+constexpr std::uint64_t kDefaultCacheSizeMB = 1024;
+constexpr int kDefaultKeyframeInterval = 30;
+// -g / -r on inputs with at least this many pixels run row by row instead of in memory
+constexpr std::uint64_t kTiledPixelThreshold = std::uint64_t{1} << 28;
+// rows read at a time by the tiled path when no memory budget is given
+constexpr int kDefaultBandRows = 64;
+// larger bands read no faster, they only raise the peak
+constexpr std::uint64_t kMaxBandBytes = std::uint64_t{16} << 20;
+// part of a --max-memory budget kept for the program itself, libraries and stream buffers
+constexpr std::uint64_t kProcessReserveBytes = std::uint64_t{16} << 20;
+// -g / -r / -c pipelines run on the non-zero pixels only when fewer than this fraction of pixels are non-zero
+constexpr double kSparseDensityThreshold = 0.05;
+// files a directory batch keeps in flight in each direction
+constexpr unsigned kDefaultIoDepth = 16;
+constexpr unsigned kMaxIoDepth = 1024;
+
 enum class OperationType {
     Compress,
     Decompress,
@@ -31,19 +67,57 @@ struct CLIConfig {
     std::string inputPath;
     std::string outputPath;
     std::vector<Operation> operations;
+    std::string cacheDirectory; // 留空表示不使用结果缓存
+    std::uint64_t cacheSizeMB = kDefaultCacheSizeMB;
+    bool profile = false;
+    int nearLossless = 0;   // -c 的最大逐像素误差，0 表示无损
+    CompressionLevel level = CompressionLevel::Default; // -c 的压缩级别
+    bool verify = false;
+    bool sequence = false;  // -c 读取输入中的全部帧并写出 HFS 序列
+    int keyframeInterval = kDefaultKeyframeInterval;
+    bool keyframeGiven = false;
+    std::string frameRange; // -x 解码的帧范围，留空表示全部
+    std::string dictionaryPath; // -c / -x 使用的共享哈夫曼字典，留空表示不使用
+    bool trainDictionary = false;   // 从输入目录中的样本训练字典
+    std::uint64_t maxMemoryMB = 0;  // 图像数据的内存预算，0 表示不限制
+    unsigned ioDepth = kDefaultIoDepth; // 目录批处理同时在途的读/写文件数
+    std::string ioBackend = "auto";     // 目录批处理的 I/O 后端：auto、uring、pread 或 stream
+    bool ioOptionsGiven = false;
+    bool pack = false;      // 将输入目录中的 .hfm 文件打包为单个文件
+    bool list = false;      // 列出打包文件的成员
+    std::string member;     // -x 解压打包文件时只输出该成员，留空表示全部
 };
 
 void printUsage(std::ostream& os) {
     os << "用法: imagick [选项] <输入> <输出>\n"
        << "示例: imagick -g data/color-block.ppm out/gray.pgm\n"
-       << "      imagick -r 50 data/lena-512-gray.ppm out/lena-256.pgm\n\n"
+       << "      imagick -r 50 data/lena-512-gray.ppm out/lena-256.pgm\n"
+       << "      imagick -c data/ out/      (输入为目录时批量处理其中的每个文件)\n"
+       << "      imagick --pack thumbs/ thumbs.hfp && imagick -x --member cat thumbs.hfp cat.ppm\n\n"
        << "  -h, --help                     显示本帮助并退出\n"
        << "  -g, --grayscale                将图像转换为灰度\n"
        << "  -r, --resize <percentage>      依据百分比对长宽等比例缩放\n"
        << "  -c, --compress                 按默认格式压缩图像\n"
        << "  -x, --extract                  从压缩数据解码图像\n"
        << "  -t, --triples                  导出非零像素三元组\n"
-       << "  -s, --show                     在窗口中预览处理结果\n";
+       << "  -s, --show                     在窗口中预览处理结果\n"
+       << "      --near <n>                 近无损压缩，每个采样误差不超过 n（默认 0）\n"
+       << "      --level <name>             压缩级别: default 或 archive（上下文建模算术编码，更慢、更小）\n"
+       << "      --verify                   压缩后解码校验误差上限\n"
+       << "      --sequence                 将多帧 PPM 流压缩为帧间预测的序列文件\n"
+       << "      --keyframe <n>             序列的关键帧间隔（默认 30）\n"
+       << "      --frames <a>[-<b>]         解压序列时只输出第 a 到 b 帧（从 0 开始）\n"
+       << "      --train-dict               以输入目录中的 PPM/PGM 为样本训练共享哈夫曼字典\n"
+       << "      --dict <file>              压缩/解压时使用共享哈夫曼字典\n"
+       << "      --pack                     将输入目录中的 .hfm 文件打包为单个文件（成员名为文件名去掉扩展名）\n"
+       << "      --list                     列出打包文件中的成员\n"
+       << "      --member <name>            -x 解压打包文件时只输出该成员（默认全部输出到目录）\n"
+       << "      --max-memory <MB>          图像数据的内存上限，超出时 -g/-r 改为分块流式处理\n"
+       << "      --io-depth <n>             目录批处理预读与写回的队列深度（默认 16）\n"
+       << "      --io-backend <name>        目录批处理的 I/O 后端: auto、uring、pread、stream（默认 auto）\n"
+       << "      --cache-dir <dir>          复用缓存目录中相同输入与操作的结果\n"
+       << "      --cache-size <MB>          缓存目录容量上限（默认 1024）\n"
+       << "      --profile                  输出耗时与缓存命中统计\n";
 }
 
 bool operationRequiresArgument(OperationType type) {
@@ -115,6 +189,117 @@ double parseScalePercentage(const std::string& token) {
     return value / 100.0;
 }
 
+int parseNearLossless(const std::string& token) {
+    std::size_t parsed = 0;
+    int value = 0;
+    try {
+        value = std::stoi(token, &parsed);
+    } catch (const std::exception&) {
+        throw std::runtime_error("无法解析 NEAR 参数: " + token);
+    }
+    if (parsed != token.size() || value < 0 || value > 255) {
+        throw std::runtime_error("NEAR 参数必须为 0 到 255 之间的整数: " + token);
+    }
+    return value;
+}
+
+int parseKeyframeInterval(const std::string& token) {
+    std::size_t parsed = 0;
+    int value = 0;
+    try {
+        value = std::stoi(token, &parsed);
+    } catch (const std::exception&) {
+        throw std::runtime_error("无法解析关键帧间隔: " + token);
+    }
+    if (parsed != token.size() || value <= 0) {
+        throw std::runtime_error("关键帧间隔必须为正整数: " + token);
+    }
+    return value;
+}
+
+std::pair<int, int> parseFrameRange(const std::string& token) {
+    // "a" or "a-b", inclusive and zero-based; an empty token selects every frame
+    if (token.empty()) {
+        return {0, -1};
+    }
+    const std::size_t dash = token.find('-');
+    const std::string firstToken = token.substr(0, dash);
+    const std::string lastToken = dash == std::string::npos ? firstToken : token.substr(dash + 1);
+    int first = 0;
+    int last = 0;
+    std::size_t firstParsed = 0;
+    std::size_t lastParsed = 0;
+    try {
+        first = std::stoi(firstToken, &firstParsed);
+        last = std::stoi(lastToken, &lastParsed);
+    } catch (const std::exception&) {
+        throw std::runtime_error("无法解析帧范围: " + token);
+    }
+    if (firstParsed != firstToken.size() || lastParsed != lastToken.size() || first < 0 || last < first) {
+        throw std::runtime_error("帧范围格式应为 a 或 a-b (0 <= a <= b): " + token);
+    }
+    return {first, last};
+}
+
+std::uint64_t parseCacheSize(const std::string& token) {
+    std::size_t parsed = 0;
+    unsigned long long value = 0;
+    try {
+        value = std::stoull(token, &parsed);
+    } catch (const std::exception&) {
+        throw std::runtime_error("无法解析缓存容量: " + token);
+    }
+    if (parsed != token.size() || value == 0) {
+        throw std::runtime_error("缓存容量必须为正整数 (MB): " + token);
+    }
+    return static_cast<std::uint64_t>(value);
+}
+
+std::uint64_t parseMemoryBudget(const std::string& token) {
+    std::size_t parsed = 0;
+    unsigned long long value = 0;
+    try {
+        value = std::stoull(token, &parsed);
+    } catch (const std::exception&) {
+        throw std::runtime_error("无法解析内存上限: " + token);
+    }
+    if (parsed != token.size() || value == 0 || value > (std::numeric_limits<std::uint64_t>::max() >> 20)) {
+        throw std::runtime_error("内存上限必须为正整数 (MB): " + token);
+    }
+    return static_cast<std::uint64_t>(value);
+}
+
+unsigned parseIoDepth(const std::string& token) {
+    std::size_t parsed = 0;
+    unsigned long value = 0;
+    try {
+        value = std::stoul(token, &parsed);
+    } catch (const std::exception&) {
+        throw std::runtime_error("无法解析队列深度: " + token);
+    }
+    if (parsed != token.size() || value == 0 || value > kMaxIoDepth) {
+        throw std::runtime_error("队列深度必须位于 1 到 " + std::to_string(kMaxIoDepth) + " 之间: " + token);
+    }
+    return static_cast<unsigned>(value);
+}
+
+CompressionLevel parseCompressionLevel(const std::string& token) {
+    if (token == "default") {
+        return CompressionLevel::Default;
+    }
+    if (token == "archive") {
+        return CompressionLevel::Archive;
+    }
+    throw std::runtime_error("未知的压缩级别: " + token + "（可选 default、archive）");
+}
+
+std::string parseIoBackend(const std::string& token) {
+    if (token != "auto" && token != "uring" && token != "pread" && token != "stream") {
+        throw std::runtime_error("未知的 I/O 后端: " + token + "（可选 auto、uring、pread、stream）");
+    }
+    return token;
+}
+
 CLIConfig parseArguments(int argc, char** argv) {
     if (argc <= 1) {
         printUsage(std::cout);
@@ -132,6 +317,105 @@ CLIConfig parseArguments(int argc, char** argv) {
             std::exit(EXIT_SUCCESS);
         }
 
+        if (arg == "--near") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(arg + " 需要参数");
+            }
+            config.nearLossless = parseNearLossless(argv[++i]);
+            continue;
+        }
+        if (arg == "--level") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(arg + " 需要参数");
+            }
+            config.level = parseCompressionLevel(argv[++i]);
+            continue;
+        }
+        if (arg == "--verify") {
+            config.verify = true;
+            continue;
+        }
+        if (arg == "--max-memory") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(arg + " 需要参数");
+            }
+            config.maxMemoryMB = parseMemoryBudget(argv[++i]);
+            continue;
+        }
+        if (arg == "--io-depth" || arg == "--io-backend") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(arg + " 需要参数");
+            }
+            const std::string value = argv[++i];
+            if (arg == "--io-depth") {
+                config.ioDepth = parseIoDepth(value);
+            } else {
+                config.ioBackend = parseIoBackend(value);
+            }
+            config.ioOptionsGiven = true;
+            continue;
+        }
+        if (arg == "--train-dict") {
+            config.trainDictionary = true;
+            continue;
+        }
+        if (arg == "--dict") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(arg + " 需要参数");
+            }
+            config.dictionaryPath = argv[++i];
+            continue;
+        }
+        if (arg == "--pack") {
+            config.pack = true;
+            continue;
+        }
+        if (arg == "--list") {
+            config.list = true;
+            continue;
+        }
+        if (arg == "--member") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(arg + " 需要参数");
+            }
+            config.member = argv[++i];
+            continue;
+        }
+        if (arg == "--sequence") {
+            config.sequence = true;
+            continue;
+        }
+        if (arg == "--keyframe" || arg == "--frames") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(arg + " 需要参数");
+            }
+            const std::string value = argv[++i];
+            if (arg == "--keyframe") {
+                config.keyframeInterval = parseKeyframeInterval(value);
+                config.keyframeGiven = true;
+            } else {
+                parseFrameRange(value);
+                config.frameRange = value;
+            }
+            continue;
+        }
+        if (arg == "--cache-dir" || arg == "--cache-size") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(arg + " 需要参数");
+            }
+            const std::string value = argv[++i];
+            if (arg == "--cache-dir") {
+                config.cacheDirectory = value;
+            } else {
+                config.cacheSizeMB = parseCacheSize(value);
+            }
+            continue;
+        }
+        if (arg == "--profile") {
+            config.profile = true;
+            continue;
+        }
+
         if (!arg.empty() && arg[0] == '-') {
             OperationType type = parseOperationToken(arg);
             std::string parameter;
@@ -177,13 +461,7 @@ void showImage(const cv::Mat& image, const std::string& windowTitle) {
     cv::destroyWindow(windowTitle);
 }
 
-cv::Mat runOperations(const std::string& inputPath, const std::vector<Operation>& operations, int& maxValue, bool& preferBinaryColor) {
-    ImageData data = ImageLoader::load(inputPath);
-    maxValue = data.maxValue;
-    preferBinaryColor = data.magic == "P6";
-
-    cv::Mat current = data.image.clone();
-
+cv::Mat applyOperations(cv::Mat current, const std::vector<Operation>& operations) {
     for (const Operation& op : operations) {
         switch (op.type) {
         case OperationType::Grayscale:
@@ -203,89 +481,807 @@ cv::Mat runOperations(const std::string& inputPath, const std::vector<Operation>
             throw std::logic_error("压缩和解压操作应在主函数中处理");
         }
     }
+    return current;
+}
 
-    preferBinaryColor = (current.depth() == CV_8U && current.channels() == 3);
+SparseImage applySparseOperations(SparseImage current, const std::vector<Operation>& operations) {
+    for (const Operation& op : operations) {
+        switch (op.type) {
+        case OperationType::Grayscale:
+            current = ImageOps::toGrayscale(current);
+            break;
+        case OperationType::ScalePercent:
+            current = ImageOps::scaleByPercentage(current, parseScalePercentage(op.parameter));
+            break;
+        case OperationType::Show:
+        case OperationType::Compress:
+        case OperationType::Decompress:
+        case OperationType::DumpTriples:
+            throw std::logic_error("稀疏路径仅处理 -g 与 -r");
+        }
+    }
     return current;
 }
 
-} // namespace
+class FileRows : public ImageOps::RowSource {
+public:
+    // rows are read bandRows at a time; each band is a fresh matrix, so rows
+    // still held by later stages stay valid after the next band is read
+    FileRows(const std::string& path, int bandRows) : reader_(path), bandRows_(bandRows) {}
 
-int main(int argc, char** argv) {
-    try {
-        const CLIConfig config = parseArguments(argc, argv);
-        
-        bool hasDecompress = false;
-        bool hasTripleDump = false;
-        bool hasShow = false;
-        for (const auto& op : config.operations) {
-            hasDecompress |= (op.type == OperationType::Decompress);
-            hasTripleDump |= (op.type == OperationType::DumpTriples);
-            hasShow |= (op.type == OperationType::Show);
+    const ImageData& header() const { return reader_.header(); }
+    int rows() const override { return reader_.header().height; }
+    int cols() const override { return reader_.header().width; }
+    int channels() const override { return reader_.channels(); }
+
+    void nextRow(cv::Mat& row) override {
+        if (nextInBand_ == band_.rows) {
+            band_.release();
+            reader_.readRows(band_, std::min(bandRows_, rows() - rowsRead_));
+            rowsRead_ += band_.rows;
+            nextInBand_ = 0;
         }
-        
-        if (hasDecompress) {
-            for (std::size_t i = 0; i < config.operations.size(); ++i) {
-                const auto type = config.operations[i].type;
-                if (type == OperationType::Show) {
-                    if (i + 1 != config.operations.size()) {
-                        throw std::runtime_error("-s 必须位于操作序列末尾");
-                    }
-                    continue;
+        row = band_.row(nextInBand_++);
+    }
+
+private:
+    ImageReader reader_;
+    int bandRows_ = 1;
+    cv::Mat band_;
+    int nextInBand_ = 0;
+    int rowsRead_ = 0;
+};
+
+struct MemoryPlan {
+    std::uint64_t inMemoryBytes = 0;    // whole-image pipeline: input plus one intermediate
+    std::uint64_t streamRowBytes = 0;   // tiled pipeline, without the input bands
+    std::uint64_t inputRowBytes = 0;
+    std::uint64_t inputPixels = 0;
+    bool streamable = true;             // only -g and -r have row-streaming versions
+};
+
+MemoryPlan planMemory(const std::string& inputPath, const std::vector<Operation>& operations) {
+    // image-data footprint of both ways of running the operations
+    const ImageReader reader(inputPath);
+    const ImageData& header = reader.header();
+    std::uint64_t rows = static_cast<std::uint64_t>(header.height);
+    std::uint64_t cols = static_cast<std::uint64_t>(header.width);
+    std::uint64_t channels = static_cast<std::uint64_t>(reader.channels());
+
+    MemoryPlan plan;
+    plan.inputRowBytes = cols * channels;
+    plan.inputPixels = rows * cols;
+    std::uint64_t current = rows * cols * channels;
+    plan.inMemoryBytes = current;
+    if (header.magic != "P6") {
+        // ASCII bodies are parsed from memory
+        plan.inMemoryBytes += static_cast<std::uint64_t>(fs::file_size(inputPath));
+    }
+    for (const Operation& op : operations) {
+        switch (op.type) {
+        case OperationType::Grayscale:
+            channels = 1;
+            plan.streamRowBytes += cols * 3;    // the grey row and its colour input
+            break;
+        case OperationType::ScalePercent: {
+            const double factor = parseScalePercentage(op.parameter);
+            plan.streamRowBytes += cols * channels * 2;     // the two source rows around each output row
+            rows = static_cast<std::uint64_t>(std::max(1.0, std::round(static_cast<double>(rows) * factor)));
+            cols = static_cast<std::uint64_t>(std::max(1.0, std::round(static_cast<double>(cols) * factor)));
+            // the output row, two 16-bit horizontal passes, and the resample plan's
+            // taps (8 bytes per output sample and per output row)
+            plan.streamRowBytes += cols * channels * (1 + 4 + 8) + rows * 8;
+            break;
+        }
+        case OperationType::Compress:
+            // residual planes plus their coded payloads, which never exceed the residuals
+            plan.streamable = false;
+            plan.inMemoryBytes = std::max(plan.inMemoryBytes, current * 3);
+            continue;
+        default:
+            plan.streamable = false;
+            break;
+        }
+        const std::uint64_t next = rows * cols * channels;
+        plan.inMemoryBytes = std::max(plan.inMemoryBytes, current + next);
+        current = next;
+    }
+    return plan;
+}
+
+int chooseBandRows(const MemoryPlan& plan, std::uint64_t budgetBytes) {
+    // rows per input band for the tiled pipeline; 0 keeps the whole-image pipeline
+    if (budgetBytes == 0) {
+        return plan.streamable && plan.inputPixels >= kTiledPixelThreshold ? kDefaultBandRows : 0;
+    }
+    if (budgetBytes <= kProcessReserveBytes) {
+        throw std::runtime_error("内存上限过小，至少需要 " + std::to_string((kProcessReserveBytes >> 20) + 1) + " MB");
+    }
+    budgetBytes -= kProcessReserveBytes;
+    if (plan.inMemoryBytes <= budgetBytes) {
+        return 0;
+    }
+    if (!plan.streamable) {
+        throw std::runtime_error("整幅处理约需 " + std::to_string(((plan.inMemoryBytes + kProcessReserveBytes) >> 20) + 1) +
+                                 " MB 内存，超出 --max-memory 上限；只有 -g、-r 组成的操作序列可以分块处理");
+    }
+    // a stage may still hold a row of the previous band while the next one is read
+    const std::uint64_t bandBytes = 2 * plan.inputRowBytes;
+    if (budgetBytes < plan.streamRowBytes + bandBytes) {
+        throw std::runtime_error("内存上限过小，分块处理此图像至少需要 " +
+                                 std::to_string(((plan.streamRowBytes + bandBytes + kProcessReserveBytes) >> 20) + 1) + " MB");
+    }
+    const std::uint64_t bandRows = std::min((budgetBytes - plan.streamRowBytes) / bandBytes,
+                                            std::max<std::uint64_t>(1, kMaxBandBytes / plan.inputRowBytes));
+    return static_cast<int>(std::min<std::uint64_t>(bandRows, std::numeric_limits<int>::max()));
+}
+
+void runTiledOperations(const std::string& inputPath, const std::string& outputPath, const std::vector<Operation>& operations,
+                        int bandRows) {
+    auto input = std::make_unique<FileRows>(inputPath, bandRows);
+    const int maxValue = input->header().maxValue;
+    std::unique_ptr<ImageOps::RowSource> current = std::move(input);
+    for (const Operation& op : operations) {
+        if (op.type == OperationType::Grayscale) {
+            current = ImageOps::grayscaleRows(std::move(current));
+        } else {
+            current = ImageOps::scaleRowsByPercentage(std::move(current), parseScalePercentage(op.parameter));
+        }
+    }
+
+    ImageWriter writer(outputPath, current->cols(), current->rows(), current->channels(), maxValue, true);
+    cv::Mat row;
+    for (int y = 0; y < current->rows(); ++y) {
+        current->nextRow(row);
+        writer.writeRow(row);
+    }
+    writer.finish();
+}
+
+std::string buildRecipe(const CLIConfig& config) {
+    // normalized operation list: aliases and percentage spellings map to one key
+    std::ostringstream oss;
+    oss << kToolVersion << ";near=" << config.nearLossless;
+    if (config.level == CompressionLevel::Archive) {
+        oss << ";level=archive";
+    }
+    if (config.sequence) {
+        oss << ";sequence=" << config.keyframeInterval;
+    }
+    if (config.verify) {
+        // a hit skips the work, so only entries produced by a verified run may answer
+        oss << ";verify";
+    }
+    if (config.maxMemoryMB > 0) {
+        // the budget decides between the whole-image and the tiled pipeline
+        oss << ";mem=" << config.maxMemoryMB;
+    }
+    if (!config.frameRange.empty()) {
+        const auto range = parseFrameRange(config.frameRange);
+        oss << ";frames=" << range.first << '-' << range.second;
+    }
+    if (!config.dictionaryPath.empty()) {
+        oss << ";dict=" << HuffmanDictionary::load(config.dictionaryPath)->id();
+    }
+    for (const Operation& op : config.operations) {
+        switch (op.type) {
+        case OperationType::Compress:
+            oss << ";c";
+            break;
+        case OperationType::Decompress:
+            oss << ";x";
+            break;
+        case OperationType::Grayscale:
+            oss << ";g";
+            break;
+        case OperationType::ScalePercent:
+            oss.precision(17);
+            oss << ";r=" << parseScalePercentage(op.parameter);
+            break;
+        case OperationType::DumpTriples:
+            oss << ";t";
+            break;
+        case OperationType::Show:
+            oss << ";s";
+            break;
+        }
+    }
+    return oss.str();
+}
+
+void printProfile(std::ostream& os, double elapsedMs, const ResultCache* cache) {
+    os << "[profile] 总耗时: " << elapsedMs << " ms\n";
+    if (cache) {
+        const auto& stats = cache->stats();
+        os << "[profile] 缓存命中: " << stats.hits << ", 未命中: " << stats.misses
+           << ", 写入: " << stats.stores << ", 淘汰: " << stats.evictions << '\n';
+    }
+    const auto plans = ImageOps::ResamplePlanCache::shared().stats();
+    if (plans.hits + plans.misses > 0) {
+        os << "[profile] 缩放计划缓存命中: " << plans.hits << ", 未命中: " << plans.misses << '\n';
+    }
+}
+
+const char* codingName(ChannelCoding coding) {
+    switch (coding) {
+    case ChannelCoding::Stored:
+        return "stored";
+    case ChannelCoding::RunLength:
+        return "run-length";
+    case ChannelCoding::Huffman:
+        return "huffman";
+    case ChannelCoding::Dictionary:
+        return "dictionary";
+    }
+    return "unknown";
+}
+
+void printCompressionSummary(std::ostream& os, const CompressionSummary& summary) {
+    if (summary.nearLossless > 0) {
+        os << "[profile] 近无损: NEAR=" << summary.nearLossless << '\n';
+    }
+    if (summary.archive) {
+        os << "[profile] 归档级别: 上下文建模算术编码, " << summary.payloadBytes[0] << " 字节\n";
+        return;
+    }
+    if (summary.paletteSize > 0) {
+        os << "[profile] 调色板模式: " << summary.paletteSize << " 色\n";
+    }
+    for (int ch = 0; ch < summary.channels; ++ch) {
+        const auto index = static_cast<std::size_t>(ch);
+        os << "[profile] 通道 " << ch << ": " << codingName(summary.coding[index])
+           << ", " << summary.payloadBytes[index] << " 字节\n";
+    }
+}
+
+void verifyCompressed(const std::string& path, const cv::Mat& original, int nearLossless, const HuffmanDictionary* dictionary) {
+    // decode the written file again and check the per-sample error bound
+    const ImageData decoded = ImageLoader::decompress(path, dictionary);
+    if (decoded.image.size() != original.size() || decoded.image.type() != original.type()) {
+        throw std::runtime_error("校验失败: 解码图像的尺寸或类型不一致");
+    }
+    int maxError = 0;
+    const int samplesPerRow = original.cols * original.channels();
+    for (int row = 0; row < original.rows; ++row) {
+        const auto* expected = original.ptr<std::uint8_t>(row);
+        const auto* actual = decoded.image.ptr<std::uint8_t>(row);
+        for (int i = 0; i < samplesPerRow; ++i) {
+            maxError = std::max(maxError, std::abs(static_cast<int>(expected[i]) - static_cast<int>(actual[i])));
+        }
+    }
+    if (maxError > nearLossless) {
+        throw std::runtime_error("校验失败: 最大误差 " + std::to_string(maxError) + " 超过 NEAR=" + std::to_string(nearLossless));
+    }
+    std::cout << "校验通过，最大误差 " << maxError << " (NEAR=" << nearLossless << ")" << std::endl;
+}
+
+double framesPerSecond(std::size_t frames, std::chrono::steady_clock::duration elapsed) {
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    return seconds > 0.0 ? static_cast<double>(frames) / seconds : 0.0;
+}
+
+void compressSequence(const CLIConfig& config) {
+    const std::vector<ImageData> frames = ImageLoader::loadFrames(config.inputPath);
+    SequenceOptions options;
+    options.keyframeInterval = config.keyframeInterval;
+
+    const auto start = std::chrono::steady_clock::now();
+    const SequenceSummary summary = ImageLoader::compressSequence(config.outputPath, frames, options);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const double ratio = summary.compressedBytes > 0
+                             ? static_cast<double>(summary.rawBytes) / static_cast<double>(summary.compressedBytes)
+                             : 0.0;
+    std::cout << "序列压缩完成，已写入: " << config.outputPath << '\n'
+              << "  " << summary.frames << " 帧 (" << summary.keyframes << " 个关键帧), 压缩率 " << ratio
+              << ", 编码 " << framesPerSecond(frames.size(), elapsed) << " fps" << std::endl;
+
+    if (config.verify) {
+        const std::vector<ImageData> decoded = ImageLoader::decompressSequence(config.outputPath);
+        for (std::size_t i = 0; i < frames.size(); ++i) {
+            const cv::Mat& expected = frames[i].image;
+            const cv::Mat& actual = decoded[i].image;
+            const std::size_t rowBytes = static_cast<std::size_t>(expected.cols) * expected.elemSize();
+            for (int row = 0; row < expected.rows; ++row) {
+                if (std::memcmp(expected.ptr(row), actual.ptr(row), rowBytes) != 0) {
+                    throw std::runtime_error("校验失败: 第 " + std::to_string(i) + " 帧解码结果与原图不一致");
                 }
-                if (type != OperationType::Decompress) {
-                    throw std::runtime_error("解压模式下仅支持 -x 以及可选的 -s");
+            }
+        }
+        std::cout << "校验通过，" << frames.size() << " 帧均无损还原" << std::endl;
+    }
+}
+
+void decompressSequence(const CLIConfig& config) {
+    const auto range = parseFrameRange(config.frameRange);
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<ImageData> frames = ImageLoader::decompressSequence(config.inputPath, range.first, range.second);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    ImageLoader::saveFrames(config.outputPath, frames);
+    std::cout << "序列解压完成，结果已保存到: " << config.outputPath << '\n'
+              << "  " << frames.size() << " 帧, 解码 " << framesPerSecond(frames.size(), elapsed) << " fps" << std::endl;
+}
+
+void trainDictionary(const CLIConfig& config) {
+    // every PPM/PGM file directly inside the input directory is a sample, in name order
+    if (!fs::is_directory(config.inputPath)) {
+        throw std::runtime_error("--train-dict 的输入必须是样本目录: " + config.inputPath);
+    }
+    std::vector<std::string> samples;
+    for (const auto& entry : fs::directory_iterator(config.inputPath)) {
+        const std::string extension = entry.path().extension().string();
+        if (entry.is_regular_file() && (extension == ".ppm" || extension == ".pgm")) {
+            samples.push_back(entry.path().string());
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+
+    const HuffmanDictionary dictionary = HuffmanDictionary::train(samples);
+    dictionary.save(config.outputPath);
+    std::cout << "字典训练完成，样本 " << samples.size() << " 张，ID " << dictionary.id()
+              << "，已写入: " << config.outputPath << std::endl;
+}
+
+void packDirectory(const CLIConfig& config) {
+    // every .hfm file directly inside the input directory becomes a member named after its stem
+    if (!fs::is_directory(config.inputPath)) {
+        throw std::runtime_error("--pack 的输入必须是包含 .hfm 文件的目录: " + config.inputPath);
+    }
+    std::vector<std::string> inputs;
+    for (const auto& entry : fs::directory_iterator(config.inputPath)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".hfm") {
+            inputs.push_back(entry.path().string());
+        }
+    }
+    std::sort(inputs.begin(), inputs.end());
+
+    const auto start = std::chrono::steady_clock::now();
+    PackWriter writer(config.outputPath);
+    FileIO::BatchIO io(inputs, config.ioDepth);
+    std::vector<char> bytes;
+    for (const std::string& input : inputs) {
+        io.nextInput(bytes);
+        try {
+            writer.add(fs::path(input).stem().string(), bytes);
+        } catch (const std::exception& ex) {
+            throw std::runtime_error(input + ": " + ex.what());
+        }
+    }
+    writer.finish();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "打包完成，" << writer.size() << " 个文件已写入: " << config.outputPath << '\n'
+              << "  " << framesPerSecond(writer.size(), elapsed) << " 文件/秒" << std::endl;
+}
+
+void listPack(const CLIConfig& config) {
+    const ImagePack pack(config.inputPath);
+    std::uint64_t bytes = 0;
+    for (std::size_t i = 0; i < pack.size(); ++i) {
+        const PackEntry entry = pack.entry(i);
+        std::cout << entry.name << '\t' << entry.width << 'x' << entry.height << '\t' << entry.channels << " 通道\t"
+                  << entry.size << " 字节\n";
+        bytes += entry.size;
+    }
+    std::cout << "共 " << pack.size() << " 个成员，压缩数据 " << bytes << " 字节" << std::endl;
+}
+
+void extractPack(const CLIConfig& config, const HuffmanDictionary* dictionary) {
+    const ImagePack pack(config.inputPath);
+    DecompressionContext context;
+    const auto save = [](const std::string& path, const ImageData& data) {
+        ImageLoader::save(path, data.image, data.maxValue, data.image.channels() == 3);
+    };
+    if (!config.member.empty()) {
+        const std::size_t index = pack.find(config.member);
+        if (index == pack.size()) {
+            throw std::runtime_error("打包文件中没有成员: " + config.member);
+        }
+        save(config.outputPath, pack.decode(index, context, dictionary));
+        std::cout << "解压完成，结果已保存到: " << config.outputPath << std::endl;
+        return;
+    }
+
+    fs::create_directories(config.outputPath);
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < pack.size(); ++i) {
+        const PackEntry entry = pack.entry(i);
+        // names become file names, so they must not leave the output directory
+        if (entry.name == "." || entry.name == ".." || entry.name.find_first_of("/\\") != std::string_view::npos) {
+            throw std::runtime_error("打包成员名称非法: " + std::string(entry.name));
+        }
+        const std::string extension = entry.channels == 3 ? ".ppm" : ".pgm";
+        try {
+            save((fs::path(config.outputPath) / std::string(entry.name)).string() + extension, pack.decode(i, context, dictionary));
+        } catch (const std::exception& ex) {
+            throw std::runtime_error(std::string(entry.name) + ": " + ex.what());
+        }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "解压完成，" << pack.size() << " 个成员已写入: " << config.outputPath << '\n'
+              << "  " << framesPerSecond(pack.size(), elapsed) << " 文件/秒" << std::endl;
+}
+
+void runBatch(const CLIConfig& config, const std::vector<Operation>& operations, bool compress, bool decompress,
+              const std::shared_ptr<const HuffmanDictionary>& dictionary) {
+    // every input file directly inside the input directory, in name order; each result is
+    // written to the output directory under the input's name with the extension of its format
+    std::vector<std::string> inputs;
+    for (const auto& entry : fs::directory_iterator(config.inputPath)) {
+        const std::string extension = entry.path().extension().string();
+        const bool wanted = decompress ? extension == ".hfm" : (extension == ".ppm" || extension == ".pgm");
+        if (entry.is_regular_file() && wanted) {
+            inputs.push_back(entry.path().string());
+        }
+    }
+    std::sort(inputs.begin(), inputs.end());
+    fs::create_directories(config.outputPath);
+
+    std::set<std::string> outputs;
+    const auto outputFor = [&config, &outputs, compress](const std::string& input, const cv::Mat& image) {
+        const char* extension = compress ? ".hfm" : (image.channels() == 3 ? ".ppm" : ".pgm");
+        const std::string output = (fs::path(config.outputPath) / fs::path(input).stem()).string() + extension;
+        if (!outputs.insert(output).second) {
+            throw std::runtime_error("批处理输出文件名冲突: " + output);
+        }
+        return output;
+    };
+
+    CompressionContext compression;
+    DecompressionContext decompression;
+    CompressionOptions options;
+    options.nearLossless = config.nearLossless;
+    options.level = config.level;
+    options.dictionary = dictionary;
+
+    const auto decode = [&](ImageData data) {
+        return decompress ? std::move(data.image) : applyOperations(std::move(data.image), operations);
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::string backend = "stream";
+    if (config.ioBackend == "stream") {
+        // the per-file ifstream/ofstream path, kept for comparison
+        for (const std::string& input : inputs) {
+            try {
+                ImageData data = decompress ? ImageLoader::decompress(input, decompression, dictionary.get()) : ImageLoader::load(input);
+                const int maxValue = data.maxValue;
+                const cv::Mat result = decode(std::move(data));
+                const std::string output = outputFor(input, result);
+                if (compress) {
+                    ImageLoader::compress(output, result, maxValue, compression, options);
+                } else {
+                    ImageLoader::save(output, result, maxValue, result.channels() == 3);
                 }
+            } catch (const std::exception& ex) {
+                throw std::runtime_error(input + ": " + ex.what());
             }
-            
-            const ImageData data = ImageLoader::decompress(config.inputPath);
-            const bool useBinaryColor = (data.image.depth() == CV_8U && data.image.channels() == 3);
-            if (hasShow) {
-                showImage(data.image, "result");
+        }
+    } else {
+        FileIO::Backend requested = FileIO::Backend::Auto;
+        if (config.ioBackend == "uring") {
+            requested = FileIO::Backend::IoUring;
+        } else if (config.ioBackend == "pread") {
+            requested = FileIO::Backend::Threads;
+        }
+        // reads run ioDepth files ahead and results are written behind, so the
+        // codec only waits on storage when it outpaces it
+        FileIO::BatchIO io(inputs, config.ioDepth, requested);
+        backend = FileIO::backendName(io.backend());
+        std::vector<char> bytes;
+        for (const std::string& input : inputs) {
+            io.nextInput(bytes);
+            try {
+                ImageData data = decompress ? ImageLoader::decompressFromMemory(bytes, decompression, dictionary.get())
+                                            : ImageLoader::loadFromMemory(bytes);
+                const int maxValue = data.maxValue;
+                const cv::Mat result = decode(std::move(data));
+                const std::string output = outputFor(input, result);
+                std::vector<char> encoded;
+                if (compress) {
+                    ImageLoader::compressToMemory(encoded, result, maxValue, compression, options);
+                } else {
+                    encoded = ImageLoader::saveToMemory(result, maxValue, result.channels() == 3);
+                }
+                io.write(output, std::move(encoded));
+            } catch (const std::exception& ex) {
+                throw std::runtime_error(input + ": " + ex.what());
             }
-            ImageLoader::save(config.outputPath, data.image, data.maxValue, useBinaryColor);
-            std::cout << "解压完成，结果已保存到: " << config.outputPath << std::endl;
-            return EXIT_SUCCESS;
         }
+        io.finish();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
 
-        if (hasTripleDump) {
-            if (config.operations.size() != 1) {
-                throw std::runtime_error("仅支持单独使用 -t");
+    std::cout << "批处理完成，" << inputs.size() << " 个文件已写入: " << config.outputPath << '\n'
+              << "  " << framesPerSecond(inputs.size(), elapsed) << " 文件/秒 (I/O: " << backend;
+    if (backend != "stream") {
+        std::cout << ", 队列深度 " << config.ioDepth;
+    }
+    std::cout << ")" << std::endl;
+}
+
+void runCommand(const CLIConfig& config, std::ostream* profile) {
+    bool hasDecompress = false;
+    bool hasTripleDump = false;
+    bool hasShow = false;
+    for (const auto& op : config.operations) {
+        hasDecompress |= (op.type == OperationType::Decompress);
+        hasTripleDump |= (op.type == OperationType::DumpTriples);
+        hasShow |= (op.type == OperationType::Show);
+    }
+    if (config.pack || config.list) {
+        if (config.pack && config.list) {
+            throw std::runtime_error("--pack 与 --list 不能同时使用");
+        }
+        if (!config.operations.empty() || config.trainDictionary || !config.dictionaryPath.empty() || !config.member.empty() ||
+            config.sequence || config.keyframeGiven || !config.frameRange.empty() || config.maxMemoryMB > 0 ||
+            config.nearLossless > 0 || config.verify || config.level != CompressionLevel::Default) {
+            throw std::runtime_error("--pack 与 --list 不能与其他操作一起使用");
+        }
+        if (config.list) {
+            if (config.ioOptionsGiven) {
+                throw std::runtime_error("--io-depth 与 --io-backend 仅用于输入为目录的批处理");
+            }
+            listPack(config);
+        } else {
+            if (config.ioBackend != "auto") {
+                throw std::runtime_error("--pack 仅支持 --io-depth，I/O 后端自动选择");
             }
+            packDirectory(config);
+        }
+        return;
+    }
+    if (!config.member.empty() && !hasDecompress) {
+        throw std::runtime_error("--member 仅可用于解压打包文件");
+    }
+    if (config.maxMemoryMB > 0 && (config.trainDictionary || config.sequence || hasDecompress || hasTripleDump)) {
+        throw std::runtime_error("--max-memory 仅可用于 -g、-r、-s、-c 组成的操作序列");
+    }
+    const bool batch = !config.trainDictionary && fs::is_directory(config.inputPath);
+    if (batch && (hasShow || hasTripleDump)) {
+        throw std::runtime_error("目录批处理不支持 -s 与 -t");
+    }
+    if (batch && (config.verify || config.sequence || config.maxMemoryMB > 0 || !config.frameRange.empty())) {
+        throw std::runtime_error("目录批处理不支持 --verify、--sequence、--frames 与 --max-memory");
+    }
+    if (!batch && config.ioOptionsGiven) {
+        throw std::runtime_error("--io-depth 与 --io-backend 仅用于输入为目录的批处理");
+    }
 
-            const ImageData data = ImageLoader::load(config.inputPath);
-            ImageLoader::saveTriples(config.outputPath, data.image, data.maxValue);
-            std::cout << "三元组导出完成，已写入: " << config.outputPath << std::endl;
-            return EXIT_SUCCESS;
+    if (config.trainDictionary) {
+        if (!config.operations.empty() || !config.dictionaryPath.empty()) {
+            throw std::runtime_error("--train-dict 不能与其他操作一起使用");
         }
-        
-        std::vector<Operation> pipelineOps;
-        pipelineOps.reserve(config.operations.size());
-        bool hadCompress = false;
+        trainDictionary(config);
+        return;
+    }
+    std::shared_ptr<const HuffmanDictionary> dictionary;
+    if (!config.dictionaryPath.empty()) {
+        dictionary = HuffmanDictionary::load(config.dictionaryPath);
+    }
+
+    if (hasDecompress) {
         for (std::size_t i = 0; i < config.operations.size(); ++i) {
-            const auto& op = config.operations[i];
-            if (op.type == OperationType::Compress) {
-                if (hadCompress) {
-                    throw std::runtime_error("-c 不能重复出现");
-                }
+            const auto type = config.operations[i].type;
+            if (type == OperationType::Show) {
                 if (i + 1 != config.operations.size()) {
-                    throw std::runtime_error("-c 必须位于操作序列末尾");
+                    throw std::runtime_error("-s 必须位于操作序列末尾");
                 }
-                hadCompress = true;
-            } else {
-                pipelineOps.push_back(op);
+                continue;
+            }
+            if (type != OperationType::Decompress) {
+                throw std::runtime_error("解压模式下仅支持 -x 以及可选的 -s");
             }
         }
+        
+        if (config.sequence || config.keyframeGiven) {
+            throw std::runtime_error("--sequence 与 --keyframe 仅可与 -c 一起使用");
+        }
+        if (batch) {
+            runBatch(config, {}, false, true, dictionary);
+            return;
+        }
+        if (ImagePack::isPack(config.inputPath)) {
+            if (hasShow || !config.frameRange.empty()) {
+                throw std::runtime_error("打包文件解压不支持 -s 与 --frames");
+            }
+            extractPack(config, dictionary.get());
+            return;
+        }
+        if (!config.member.empty()) {
+            throw std::runtime_error("--member 仅可用于解压打包文件");
+        }
+        if (ImageLoader::isSequence(config.inputPath)) {
+            if (dictionary) {
+                throw std::runtime_error("序列文件不使用共享字典");
+            }
+            if (hasShow) {
+                throw std::runtime_error("序列文件解压不支持 -s");
+            }
+            decompressSequence(config);
+            return;
+        }
+        if (!config.frameRange.empty()) {
+            throw std::runtime_error("--frames 仅可用于解压序列文件");
+        }
+
+        const ImageData data = ImageLoader::decompress(config.inputPath, dictionary.get());
+        const bool useBinaryColor = (data.image.depth() == CV_8U && data.image.channels() == 3);
+        if (hasShow) {
+            showImage(data.image, "result");
+        }
+        ImageLoader::save(config.outputPath, data.image, data.maxValue, useBinaryColor);
+        std::cout << "解压完成，结果已保存到: " << config.outputPath << std::endl;
+        return;
+    }
 
-        int maxValue = 255;
-        bool preferBinaryColor = false;
-        const cv::Mat result = runOperations(config.inputPath, pipelineOps, maxValue, preferBinaryColor);
+    if (hasTripleDump) {
+        if (config.operations.size() != 1) {
+            throw std::runtime_error("仅支持单独使用 -t");
+        }
 
-        if (hadCompress) {
-            ImageLoader::compress(config.outputPath, result, maxValue);
-            std::cout << "压缩完成，已写入: " << config.outputPath << std::endl;
+        const ImageData data = ImageLoader::load(config.inputPath);
+        ImageLoader::saveTriples(config.outputPath, data.image, data.maxValue);
+        std::cout << "三元组导出完成，已写入: " << config.outputPath << std::endl;
+        return;
+    }
+    
+    std::vector<Operation> pipelineOps;
+    pipelineOps.reserve(config.operations.size());
+    bool hadCompress = false;
+    for (std::size_t i = 0; i < config.operations.size(); ++i) {
+        const auto& op = config.operations[i];
+        if (op.type == OperationType::Compress) {
+            if (hadCompress) {
+                throw std::runtime_error("-c 不能重复出现");
+            }
+            if (i + 1 != config.operations.size()) {
+                throw std::runtime_error("-c 必须位于操作序列末尾");
+            }
+            hadCompress = true;
         } else {
-            ImageLoader::save(config.outputPath, result, maxValue, preferBinaryColor);
-            std::cout << "处理完成，已保存到: " << config.outputPath << std::endl;
+            pipelineOps.push_back(op);
+        }
+    }
+
+    if (!hadCompress && (config.nearLossless > 0 || config.verify || config.level != CompressionLevel::Default)) {
+        throw std::runtime_error("--near、--level 与 --verify 仅可与 -c 一起使用");
+    }
+    if (config.level == CompressionLevel::Archive && config.nearLossless > 0) {
+        throw std::runtime_error("归档级别仅支持无损压缩");
+    }
+    if (!hadCompress && dictionary) {
+        throw std::runtime_error("--dict 仅可与 -c 或 -x 一起使用");
+    }
+    if (!config.frameRange.empty()) {
+        throw std::runtime_error("--frames 仅可用于解压序列文件");
+    }
+    if (config.keyframeGiven && !config.sequence) {
+        throw std::runtime_error("--keyframe 需要与 --sequence 一起使用");
+    }
+    if (batch) {
+        runBatch(config, pipelineOps, hadCompress, false, dictionary);
+        return;
+    }
+    if (config.sequence) {
+        if (!hadCompress || !pipelineOps.empty()) {
+            throw std::runtime_error("--sequence 仅支持单独使用 -c");
+        }
+        if (config.nearLossless > 0) {
+            throw std::runtime_error("序列压缩暂不支持 --near");
+        }
+        if (config.level != CompressionLevel::Default) {
+            throw std::runtime_error("序列压缩暂不支持 --level");
+        }
+        if (dictionary) {
+            throw std::runtime_error("序列压缩不使用共享字典");
+        }
+        compressSequence(config);
+        return;
+    }
+
+    const int bandRows = chooseBandRows(planMemory(config.inputPath, config.operations), config.maxMemoryMB << 20);
+    if (bandRows > 0) {
+        runTiledOperations(config.inputPath, config.outputPath, pipelineOps, bandRows);
+        std::cout << "处理完成（分块），已保存到: " << config.outputPath << std::endl;
+        return;
+    }
+
+    ImageData data = ImageLoader::load(config.inputPath);
+    const int maxValue = data.maxValue;
+
+    // Mask-like inputs compressed losslessly skip the dense pipeline: -g, -r and -c
+    // then cost time in proportion to the non-zero pixels. Without -c the result is
+    // written densely anyway, and the conversions cost more than they save.
+    const bool sparseCandidate =
+        hadCompress && !hasShow && config.nearLossless == 0 && config.level == CompressionLevel::Default;
+    const std::optional<SparseImage> sparse =
+        sparseCandidate ? SparseImage::fromDenseIfSparse(data.image, kSparseDensityThreshold) : std::nullopt;
+    if (sparse) {
+        data.image.release();
+        if (profile) {
+            *profile << "[profile] 稀疏路径: 非零像素占 " << sparse->density() * 100.0 << "%\n";
+        }
+        const SparseImage result = applySparseOperations(*sparse, pipelineOps);
+        CompressionOptions options;
+        options.dictionary = dictionary;
+        const CompressionSummary summary = ImageLoader::compress(config.outputPath, result, maxValue, options);
+        if (profile) {
+            printCompressionSummary(*profile, summary);
+        }
+        std::cout << "压缩完成，已写入: " << config.outputPath << std::endl;
+        if (config.verify) {
+            verifyCompressed(config.outputPath, result.toDense(), 0, dictionary.get());
+        }
+        return;
+    }
+
+    // the loaded image is handed over rather than copied, so at most the
+    // current image and the result of one operation are alive at a time
+    const cv::Mat result = applyOperations(std::move(data.image), pipelineOps);
+    const bool preferBinaryColor = (result.depth() == CV_8U && result.channels() == 3);
+
+    if (hadCompress) {
+        CompressionOptions options;
+        options.nearLossless = config.nearLossless;
+        options.level = config.level;
+        options.dictionary = dictionary;
+        const CompressionSummary summary = ImageLoader::compress(config.outputPath, result, maxValue, options);
+        if (profile) {
+            printCompressionSummary(*profile, summary);
+        }
+        std::cout << "压缩完成，已写入: " << config.outputPath << std::endl;
+        if (config.verify) {
+            verifyCompressed(config.outputPath, result, config.nearLossless, dictionary.get());
+        }
+    } else {
+        ImageLoader::save(config.outputPath, result, maxValue, preferBinaryColor);
+        std::cout << "处理完成，已保存到: " << config.outputPath << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const CLIConfig config = parseArguments(argc, argv);
+        const auto start = std::chrono::steady_clock::now();
+
+        // directory inputs (training, batches) have no single input file to key on, and packs
+        // are meant to be read in part, so hashing the whole file would cost more than the work
+        bool cacheable = !config.cacheDirectory.empty() && !config.trainDictionary && !config.pack && !config.list &&
+                         !fs::is_directory(config.inputPath) && !ImagePack::isPack(config.inputPath);
+        for (const auto& op : config.operations) {
+            cacheable &= (op.type != OperationType::Show);
+        }
+
+        std::unique_ptr<ResultCache> cache;
+        std::string cacheKey;
+        bool servedFromCache = false;
+        if (cacheable) {
+            cache = std::make_unique<ResultCache>(config.cacheDirectory, config.cacheSizeMB * 1024 * 1024);
+            cacheKey = cache->makeKey(config.inputPath, buildRecipe(config));
+            if (cache->fetch(cacheKey, config.outputPath)) {
+                servedFromCache = true;
+                std::cout << "命中缓存，结果已保存到: " << config.outputPath << std::endl;
+            }
+        }
+
+        if (!servedFromCache) {
+            runCommand(config, config.profile ? &std::cout : nullptr);
+            if (cache) {
+                try {
+                    cache->store(cacheKey, config.outputPath);
+                } catch (const std::exception& ex) {
+                    // the result itself is complete; a failed cache write is only worth a warning
+                    std::cerr << "警告: " << ex.what() << std::endl;
+                }
+            }
+        }
+
+        if (config.profile) {
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            printProfile(std::cout, elapsed.count(), cache.get());
         }
     } catch (const std::exception& ex) {
         std::cerr << "错误: " << ex.what() << std::endl;
@@ -0,0 +1,153 @@
+// Code lengths must stay within kMaxCodeLength however large and skewed the
+// plane. Planes with wide sizes hold more than 2^32 samples, enough for
+// Fibonacci-like counts, the worst case for Huffman depth, to need codes of
+// 40 bits and more. Such histograms are built directly here, since images
+// that large do not fit in memory. Smaller histograms must keep the plain
+// Huffman lengths, so files written before the limit are unchanged.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "HuffmanCode.hpp"
+
+namespace {
+
+using Histogram = std::array<std::uint64_t, 256>;
+using Lengths = std::array<std::uint8_t, 256>;
+
+std::mt19937_64 rng(20260718);
+int failures = 0;
+
+void expect(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cerr << what << '\n';
+        ++failures;
+    }
+}
+
+std::uint64_t total(const Histogram& histogram) {
+    std::uint64_t sum = 0;
+    for (std::uint64_t count : histogram) {
+        sum += count;
+    }
+    return sum;
+}
+
+Histogram fibonacci(int symbols) {
+    // counts 1, 1, 2, 3, 5, ... spread over the symbols in a shuffled order
+    Histogram histogram{};
+    std::array<int, 256> order{};
+    for (int i = 0; i < 256; ++i) {
+        order[static_cast<std::size_t>(i)] = i;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+    std::uint64_t previous = 0;
+    std::uint64_t current = 1;
+    for (int i = 0; i < symbols; ++i) {
+        histogram[static_cast<std::size_t>(order[static_cast<std::size_t>(i)])] = current;
+        const std::uint64_t next = previous + current;
+        previous = current;
+        current = next;
+    }
+    return histogram;
+}
+
+void checkCode(const Histogram& histogram, const Lengths& lengths, const std::string& name) {
+    // every used symbol has a code within the limit, and the code is prefix-free and complete
+    std::uint64_t kraft = 0;
+    int used = 0;
+    for (std::size_t symbol = 0; symbol < 256; ++symbol) {
+        if (histogram[symbol] == 0) {
+            expect(lengths[symbol] == 0, name + ": 未出现的符号分配了码字");
+            continue;
+        }
+        ++used;
+        if (lengths[symbol] == 0 || lengths[symbol] > kMaxCodeLength) {
+            expect(false, name + ": 码长 " + std::to_string(lengths[symbol]) + " 超出范围");
+            return;
+        }
+        kraft += std::uint64_t{1} << (kMaxCodeLength - lengths[symbol]);
+    }
+    const std::uint64_t complete = std::uint64_t{1} << kMaxCodeLength;
+    expect(used == 1 ? kraft == complete / 2 : kraft == complete, name + ": 码长不构成完整的前缀码");
+
+    // canonical codes of each length are distinct and fit in their length
+    const HuffmanTable table = buildCanonicalTable(lengths);
+    for (std::size_t a = 0; a < 256; ++a) {
+        if (lengths[a] == 0) {
+            continue;
+        }
+        expect(table.codes[a] >> lengths[a] == 0, name + ": 规范码超出码长");
+        for (std::size_t b = a + 1; b < 256; ++b) {
+            if (lengths[b] == 0) {
+                continue;
+            }
+            const std::uint8_t shorter = std::min(lengths[a], lengths[b]);
+            expect(table.codes[a] >> (lengths[a] - shorter) != table.codes[b] >> (lengths[b] - shorter),
+                   name + ": 规范码不是前缀码");
+        }
+    }
+}
+
+void testLimited() {
+    // 60 Fibonacci counts add up to about 4e12 samples, far past 2^32
+    for (int symbols : {40, 47, 48, 60, 90}) {
+        const Histogram histogram = fibonacci(symbols);
+        const std::string name = "斐波那契 " + std::to_string(symbols) + " 个符号, 共 " + std::to_string(total(histogram));
+        checkCode(histogram, buildCodeLengths(histogram), name);
+    }
+
+    // one dominant residual of a 2^33-sample plane, the rest seen once or a few times
+    Histogram skewed{};
+    skewed[0] = std::uint64_t{1} << 33;
+    for (std::size_t symbol = 1; symbol < 256; ++symbol) {
+        skewed[symbol] = symbol % 7 == 0 ? 1 : (std::uint64_t{1} << (symbol % 40));
+    }
+    checkCode(skewed, buildCodeLengths(skewed), "偏斜直方图");
+}
+
+void testUnchangedBelowLimit() {
+    // 32 Fibonacci counts give lengths 1, 2, ..., 30, 31, 31: the plain tree, untouched
+    const Histogram histogram = fibonacci(32);
+    const Lengths lengths = buildCodeLengths(histogram);
+    checkCode(histogram, lengths, "斐波那契 32 个符号");
+    std::array<int, 32> perLength{};
+    for (std::uint8_t length : lengths) {
+        if (length > 0) {
+            ++perLength[length];
+        }
+    }
+    bool plain = perLength[31] == 2;
+    for (int length = 1; length < 31; ++length) {
+        plain = plain && perLength[static_cast<std::size_t>(length)] == 1;
+    }
+    expect(plain, "码长未超限时不应改变哈夫曼树");
+
+    // random histograms of realistic planes
+    for (int i = 0; i < 200; ++i) {
+        Histogram random{};
+        const int symbols = std::uniform_int_distribution<int>(1, 256)(rng);
+        for (int symbol = 0; symbol < symbols; ++symbol) {
+            random[static_cast<std::size_t>(symbol)] = std::uniform_int_distribution<std::uint64_t>(1, 1000000)(rng);
+        }
+        checkCode(random, buildCodeLengths(random), "随机直方图");
+    }
+}
+
+} // namespace
+
+int main() {
+    testLimited();
+    testUnchangedBelowLimit();
+    if (failures > 0) {
+        std::cerr << failures << " 项检查失败\n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "哈夫曼码长均不超过 " << static_cast<int>(kMaxCodeLength) << " 位\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+// Images whose pixel data runs past 2^31 and 2^32 bytes. The inputs are
+// sparse files, so they take almost no disk space until imagick writes its
+// output. Each input goes through the imagick executable given on the command
+// line: -r 100 must give back a file of the same size with the marker pixels
+// at the same offsets, and -g -r 3 must give the scaled dimensions. Both runs
+// get a small --max-memory, so they only succeed on the tiled path.
+//
+// Usage: large_image_test <imagick> <scratch directory>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+
+struct Case {
+    const char* name;
+    int width;
+    int height;
+    std::uint64_t boundary;     // the pixel data must run past this many bytes
+};
+
+constexpr Case kCases[] = {
+    {"2^31", 40000, 17900, std::uint64_t{1} << 31},
+    {"2^32", 40000, 35800, std::uint64_t{1} << 32},
+};
+
+constexpr std::array<std::uint8_t, 3> kFirstMarker = {1, 2, 3};         // first pixel of the last row
+constexpr std::array<std::uint8_t, 3> kLastMarker = {250, 251, 252};    // last pixel
+
+int failures = 0;
+
+void expect(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << message << '\n';
+        ++failures;
+    }
+}
+
+std::string header(const Case& c) {
+    return "P6\n" + std::to_string(c.width) + ' ' + std::to_string(c.height) + "\n255\n";
+}
+
+std::uint64_t pixelOffset(const Case& c, int row, int col) {
+    return header(c).size() + (static_cast<std::uint64_t>(row) * c.width + col) * 3;
+}
+
+bool createSparsePpm(const std::string& path, const Case& c) {
+    // header and markers are the only blocks written; the rest is a hole of zeros
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    const std::string text = header(c);
+    const std::uint64_t size = pixelOffset(c, c.height, 0);
+    bool ok = ::write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size()) &&
+              ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+    ok = ok && ::pwrite(fd, kFirstMarker.data(), 3, static_cast<off_t>(pixelOffset(c, c.height - 1, 0))) == 3;
+    ok = ok && ::pwrite(fd, kLastMarker.data(), 3, static_cast<off_t>(pixelOffset(c, c.height - 1, c.width - 1))) == 3;
+    return ::close(fd) == 0 && ok;
+}
+
+std::uint64_t fileSize(const std::string& path) {
+    struct stat info {};
+    return ::stat(path.c_str(), &info) == 0 ? static_cast<std::uint64_t>(info.st_size) : 0;
+}
+
+std::array<std::uint8_t, 3> pixelAt(const std::string& path, std::uint64_t offset) {
+    std::array<std::uint8_t, 3> pixel{};
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        if (::pread(fd, pixel.data(), 3, static_cast<off_t>(offset)) != 3) {
+            pixel = {};
+        }
+        ::close(fd);
+    }
+    return pixel;
+}
+
+bool readDimensions(const std::string& path, std::string& magic, long long& width, long long& height) {
+    // the outputs are written without header comments
+    std::ifstream in(path, std::ios::binary);
+    return static_cast<bool>(in >> magic >> width >> height);
+}
+
+bool run(const std::string& imagick, const std::string& arguments) {
+    const std::string command = '"' + imagick + "\" --max-memory 64 " + arguments;
+    return std::system(command.c_str()) == 0;
+}
+
+void testCase(const std::string& imagick, const std::string& directory, const Case& c) {
+    const std::string input = directory + "/large_" + std::to_string(c.height) + ".ppm";
+    const std::string copy = directory + "/large_" + std::to_string(c.height) + "_copy.ppm";
+    const std::string small = directory + "/large_" + std::to_string(c.height) + "_small.pgm";
+    const std::string label = std::string("[") + c.name + "] ";
+
+    if (!createSparsePpm(input, c)) {
+        expect(false, label + "无法创建稀疏文件 " + input);
+        return;
+    }
+    const std::uint64_t inputSize = fileSize(input);
+    expect(pixelOffset(c, c.height - 1, 0) > c.boundary, label + "末行标记没有越过边界");
+
+    // -r 100 streams every row through the tiled pipeline unchanged
+    if (run(imagick, "-r 100 \"" + input + "\" \"" + copy + "\"")) {
+        expect(fileSize(copy) == inputSize, label + "-r 100 输出大小 " + std::to_string(fileSize(copy)) + " 与输入 " +
+                                                std::to_string(inputSize) + " 不同");
+        expect(pixelAt(copy, pixelOffset(c, c.height - 1, 0)) == kFirstMarker, label + "末行首像素未原样写出");
+        expect(pixelAt(copy, pixelOffset(c, c.height - 1, c.width - 1)) == kLastMarker, label + "末像素未原样写出");
+        expect(pixelAt(copy, pixelOffset(c, c.height / 2, c.width / 2)) == std::array<std::uint8_t, 3>{},
+               label + "中间像素不为 0");
+    } else {
+        expect(false, label + "-r 100 运行失败");
+    }
+    std::remove(copy.c_str());
+
+    if (run(imagick, "-g -r 3 \"" + input + "\" \"" + small + "\"")) {
+        std::string magic;
+        long long width = 0;
+        long long height = 0;
+        expect(readDimensions(small, magic, width, height) && magic == "P2" && width == c.width * 3 / 100 &&
+                   height == c.height * 3 / 100,
+               label + "-g -r 3 输出为 " + magic + ' ' + std::to_string(width) + 'x' + std::to_string(height));
+    } else {
+        expect(false, label + "-g -r 3 运行失败");
+    }
+    std::remove(small.c_str());
+    std::remove(input.c_str());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "用法: large_image_test <imagick> <临时目录>\n";
+        return EXIT_FAILURE;
+    }
+    for (const Case& c : kCases) {
+        testCase(argv[1], argv[2], c);
+    }
+    if (failures > 0) {
+        std::cerr << failures << " 项检查失败\n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "超过 2^31 与 2^32 字节的图像均正确分块处理\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+// Every kernel level must produce the same bytes as the scalar code. Each
+// kernel runs on random rows of widths 1..kMaxWidth at every level this CPU
+// supports, and the results are compared with the scalar level.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "PixelKernels.hpp"
+
+namespace {
+
+using PixelKernels::Level;
+
+constexpr int kMaxWidth = 200;
+constexpr int kWeightScale = 1 << 11;
+
+std::mt19937 rng(20260718);
+int failures = 0;
+
+int uniform(int low, int high) {
+    return std::uniform_int_distribution<int>(low, high)(rng);
+}
+
+std::vector<std::uint8_t> randomBytes(std::size_t size, int zeroPercent) {
+    // zeroPercent of the bytes are 0, so that sparse-aware kernels see runs of zeros
+    std::vector<std::uint8_t> bytes(size);
+    for (auto& byte : bytes) {
+        byte = uniform(0, 99) < zeroPercent ? 0 : static_cast<std::uint8_t>(uniform(0, 255));
+    }
+    return bytes;
+}
+
+std::vector<Level> levels() {
+    std::vector<Level> result;
+    for (Level level : {Level::Scalar, Level::SSE2, Level::AVX2}) {
+        if (level <= PixelKernels::detectedLevel()) {
+            result.push_back(level);
+        }
+    }
+    return result;
+}
+
+template <typename Run>
+void expectSameAtEveryLevel(const std::string& kernel, int width, int channels, Run run) {
+    // run() returns the kernel output at the active level
+    PixelKernels::setLevel(Level::Scalar);
+    const auto expected = run();
+    for (Level level : levels()) {
+        PixelKernels::setLevel(level);
+        if (run() != expected) {
+            std::cerr << kernel << ": " << PixelKernels::levelName(level) << " 与 scalar 不一致 (宽度 " << width
+                      << ", 通道 " << channels << ")\n";
+            ++failures;
+        }
+    }
+}
+
+void testResiduals(int width, int channels) {
+    const auto row = randomBytes(static_cast<std::size_t>(width * channels), 0);
+    const auto difference = [&] {
+        std::vector<std::vector<std::uint8_t>> planes(static_cast<std::size_t>(channels),
+                                                      std::vector<std::uint8_t>(static_cast<std::size_t>(width)));
+        std::uint8_t* pointers[3] = {};
+        for (int ch = 0; ch < channels; ++ch) {
+            pointers[ch] = planes[static_cast<std::size_t>(ch)].data();
+        }
+        PixelKernels::leftDifference(row.data(), width, channels, pointers);
+        return planes;
+    };
+    expectSameAtEveryLevel("leftDifference", width, channels, difference);
+
+    PixelKernels::setLevel(Level::Scalar);
+    const auto planes = difference();
+    const auto reconstruct = [&] {
+        const std::uint8_t* pointers[3] = {};
+        for (int ch = 0; ch < channels; ++ch) {
+            pointers[ch] = planes[static_cast<std::size_t>(ch)].data();
+        }
+        std::vector<std::uint8_t> out(row.size());
+        PixelKernels::reconstructInterleaved(pointers, width, channels, out.data());
+        return out;
+    };
+    expectSameAtEveryLevel("reconstructInterleaved", width, channels, reconstruct);
+    if (reconstruct() != row) {
+        std::cerr << "reconstructInterleaved 未还原 leftDifference 的输入 (宽度 " << width << ")\n";
+        ++failures;
+    }
+}
+
+void testSparseScans(int width, int channels) {
+    const auto row = randomBytes(static_cast<std::size_t>(width * channels), 95);
+    expectSameAtEveryLevel("countNonZeroPixels", width, channels,
+                           [&] { return PixelKernels::countNonZeroPixels(row.data(), width, channels); });
+    expectSameAtEveryLevel("findNonZero", width, channels,
+                           [&] { return PixelKernels::findNonZero(row.data(), row.size()); });
+}
+
+std::vector<std::int16_t> randomWeightPairs(std::size_t pairs) {
+    // tap weights of one sample add up to 1.0 in 11-bit fixed point, as the resampler's do
+    std::vector<std::int16_t> weights(2 * pairs);
+    for (std::size_t i = 0; i < pairs; ++i) {
+        weights[2 * i] = static_cast<std::int16_t>(uniform(0, kWeightScale));
+        weights[2 * i + 1] = static_cast<std::int16_t>(kWeightScale - weights[2 * i]);
+    }
+    return weights;
+}
+
+void testResampleRow(int width, int channels) {
+    // step is the distance between the taps: the next pixel, or 0 for one-pixel rows
+    const int step = width > 1 ? channels : 0;
+    const int rowBytes = width * channels;
+    const auto row = randomBytes(static_cast<std::size_t>(rowBytes), 0);
+    const int outWidth = uniform(1, kMaxWidth);
+    const std::size_t count = static_cast<std::size_t>(outWidth * channels);
+
+    // ascending first taps, as scaling produces; the channels of a pixel share its weights
+    std::vector<int> firstTaps(static_cast<std::size_t>(outWidth));
+    for (int& tap : firstTaps) {
+        tap = uniform(0, std::max(0, width - 2));
+    }
+    std::sort(firstTaps.begin(), firstTaps.end());
+    std::vector<std::int32_t> offsets(count);
+    const auto pixelWeights = randomWeightPairs(static_cast<std::size_t>(outWidth));
+    std::vector<std::int16_t> weights(2 * count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::size_t pixel = i / static_cast<std::size_t>(channels);
+        offsets[i] = firstTaps[pixel] * channels + static_cast<int>(i % static_cast<std::size_t>(channels));
+        weights[2 * i] = pixelWeights[2 * pixel];
+        weights[2 * i + 1] = pixelWeights[2 * pixel + 1];
+    }
+    std::size_t gatherSafe = 0;
+    while (gatherSafe < count && offsets[gatherSafe] + 8 <= rowBytes) {
+        ++gatherSafe;
+    }
+    expectSameAtEveryLevel("resampleRow", width, channels, [&] {
+        std::vector<std::int16_t> out(count);
+        PixelKernels::resampleRow(row.data(), offsets.data(), weights.data(), step, count, gatherSafe, out.data());
+        return out;
+    });
+
+    if (rowBytes < 16) {
+        return;
+    }
+    // groups of 8 samples with both taps inside a 16-byte window
+    const std::size_t local = count - count % 8;
+    std::vector<std::int32_t> windows(local / 8);
+    std::vector<std::uint8_t> shuffles(2 * local);
+    for (std::size_t g = 0; g < windows.size(); ++g) {
+        windows[g] = uniform(0, rowBytes - 16);
+        for (std::size_t i = 8 * g; i < 8 * g + 8; ++i) {
+            const int position = uniform(0, 15 - step);
+            shuffles[2 * i] = static_cast<std::uint8_t>(position);
+            shuffles[2 * i + 1] = static_cast<std::uint8_t>(position + step);
+        }
+    }
+    expectSameAtEveryLevel("resampleRowLocal", width, channels, [&] {
+        std::vector<std::int16_t> out(local);
+        PixelKernels::resampleRowLocal(row.data(), windows.data(), weights.data(), shuffles.data(), local, out.data());
+        return out;
+    });
+}
+
+void testBlendRows(int width, int channels) {
+    // horizontal samples lie in [0, 255 << 7]
+    const std::size_t count = static_cast<std::size_t>(width * channels);
+    std::vector<std::int16_t> top(count);
+    std::vector<std::int16_t> bottom(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        top[i] = static_cast<std::int16_t>(uniform(0, 255 << 7));
+        bottom[i] = static_cast<std::int16_t>(uniform(0, 255 << 7));
+    }
+    const auto rowWeights = randomWeightPairs(1);
+    expectSameAtEveryLevel("blendRows", width, channels, [&] {
+        std::vector<std::uint8_t> out(count);
+        PixelKernels::blendRows(top.data(), bottom.data(), rowWeights[0], rowWeights[1], count, out.data());
+        return out;
+    });
+}
+
+} // namespace
+
+int main() {
+    for (int width = 1; width <= kMaxWidth; ++width) {
+        for (int channels : {1, 3}) {
+            testResiduals(width, channels);
+            testSparseScans(width, channels);
+            testResampleRow(width, channels);
+            testBlendRows(width, channels);
+        }
+    }
+    if (failures > 0) {
+        std::cerr << failures << " 项检查失败\n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "PixelKernels: 所有级别与 scalar 一致 (" << levels().size() << " 个级别)\n";
+    return EXIT_SUCCESS;
+}